@@ -0,0 +1,413 @@
+// Throughput benchmark over deterministic synthetic corpora.
+//
+// Every corpus is generated from a fixed seed, so runs are comparable across
+// commits. Each result is printed as one JSON object per line:
+//   {"corpus": "strings", "op": "parse", "bytes": ..., "seconds": ...,
+//    "mb_per_s": ..., "allocs": ..., "frees": ..., "alloc_bytes": ...,
+//    "peak_rss_kb": ...}
+// seconds is the best of --reps runs. allocs/frees/alloc_bytes count the
+// allocator calls of one run (-1 where the allocator cannot be intercepted).
+// peak_rss_kb is the peak of the process that benchmarked the corpus.
+//
+// Usage: json_bench [--size MB] [--reps N] [corpus...]
+
+#include "json.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BENCH_FORK
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define DEFAULT_SIZE_MB 16
+#define DEFAULT_REPS 3
+
+#ifdef BENCH_COUNT_ALLOCS
+// Linked with --wrap, so every allocation of the library passes through here
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static long long alloc_count, free_count, alloc_bytes;
+
+void *__wrap_malloc(size_t size) {
+  alloc_count++;
+  alloc_bytes += size;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  alloc_count++;
+  alloc_bytes += count * size;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  alloc_count++;
+  alloc_bytes += size;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr != NULL)
+    free_count++;
+  __real_free(ptr);
+}
+#else
+static long long alloc_count = -1, free_count = -1, alloc_bytes = -1;
+#endif
+
+static void reset_alloc_counters(void) {
+#ifdef BENCH_COUNT_ALLOCS
+  alloc_count = 0;
+  free_count = 0;
+  alloc_bytes = 0;
+#endif
+}
+
+static double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Growing text buffer for the generators
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+  uint64_t rng;
+} Gen;
+
+static void gen_append(Gen *g, const char *str, size_t len) {
+  if (g->len + len + 1 > g->cap) {
+    while (g->len + len + 1 > g->cap)
+      g->cap = g->cap ? g->cap * 2 : 4096;
+    g->data = realloc(g->data, g->cap);
+  }
+  memcpy(g->data + g->len, str, len);
+  g->len += len;
+  g->data[g->len] = '\0';
+}
+
+static void gen_str(Gen *g, const char *str) {
+  gen_append(g, str, strlen(str));
+}
+
+static void gen_int(Gen *g, const char *fmt, long long value) {
+  char buf[64];
+  gen_append(g, buf, (size_t)snprintf(buf, sizeof(buf), fmt, value));
+}
+
+static void gen_double(Gen *g, const char *fmt, double value) {
+  char buf[64];
+  gen_append(g, buf, (size_t)snprintf(buf, sizeof(buf), fmt, value));
+}
+
+// xorshift64*
+static uint64_t gen_rand(Gen *g) {
+  g->rng ^= g->rng >> 12;
+  g->rng ^= g->rng << 25;
+  g->rng ^= g->rng >> 27;
+  return g->rng * UINT64_C(2685821657736338717);
+}
+
+static unsigned gen_below(Gen *g, unsigned n) {
+  return (unsigned)(gen_rand(g) >> 32) % n;
+}
+
+// The last three are escape-sequences
+static const char *WORDS[] = {
+    "lorem", "ipsum", "dolor", "sit",   "amet",     "json", "parser",
+    "arena", "value", "token", "quick", "brown",    "fox",  "jumps",
+    "over",  "lazy",  "dog",   "\\\"q\\\"", "\\n", "\\u00e9"};
+
+static void gen_text(Gen *g, unsigned words) {
+  gen_str(g, "\"");
+  for (unsigned i = 0; i < words; i++) {
+    if (i > 0)
+      gen_str(g, " ");
+    // Escapes are rarer than plain words
+    unsigned n = sizeof(WORDS) / sizeof(WORDS[0]);
+    gen_str(g, WORDS[gen_below(g, gen_below(g, 8) == 0 ? n : n - 3)]);
+  }
+  gen_str(g, "\"");
+}
+
+// Documents are separated by '\n', most corpora are a single document
+static void gen_strings(Gen *g, size_t size) {
+  gen_str(g, "[");
+  for (long long i = 0; g->len < size; i++) {
+    if (i > 0)
+      gen_str(g, ",");
+    gen_int(g, "{\"id\":\"%llx\",\"title\":", (long long)gen_rand(g));
+    gen_text(g, 4 + gen_below(g, 8));
+    gen_str(g, ",\"body\":");
+    gen_text(g, 20 + gen_below(g, 80));
+    gen_str(g, ",\"tags\":[");
+    gen_text(g, 1);
+    gen_str(g, ",");
+    gen_text(g, 1);
+    gen_str(g, "]}");
+  }
+  gen_str(g, "]");
+}
+
+static void gen_numbers(Gen *g, size_t size) {
+  gen_str(g, "[");
+  for (long long i = 0; g->len < size; i++) {
+    gen_str(g, i > 0 ? ",[" : "[");
+    for (int j = 0; j < 16; j++) {
+      if (j > 0)
+        gen_str(g, ",");
+      uint64_t r = gen_rand(g);
+      switch (j % 4) {
+      case 0:
+        gen_int(g, "%lld", (long long)(r % 1000));
+        break;
+      case 1:
+        gen_int(g, "%lld", (long long)(r >> 1));
+        break;
+      case 2:
+        gen_double(g, "%.6g", (double)(r % 1000000) / 1000.0);
+        break;
+      default:
+        gen_double(g, "%.17g", (double)(int64_t)r * 1e-12);
+        break;
+      }
+    }
+    gen_str(g, "]");
+  }
+  gen_str(g, "]");
+}
+
+static void gen_nested(Gen *g, size_t size) {
+  gen_str(g, "[");
+  for (long long i = 0; g->len < size; i++) {
+    if (i > 0)
+      gen_str(g, ",");
+    unsigned depth = 32 + gen_below(g, 64);
+    for (unsigned d = 0; d < depth; d++)
+      gen_str(g, d % 2 ? "[" : "{\"child\":");
+    gen_int(g, "%lld", i);
+    for (unsigned d = depth; d-- > 0;)
+      gen_str(g, d % 2 ? "]" : "}");
+  }
+  gen_str(g, "]");
+}
+
+static void gen_wide(Gen *g, size_t size) {
+  gen_str(g, "[");
+  for (long long i = 0; g->len < size; i++) {
+    gen_str(g, i > 0 ? ",{" : "{");
+    for (int k = 0; k < 512; k++) {
+      gen_int(g, k > 0 ? ",\"field_%lld\":" : "\"field_%lld\":", k);
+      if (k % 3 == 0)
+        gen_text(g, 1);
+      else
+        gen_int(g, "%lld", (long long)gen_below(g, 100000));
+    }
+    gen_str(g, "}");
+  }
+  gen_str(g, "]");
+}
+
+static void gen_small(Gen *g, size_t size) {
+  for (long long i = 0; g->len < size; i++) {
+    gen_int(g, "{\"id\":%lld,\"name\":", i);
+    gen_text(g, 2);
+    gen_double(g, ",\"score\":%.6g,\"active\":", gen_below(g, 10000) / 100.0);
+    gen_str(g, gen_below(g, 2) ? "true" : "false");
+    gen_str(g, ",\"parent\":null}\n");
+  }
+}
+
+typedef struct {
+  const char *name;
+  void (*gen)(Gen *, size_t);
+} Corpus;
+
+static const Corpus CORPORA[] = {
+    {"strings", gen_strings}, {"numbers", gen_numbers}, {"nested", gen_nested},
+    {"wide", gen_wide},       {"small", gen_small},
+};
+
+static long peak_rss_kb(void) {
+#ifdef BENCH_FORK
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#else
+  return -1;
+#endif
+}
+
+typedef struct {
+  double seconds;
+  long long allocs;
+  long long frees;
+  long long alloc_bytes;
+} Measure;
+
+static double measure_start(void) {
+  reset_alloc_counters();
+  return now();
+}
+
+static void measure_stop(Measure *m, double start) {
+  double seconds = now() - start;
+  if (m->seconds == 0 || seconds < m->seconds)
+    m->seconds = seconds;
+  m->allocs = alloc_count;
+  m->frees = free_count;
+  m->alloc_bytes = alloc_bytes;
+}
+
+static void report(const char *corpus, const char *op, size_t bytes,
+                   const Measure *m) {
+  printf("{\"corpus\": \"%s\", \"op\": \"%s\", \"bytes\": %zu, "
+         "\"seconds\": %.6f, \"mb_per_s\": %.1f, \"allocs\": %lld, "
+         "\"frees\": %lld, \"alloc_bytes\": %lld, \"peak_rss_kb\": %ld}\n",
+         corpus, op, bytes, m->seconds, bytes / 1e6 / m->seconds, m->allocs,
+         m->frees, m->alloc_bytes, peak_rss_kb());
+  fflush(stdout);
+}
+
+// Upper bound, a trailing '\n' does not start another document
+static size_t count_docs(const char *text) {
+  size_t count = 0;
+  for (; *text != '\0'; text++)
+    count += *text == '\n';
+  return count + 1;
+}
+
+// Parses every document of text into vals, returns their number
+static size_t parse_docs(const char *text, JsonVal *vals, JsonDocument *doc) {
+  size_t count = 0;
+  while (*text != '\0') {
+    bool ok = doc != NULL ? json_doc_parse(doc, &text)
+                          : json_parse_val(&vals[count++], &text);
+    if (!ok) {
+      fprintf(stderr, "json_bench: corpus does not parse\n");
+      exit(1);
+    }
+    if (*text == '\n')
+      text++;
+  }
+  return count;
+}
+
+static void run_corpus(const Corpus *corpus, size_t size, int reps) {
+  Gen g = {.rng = UINT64_C(0x9E3779B97F4A7C15)};
+  corpus->gen(&g, size);
+  size_t docs = count_docs(g.data);
+  JsonVal *vals = malloc(docs * sizeof(JsonVal));
+  JsonStyle minimal = JSON_STYLE_MINIMAL;
+  JsonStyle pretty = JSON_STYLE_PRETTY_PRINT_DOUBLESPACES;
+  JsonWriter w;
+  Measure parse = {0}, ser = {0}, ser_pretty = {0}, free_m = {0};
+  Measure doc_parse = {0}, doc_free = {0};
+  double start;
+
+  for (int rep = 0; rep < reps; rep++) {
+    start = measure_start();
+    docs = parse_docs(g.data, vals, NULL);
+    measure_stop(&parse, start);
+
+    json_writer_init(&w, &minimal);
+    start = measure_start();
+    for (size_t i = 0; i < docs; i++)
+      json_write_val(&w, &vals[i]);
+    measure_stop(&ser, start);
+    json_writer_free(&w);
+
+    json_writer_init(&w, &pretty);
+    start = measure_start();
+    for (size_t i = 0; i < docs; i++)
+      json_write_val(&w, &vals[i]);
+    measure_stop(&ser_pretty, start);
+    json_writer_free(&w);
+
+    start = measure_start();
+    for (size_t i = 0; i < docs; i++)
+      json_free_val(&vals[i]);
+    measure_stop(&free_m, start);
+
+    // Every document of the corpus goes to the same arena
+    JsonDocument doc;
+    json_doc_init(&doc);
+    start = measure_start();
+    parse_docs(g.data, NULL, &doc);
+    measure_stop(&doc_parse, start);
+
+    start = measure_start();
+    json_doc_free(&doc);
+    measure_stop(&doc_free, start);
+  }
+
+  report(corpus->name, "parse", g.len, &parse);
+  report(corpus->name, "serialize", g.len, &ser);
+  report(corpus->name, "serialize_pretty", g.len, &ser_pretty);
+  report(corpus->name, "free", g.len, &free_m);
+  report(corpus->name, "doc_parse", g.len, &doc_parse);
+  report(corpus->name, "doc_free", g.len, &doc_free);
+  free(vals);
+  free(g.data);
+}
+
+int main(int argc, char **argv) {
+  size_t size = (size_t)DEFAULT_SIZE_MB * 1024 * 1024;
+  int reps = DEFAULT_REPS;
+  const char *selected[sizeof(CORPORA) / sizeof(CORPORA[0])];
+  size_t selected_len = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+      size = (size_t)(atof(argv[++i]) * 1024 * 1024);
+    else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+      reps = atoi(argv[++i]);
+    else if (argv[i][0] != '-' &&
+             selected_len < sizeof(selected) / sizeof(selected[0]))
+      selected[selected_len++] = argv[i];
+    else {
+      fprintf(stderr, "usage: %s [--size MB] [--reps N] [corpus...]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if (reps < 1)
+    reps = 1;
+
+  for (size_t c = 0; c < sizeof(CORPORA) / sizeof(CORPORA[0]); c++) {
+    bool wanted = selected_len == 0;
+    for (size_t i = 0; i < selected_len; i++)
+      wanted |= strcmp(selected[i], CORPORA[c].name) == 0;
+    if (!wanted)
+      continue;
+#ifdef BENCH_FORK
+    // A process per corpus, so that peak_rss_kb is the corpus' own
+    pid_t pid = fork();
+    if (pid == 0) {
+      run_corpus(&CORPORA[c], size, reps);
+      exit(0);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || status != 0)
+      return 1;
+#else
+    run_corpus(&CORPORA[c], size, reps);
+#endif
+  }
+  return 0;
+}
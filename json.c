@@ -1,5 +1,9 @@
+// mmap() and madvise() are hidden by glibc in strict ISO C modes
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "json.h"
-#include <ctype.h>
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
@@ -7,546 +11,6041 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define JSON_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__STDC_NO_ATOMICS__)
+#define JSON_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define JSON_SIMD_X86
+#include <immintrin.h>
+#endif
 
-#define INTERNAL_BUF_SIZE 128
+#if defined(__GNUC__) || defined(__clang__)
+// The vector kernels below read whole aligned blocks, which may extend past
+// the terminating NUL but never cross a page boundary
+#define JSON_NO_SANITIZE __attribute__((no_sanitize_address))
+#else
+#define JSON_NO_SANITIZE
+#endif
+
+#define MAX_NUMBER_LEN 32
 #define INITIAL_REALLOC_INCREMENT 128
+#define WRITER_MIN_SINK_BUF_SIZE 64 // Room for any number and separator
+#define INITIAL_SCRATCH_SIZE 1024
+#define INTERNAL_TOKEN_SIZE 64
+#define ARENA_MIN_BLOCK_SIZE (64 * 1024)
+#define ARENA_MAX_BLOCK_SIZE (16 * 1024 * 1024)
+#define ARENA_NODE_ALIGN 8
+#define OBJ_INDEX_MIN_LEN 16
+#define PARALLEL_MIN_SIZE (1024 * 1024)
+#define PARALLEL_BATCH 64
+#define NDJSON_CHUNK_SIZE (256 * 1024)
+#define INTERN_INITIAL_CAP 256
+#define INTERN_MAX_VALUE_LEN 32
+#define INTERN_VALUE_CACHE_SIZE 1024
 
 static char TRUE_STR[] = "true";
 static char FALSE_STR[] = "false";
 static char NULL_STR[] = "null";
 
-static bool json_parse_pair(JsonPair *, const char **);
-static bool json_parse_str(JsonStr *, const char **);
-static bool json_parse_arr(JsonArr **, const char **);
+// Allocation through an optional JsonAllocator, malloc without one
+static inline void *mem_alloc(const JsonAllocator *a, size_t size) {
+  return a != NULL ? a->alloc(a->ctx, size) : malloc(size);
+}
 
-static void json_skip_whitespace(const char **ptr) {
-  while (isspace((unsigned char)**ptr))
-    (*ptr)++;
+static inline void *mem_resize(const JsonAllocator *a, void *ptr,
+                               size_t old_size, size_t new_size) {
+  if (a == NULL)
+    return realloc(ptr, new_size);
+  if (ptr == NULL)
+    return a->alloc(a->ctx, new_size);
+  return a->resize(a->ctx, ptr, old_size, new_size);
 }
 
-static bool json_parse_obj(JsonObj **res, const char **text) {
-  *res = malloc(sizeof(JsonObj));
-  (*res)->pairs = NULL;
-  (*res)->len = 0;
-  size_t actual_len = 2;
-  (*res)->pairs = malloc(sizeof(JsonPair) * actual_len);
+static inline void mem_free(const JsonAllocator *a, void *ptr, size_t size) {
+  if (a != NULL)
+    a->release(a->ctx, ptr, size);
+  else
+    free(ptr);
+}
 
-  if (**text != '{')
-    return false;
+struct JsonArenaBlock {
+  JsonArenaBlock *next;
+  char *cur;
+  char *end;
+};
 
-  (*text)++;
-  json_skip_whitespace(text);
-  if (**text != '}')
-    for (;;) {
-      if ((*res)->len == actual_len) {
-        (*res)->pairs =
-            realloc((*res)->pairs, sizeof(JsonPair) * (actual_len * 2));
-        actual_len *= 2;
-      }
+static void *arena_alloc_slow(JsonArena *arena, size_t size, size_t align) {
+  size_t header = (sizeof(JsonArenaBlock) + _Alignof(max_align_t) - 1) &
+                  ~(_Alignof(max_align_t) - 1);
+  size_t block_size = arena->next_block_size;
+  bool dedicated = size + align > block_size / 2;
+  if (dedicated)
+    block_size = size + align;
+  else if (arena->next_block_size < ARENA_MAX_BLOCK_SIZE)
+    arena->next_block_size *= 2;
 
-      (*res)->len += 1;
-      if (!json_parse_pair(&(*res)->pairs[(*res)->len - 1], text))
-        return false;
+  JsonArenaBlock *block = mem_alloc(arena->alloc, header + block_size);
+  if (block == NULL)
+    return NULL;
+  block->cur = (char *)block + header;
+  block->end = block->cur + block_size;
 
-      json_skip_whitespace(text);
-      if (**text == ',') {
-        (*text)++;
-        json_skip_whitespace(text);
-      } else
-        break;
+  // Oversized requests get a block of their own, so the free space left in
+  // the current block stays usable for the following small nodes.
+  if (dedicated && arena->head != NULL) {
+    block->next = arena->head->next;
+    arena->head->next = block;
+  } else {
+    block->next = arena->head;
+    arena->head = block;
+  }
+
+  char *res = (char *)(((uintptr_t)block->cur + align - 1) & ~(align - 1));
+  block->cur = res + size;
+  return res;
+}
+
+static inline void *arena_alloc(JsonArena *arena, size_t size, size_t align) {
+  JsonArenaBlock *block = arena->head;
+  if (block != NULL) {
+    char *res = (char *)(((uintptr_t)block->cur + align - 1) & ~(align - 1));
+    if (res <= block->end && (size_t)(block->end - res) >= size) {
+      block->cur = res + size;
+      return res;
     }
-  json_skip_whitespace(text);
+  }
+  return arena_alloc_slow(arena, size, align);
+}
 
-  if (**text != '}')
-    return false;
+void *json_arena_alloc(JsonArena *arena, size_t size) {
+  return arena_alloc(arena, size, _Alignof(max_align_t));
+}
 
-  (*text)++;
-  return true;
+// Size-class pool: a free list per multiple of POOL_GRANULE up to
+// JSON_POOL_MAX_SIZE. Blocks are carved from chunks in order and go back to
+// their list when released, the chunks themselves only with the pool. Every
+// thread has a cache of its own (free lists and the rest of its newest
+// chunk), found through a thread-local slot remembering the last pool used,
+// so only adding a cache or a chunk takes the lock.
+#define POOL_GRANULE 8
+#define POOL_CLASSES (JSON_POOL_MAX_SIZE / POOL_GRANULE)
+#define POOL_CHUNK_SIZE (64 * 1024)
+
+typedef struct PoolChunk {
+  struct PoolChunk *next;
+  max_align_t data[]; // Keeps the blocks aligned
+} PoolChunk;
+
+typedef struct PoolCache {
+  struct PoolCache *next;
+  void *free_lists[POOL_CLASSES];
+  char *cur; // Unused part of the newest chunk
+  char *end;
+#ifdef JSON_THREADS
+  pthread_t thread;
+#endif
+} PoolCache;
+
+struct JsonPool {
+  JsonAllocator alloc;
+  PoolChunk *chunks;
+  PoolCache *caches;
+#ifdef JSON_THREADS
+  pthread_mutex_t lock;
+  uint64_t id; // Never reused, unlike the address of a freed pool
+#endif
+};
+
+#ifdef JSON_THREADS
+static atomic_uint_fast64_t pool_next_id = 1;
+static _Thread_local uint64_t pool_slot_id;
+static _Thread_local PoolCache *pool_slot_cache;
+#endif
+
+static inline size_t pool_class(size_t size) {
+  return (size - 1) / POOL_GRANULE;
 }
 
-static bool json_parse_str(JsonStr *str, const char **text) {
-  str->needs_dealloc = false;
-  if (**text != '"')
-    return false;
+static inline bool pool_small(size_t size) {
+  return size != 0 && size <= JSON_POOL_MAX_SIZE;
+}
 
-  str->start = (char *)++*text;
-  bool esc = false;
-  bool needs_decoding = false;
-  for (;; (*text)++) {
-    if (**text == '\0' || (unsigned char)**text < 0x20)
-      return false;
-    if (!esc) {
-      if (**text == '"')
-        break;
-      esc = **text == '\\';
-      needs_decoding |= esc;
-    } else
-      esc = false;
+static PoolCache *pool_cache(JsonPool *pool) {
+#ifdef JSON_THREADS
+  if (pool_slot_id == pool->id)
+    return pool_slot_cache;
+  pthread_t self = pthread_self();
+  pthread_mutex_lock(&pool->lock);
+  PoolCache *cache = pool->caches;
+  while (cache != NULL && !pthread_equal(cache->thread, self))
+    cache = cache->next;
+  if (cache == NULL && (cache = calloc(1, sizeof(PoolCache))) != NULL) {
+    cache->thread = self;
+    cache->next = pool->caches;
+    pool->caches = cache;
   }
-  str->len = *text - str->start;
-
-  str->needs_dealloc = needs_decoding;
-  if (needs_decoding) {
-    if (!json_decode_str((const char **)&str->start, &str->len, str->start,
-                         str->len))
-      return false;
+  pthread_mutex_unlock(&pool->lock);
+  if (cache != NULL) {
+    pool_slot_id = pool->id;
+    pool_slot_cache = cache;
   }
+  return cache;
+#else
+  return pool->caches;
+#endif
+}
 
-  if (**text != '"')
-    return false;
+static void *pool_alloc(void *ctx, size_t size) {
+  JsonPool *pool = ctx;
+  if (!pool_small(size))
+    return malloc(size);
+  PoolCache *cache = pool_cache(pool);
+  if (cache == NULL)
+    return NULL;
+  size_t cls = pool_class(size);
+  void *res = cache->free_lists[cls];
+  if (res != NULL) {
+    memcpy(&cache->free_lists[cls], res, sizeof(void *));
+    return res;
+  }
+  size = (cls + 1) * POOL_GRANULE;
+  if ((size_t)(cache->end - cache->cur) < size) {
+    PoolChunk *chunk = malloc(sizeof(PoolChunk) + POOL_CHUNK_SIZE);
+    if (chunk == NULL)
+      return NULL;
+#ifdef JSON_THREADS
+    pthread_mutex_lock(&pool->lock);
+#endif
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+#ifdef JSON_THREADS
+    pthread_mutex_unlock(&pool->lock);
+#endif
+    cache->cur = (char *)chunk->data;
+    cache->end = cache->cur + POOL_CHUNK_SIZE;
+  }
+  res = cache->cur;
+  cache->cur += size;
+  return res;
+}
 
-  (*text)++;
-  return true;
+// A block released on another thread than it was allocated on joins the
+// lists of the releasing thread
+static void pool_release(void *ctx, void *ptr, size_t size) {
+  if (ptr == NULL)
+    return;
+  if (!pool_small(size)) {
+    free(ptr);
+    return;
+  }
+  PoolCache *cache = pool_cache(ctx);
+  if (cache == NULL)
+    return; // The block stays in its chunk until the pool is freed
+  size_t cls = pool_class(size);
+  memcpy(ptr, &cache->free_lists[cls], sizeof(void *));
+  cache->free_lists[cls] = ptr;
 }
 
-static bool json_parse_pair(JsonPair *res, const char **text) {
-  // Initialize res->value for errorprone freeing
-  res->value.type = JSON_TYPE_NUL;
+static void *pool_resize(void *ctx, void *ptr, size_t old_size,
+                         size_t new_size) {
+  if (!pool_small(old_size) && !pool_small(new_size))
+    return realloc(ptr, new_size);
+  if (pool_small(old_size) && pool_small(new_size) &&
+      pool_class(old_size) == pool_class(new_size))
+    return ptr;
+  void *res = pool_alloc(ctx, new_size);
+  if (res == NULL)
+    return NULL;
+  memcpy(res, ptr, old_size < new_size ? old_size : new_size);
+  pool_release(ctx, ptr, old_size);
+  return res;
+}
 
-  if (!json_parse_str(&res->key, text))
-    return false;
+JsonPool *json_pool_new(void) {
+  JsonPool *pool = calloc(1, sizeof(JsonPool));
+  if (pool == NULL)
+    return NULL;
+#ifdef JSON_THREADS
+  if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+    free(pool);
+    return NULL;
+  }
+  pool->id = atomic_fetch_add(&pool_next_id, 1);
+#else
+  pool->caches = calloc(1, sizeof(PoolCache));
+  if (pool->caches == NULL) {
+    free(pool);
+    return NULL;
+  }
+#endif
+  pool->alloc.alloc = pool_alloc;
+  pool->alloc.resize = pool_resize;
+  pool->alloc.release = pool_release;
+  pool->alloc.ctx = pool;
+  pool->alloc.thread_safe = true;
+  return pool;
+}
 
-  json_skip_whitespace(text);
+const JsonAllocator *json_pool_allocator(JsonPool *pool) {
+  return &pool->alloc;
+}
 
-  if (**text != ':')
-    return false;
+void json_pool_free(JsonPool *pool) {
+  PoolChunk *chunk = pool->chunks;
+  while (chunk != NULL) {
+    PoolChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  PoolCache *cache = pool->caches;
+  while (cache != NULL) {
+    PoolCache *next = cache->next;
+    free(cache);
+    cache = next;
+  }
+#ifdef JSON_THREADS
+  pthread_mutex_destroy(&pool->lock);
+#endif
+  free(pool);
+}
 
-  (*text)++;
-  json_skip_whitespace(text);
+// Parsing state. Container elements are collected on the scratch stack and
+// copied out once the container is closed, so every pairs/values array is
+// allocated exactly once with its final size.
+typedef struct {
+  JsonArena *arena; // NULL: nodes are malloc'ed and freed by json_free_val
+  JsonArena *owner; // Recorded in objects, differs from arena in workers
+  unsigned flags;
+  JsonInternTable *intern; // Document's table if it interns strings
+  char *scratch;
+  size_t scratch_len;
+  size_t scratch_cap;
+  JsonStats *stats; // Attached to the parsing thread, NULL if none
+  size_t depth;     // Open objects/arrays around the parsed value
+  size_t max_depth; // 0: JSON_DEFAULT_MAX_DEPTH
+  const JsonAllocator *alloc; // Nodes without an arena, and scratch
+  const char *line_end;       // NDJSON: end of the record's line, else NULL
+} JsonParser;
 
-  if (!json_parse_val(&res->value, text))
-    return false;
-  return true;
+static size_t parser_max_depth(const JsonParser *p) {
+  return p->max_depth != 0 ? p->max_depth : JSON_DEFAULT_MAX_DEPTH;
 }
 
-static bool json_parse_arr(JsonArr **res, const char **text) {
-  *res = malloc(sizeof(JsonArr));
-  (*res)->values = NULL;
-  (*res)->len = 0;
-  size_t actual_len = 2;
-  (*res)->values = malloc(sizeof(JsonVal) * actual_len);
+// Statistics: the counting sites compile to nothing with JSON_NO_STATS and
+// cost a predictable branch when no stats are attached
+#ifndef JSON_NO_STATS
+static _Thread_local JsonStats *thread_stats;
 
-  if (**text != '[')
-    return false;
+#define STATS_CURRENT() thread_stats
+#define STATS_ADD(stats, field, n)                                             \
+  do {                                                                         \
+    if ((stats) != NULL)                                                       \
+      (stats)->field += (n);                                                   \
+  } while (0)
 
-  (*text)++;
-  json_skip_whitespace(text);
-  if (**text != ']')
-    for (;;) {
-      if ((*res)->len == actual_len) {
-        (*res)->values =
-            realloc((*res)->values, sizeof(JsonVal) * (actual_len * 2));
-        actual_len *= 2;
-      }
+static uint64_t stats_clock(void) {
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+  timespec_get(&ts, TIME_UTC);
+#endif
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
 
-      (*res)->len += 1;
-      if (!json_parse_val(&(*res)->values[(*res)->len - 1], text))
-        return false;
+static inline uint64_t stats_start(const JsonStats *stats) {
+  return stats != NULL ? stats_clock() : 0;
+}
 
-      json_skip_whitespace(text);
-      if (**text == ',') {
-        (*text)++;
-        json_skip_whitespace(text);
-      } else
-        break;
-    }
-  json_skip_whitespace(text);
+#define STATS_STOP(stats, field, start)                                        \
+  STATS_ADD(stats, field, stats_clock() - (start))
 
-  if (**text != ']')
-    return false;
+static inline void stats_depth(JsonParser *p, size_t depth) {
+  if (p->stats != NULL && depth > p->stats->max_depth)
+    p->stats->max_depth = depth;
+}
 
-  (*text)++;
-  return true;
+static inline void stats_str(JsonParser *p, size_t len, bool escaped) {
+  if (p->stats == NULL)
+    return;
+  if (escaped)
+    p->stats->escaped_str_bytes += len;
+  else
+    p->stats->plain_str_bytes += len;
 }
 
-typedef enum {
-  NUM_INT,
-  NUM_FRC,
-  NUM_INV,
-} NumResult;
+static void stats_merge(JsonStats *dst, const JsonStats *src) {
+  for (size_t i = 0; i <= JSON_TYPE_NUL; i++)
+    dst->values[i] += src->values[i];
+  if (src->max_depth > dst->max_depth)
+    dst->max_depth = src->max_depth;
+  dst->plain_str_bytes += src->plain_str_bytes;
+  dst->escaped_str_bytes += src->escaped_str_bytes;
+  dst->allocs += src->allocs;
+  dst->alloc_bytes += src->alloc_bytes;
+  dst->scratch_growths += src->scratch_growths;
+  dst->writer_growths += src->writer_growths;
+  dst->parse_ns += src->parse_ns;
+  dst->free_ns += src->free_ns;
+  dst->serialize_ns += src->serialize_ns;
+}
 
-static NumResult is_fractional(const char *text) {
-  if (*text == '-')
-    text++;
-  if (*text == '0' && isdigit((unsigned char)*(text + 1)))
-    return NUM_INV;
-  while (isdigit((unsigned char)*text))
-    text++;
-  if (*text == '.' && isdigit((unsigned char)*(text + 1)))
-    return NUM_FRC;
-  if (*text == 'e' || *text == 'E') {
-    if (isdigit((unsigned char)*(text + 1)) ||
-        ((*(text + 1) == '-' || *(text + 1) == '+') &&
-         isdigit((unsigned char)*(text + 2))))
-      return NUM_FRC;
-  }
-  return NUM_INT;
+JsonStats *json_stats_attach(JsonStats *stats) {
+  JsonStats *prev = thread_stats;
+  thread_stats = stats;
+  return prev;
 }
+#else
+#define STATS_CURRENT() NULL
+#define STATS_ADD(stats, field, n) ((void)(stats))
+#define STATS_STOP(stats, field, start) ((void)(stats), (void)(start))
+#define stats_start(stats) ((uint64_t)0)
+#define stats_depth(p, depth) ((void)0)
+#define stats_str(p, len, escaped) ((void)0)
 
-bool json_parse_val(JsonVal *res, const char **text) {
-  res->type = JSON_TYPE_NUL;
-  if (**text == '"') {
-    res->as.str_ptr = malloc(sizeof(JsonStr));
-    res->type = JSON_TYPE_STR;
-    if (!json_parse_str(res->as.str_ptr, text)) {
-      return false;
-    }
-  } else if (**text == '{') {
-    res->type = JSON_TYPE_OBJ;
-    if (!json_parse_obj(&res->as.obj_ptr, text))
-      return false;
-  } else if (**text == '[') {
-    res->type = JSON_TYPE_ARR;
-    if (!json_parse_arr(&res->as.arr_ptr, text))
-      return false;
-  } else if (isdigit((unsigned char)**text) ||
-             (**text == '-' && isdigit((unsigned char)*(*text + 1)))) {
-    char *end;
-    switch (is_fractional(*text)) {
-    case NUM_INT:
-      res->type = JSON_TYPE_INT;
-      errno = 0;
-      res->as.integer = strtoll(*text, &end, 10);
-      if (errno == ERANGE)
-        return false;
-      break;
-    case NUM_FRC:
-      res->type = JSON_TYPE_FRC;
-      errno = 0;
-      res->as.fract = strtod(*text, &end);
-      if (errno == ERANGE || !isfinite(res->as.fract))
-        return false;
-      break;
-    default:
-      return false;
-    }
-    *text = end;
-  } else if (0 == strncmp(*text, TRUE_STR, sizeof(TRUE_STR) - 1)) {
-    // Bool: true
-    res->as.boolean = true;
-    res->type = JSON_TYPE_BOL;
-    (*text) += sizeof(TRUE_STR) - 1;
-  } else if (0 == strncmp(*text, FALSE_STR, sizeof(FALSE_STR) - 1)) {
-    // Bool: false
-    res->as.boolean = false;
-    res->type = JSON_TYPE_BOL;
-    (*text) += sizeof(FALSE_STR) - 1;
-  } else if (0 == strncmp(*text, NULL_STR, sizeof(NULL_STR) - 1)) {
-    // Null
-    res->type = JSON_TYPE_NUL;
-    (*text) += sizeof(NULL_STR) - 1;
-  } else {
-    return false;
-  }
-  return true;
+JsonStats *json_stats_attach(JsonStats *stats) {
+  (void)stats;
+  return NULL;
 }
+#endif
 
-static int hexval(unsigned char c) {
-  if (c >= '0' && c <= '9')
-    return (int)(c - '0');
-  if (c >= 'a' && c <= 'f')
-    return (int)(c - 'a' + 10);
-  if (c >= 'A' && c <= 'F')
-    return (int)(c - 'A' + 10);
-  return -1;
+static void *parser_alloc(JsonParser *p, size_t size, size_t align) {
+  STATS_ADD(p->stats, allocs, 1);
+  STATS_ADD(p->stats, alloc_bytes, size);
+  if (p->arena != NULL)
+    return arena_alloc(p->arena, size, align);
+  return mem_alloc(p->alloc, size);
 }
 
-static bool parse_u16_4hex(const char *p, const char *end, uint16_t *out) {
-  if (end - p < 4)
-    return false;
-  int h0 = hexval((unsigned char)p[0]);
-  int h1 = hexval((unsigned char)p[1]);
-  int h2 = hexval((unsigned char)p[2]);
-  int h3 = hexval((unsigned char)p[3]);
-  if (h0 < 0 || h1 < 0 || h2 < 0 || h3 < 0)
-    return false;
-  *out = (uint16_t)((h0 << 12) | (h1 << 8) | (h2 << 4) | h3);
-  return true;
+// Heap strings are released by their length, so with an allocator the
+// buffer a string was decoded into is shrunk to the decoded length
+static char *parser_fit_str(JsonParser *p, char *decoded, size_t size,
+                            size_t len) {
+  if (p->arena != NULL || p->alloc == NULL || len == size)
+    return decoded;
+  return p->alloc->resize(p->alloc->ctx, decoded, size, len);
 }
 
-static size_t utf8_encode(uint32_t cp, char out[4]) {
-  if (cp <= 0x7F) {
-    out[0] = (char)cp;
-    return 1;
-  } else if (cp <= 0x7FF) {
-    out[0] = (char)(0xC0 | (cp >> 6));
-    out[1] = (char)(0x80 | (cp & 0x3F));
-    return 2;
-  } else if (cp <= 0xFFFF) {
-    out[0] = (char)(0xE0 | (cp >> 12));
-    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
-    out[2] = (char)(0x80 | (cp & 0x3F));
-    return 3;
-  } else {
-    out[0] = (char)(0xF0 | (cp >> 18));
-    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
-    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
-    out[3] = (char)(0x80 | (cp & 0x3F));
-    return 4;
+static void scratch_free(JsonParser *p) {
+  mem_free(p->alloc, p->scratch, p->scratch_cap);
+}
+
+static void scratch_push(JsonParser *p, const void *elem, size_t size) {
+  if (p->scratch_len + size > p->scratch_cap) {
+    size_t new_cap = p->scratch_cap ? p->scratch_cap * 2 : INITIAL_SCRATCH_SIZE;
+    while (new_cap < p->scratch_len + size)
+      new_cap *= 2;
+    p->scratch = mem_resize(p->alloc, p->scratch, p->scratch_cap, new_cap);
+    p->scratch_cap = new_cap;
+    STATS_ADD(p->stats, scratch_growths, 1);
   }
+  memcpy(p->scratch + p->scratch_len, elem, size);
+  p->scratch_len += size;
 }
 
-bool json_decode_str(const char **res, size_t *res_len, const char *src,
-                     size_t len) {
-  *res = malloc(len);
-  char *cur = (char *)*res;
-  const char *end = src + len;
+// Moves everything pushed since `base` into a freshly allocated array
+static void *scratch_pop(JsonParser *p, size_t base, size_t elem_size,
+                         size_t *len) {
+  size_t size = p->scratch_len - base;
+  *len = size / elem_size;
+  if (size == 0)
+    return NULL;
+  void *res = parser_alloc(p, size, ARENA_NODE_ALIGN);
+  memcpy(res, p->scratch + base, size);
+  p->scratch_len = base;
+  return res;
+}
 
-  while (src < end) {
-    if (*src == '\\') {
-      if (++src >= end)
-        return false;
-      switch (*src++) {
-      case 'b':
-        *cur++ = '\b';
-        break;
-      case 'f':
-        *cur++ = '\f';
-        break;
-      case 'n':
-        *cur++ = '\n';
-        break;
-      case 'r':
-        *cur++ = '\r';
-        break;
-      case 't':
-        *cur++ = '\t';
-        break;
-      case '\\':
-        *cur++ = '\\';
-        break;
-      case '"':
-        *cur++ = '"';
-        break;
-      case '/':
-        *cur++ = '/';
-        break;
-      case 'u': {
-        uint16_t u1;
-        if (!parse_u16_4hex(src, end, &u1))
-          return false;
-        src += 4; // Cause four HEX-digits
-        uint32_t cp;
-
-        if (u1 >= 0xD800 && u1 <= 0xDBFF) { // High surrogate
-          if (end - src < 6)
-            return false; // Need \uXXXX
-          if (src[0] != '\\' || src[1] != 'u')
-            return false;
-          uint16_t u2;
-          src += 2;
-          if (!parse_u16_4hex(src, end, &u2))
-            return false;
-          if (u2 < 0xDC00 || u2 > 0xDFFF) // Must be low surrogate
-            return false;
-          src += 4;
-          cp = 0x10000u +
-               (((uint32_t)(u1 - 0xD800) << 10) | (uint32_t)(u2 - 0xDC00));
-        } else if (u1 >= 0xDC00 && u1 <= 0xDFFF)
-          return false;
-        else
-          cp = (uint32_t)u1;
+static uint64_t hash_bytes(const char *, size_t);
 
-        if (cp > 0x10FFFFu)
-          return false;
+// The distinct keys of a document, open addressing, at most half full. Short
+// string values go through a direct-mapped cache instead: repeated values
+// are found there, while unique ones only replace a slot and do not make the
+// table grow.
+typedef struct {
+  const char *start; // NULL marks an empty slot
+  size_t len;
+  uint64_t hash;
+  JsonStr *node; // Value cache: the node shared by the equal values
+} InternEntry;
 
-        char utf8[4];
-        size_t utf8_len = utf8_encode(cp, utf8);
+struct JsonInternTable {
+  InternEntry *entries;
+  size_t mask; // Slot count - 1
+  size_t len;
+  InternEntry *values; // INTERN_VALUE_CACHE_SIZE slots, NULL until needed
+};
 
-        memcpy(cur, utf8, utf8_len);
-        cur += utf8_len;
-        break;
-      }
-      default:
-        return false;
-      }
-    } else
-      *cur++ = *src++;
+static InternEntry *intern_slot(const JsonInternTable *t, const char *data,
+                                size_t len, uint64_t h) {
+  for (size_t slot = h & t->mask;; slot = (slot + 1) & t->mask) {
+    InternEntry *e = &t->entries[slot];
+    if (e->start == NULL ||
+        (e->hash == h && e->len == len && memcmp(e->start, data, len) == 0))
+      return e;
   }
-  *res_len = cur - *res;
-  return true;
 }
 
-static void json_free_obj(JsonObj *);
-static void json_free_arr(JsonArr *);
+static JsonInternTable *intern_new(void) {
+  JsonInternTable *t = malloc(sizeof(JsonInternTable));
+  t->entries = calloc(INTERN_INITIAL_CAP, sizeof(InternEntry));
+  t->mask = INTERN_INITIAL_CAP - 1;
+  t->len = 0;
+  t->values = NULL;
+  return t;
+}
 
-void json_free_val(JsonVal *val) {
-  switch (val->type) {
-  case JSON_TYPE_OBJ:
-    json_free_obj(val->as.obj_ptr);
-    break;
-  case JSON_TYPE_ARR:
-    json_free_arr(val->as.arr_ptr);
-    break;
-  case JSON_TYPE_STR:
-    if (val->as.str_ptr->needs_dealloc)
-      free((void *)val->as.str_ptr->start);
-    free(val->as.str_ptr);
-    break;
-  case JSON_TYPE_NUL:
-  case JSON_TYPE_INT:
-  case JSON_TYPE_FRC:
-  case JSON_TYPE_BOL:
-    break; // Nothing
-  }
+static void intern_free(JsonInternTable *t) {
+  if (t == NULL)
+    return;
+  free(t->entries);
+  free(t->values);
+  free(t);
 }
 
-static void json_free_obj(JsonObj *obj) {
-  for (size_t i = 0; i < obj->len; i++) {
-    if (obj->pairs[i].key.needs_dealloc)
-      free((void *)obj->pairs[i].key.start);
-    json_free_val(&obj->pairs[i].value);
-  }
-  free(obj->pairs);
-  free(obj);
+static void intern_grow(JsonInternTable *t) {
+  InternEntry *old = t->entries;
+  size_t old_cap = t->mask + 1;
+  t->entries = calloc(old_cap * 2, sizeof(InternEntry));
+  t->mask = old_cap * 2 - 1;
+  for (size_t i = 0; i < old_cap; i++)
+    if (old[i].start != NULL)
+      *intern_slot(t, old[i].start, old[i].len, old[i].hash) = old[i];
+  free(old);
 }
 
-static void json_free_arr(JsonArr *arr) {
-  for (size_t i = 0; i < arr->len; i++) {
-    json_free_val(&arr->values[i]);
+// Entry of the string, added with data as its bytes if it is new. Those have
+// to live as long as the document.
+static InternEntry *intern_get(JsonInternTable *t, const char *data,
+                               size_t len) {
+  uint64_t h = hash_bytes(data, len);
+  InternEntry *e = intern_slot(t, data, len, h);
+  if (e->start != NULL)
+    return e;
+  if ((t->len + 1) * 2 > t->mask + 1) {
+    intern_grow(t);
+    e = intern_slot(t, data, len, h);
   }
-  free(arr->values);
-  free(arr);
+  *e = (InternEntry){.start = data, .len = len, .hash = h};
+  t->len++;
+  return e;
 }
 
-JsonVal *json_value_by_key(JsonObj *obj, const char *to_find) {
-  JsonStr *key_str;
-  for (size_t i = 0; i < obj->len; i++) {
-    key_str = &obj->pairs[i].key;
-    if (strlen(to_find) == key_str->len &&
-        0 == strncmp(to_find, key_str->start, key_str->len))
-      return &obj->pairs[i].value;
+static bool json_parse_str(JsonParser *, JsonStr *, const char **, bool);
+static bool json_decode_str_into(char *, size_t *, const char *, size_t);
+static bool json_check_escapes(const char *, size_t);
+static void json_obj_build_index(JsonObj *);
+static void obj_build_index(JsonObj *obj, JsonArena *arena);
+static void obj_free_index(JsonObj *obj);
+
+static inline bool is_json_whitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// True for bytes that end the plain run of a string: '"', '\\' and control
+// characters (including the terminating NUL)
+static inline bool is_str_special(char c) {
+  return c == '"' || c == '\\' || (unsigned char)c < 0x20;
+}
+
+// Positions of the bytes of one 64-byte block that matter for locating
+// structural characters, bit i for block[i]
+typedef struct {
+  uint64_t quote;
+  uint64_t bslash;
+  uint64_t open;  // '[' and '{'
+  uint64_t close; // ']' and '}'
+  uint64_t comma;
+  uint64_t nul;
+} StructMasks;
+
+#ifdef JSON_SIMD_X86
+static inline __m128i str_special_sse2(__m128i v) {
+  __m128i quote = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+  __m128i bslash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+  __m128i ctrl = _mm_set1_epi8(0x1F);
+  ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl); // Unsigned v <= 0x1F
+  return _mm_or_si128(_mm_or_si128(quote, bslash), ctrl);
+}
+
+static inline unsigned str_special_mask_sse2(__m128i v) {
+  return (unsigned)_mm_movemask_epi8(str_special_sse2(v));
+}
+
+static inline unsigned whitespace_mask_sse2(__m128i v) {
+  __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+  __m128i nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+  __m128i cr = _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'));
+  __m128i tab = _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'));
+  return (unsigned)_mm_movemask_epi8(
+      _mm_or_si128(_mm_or_si128(sp, nl), _mm_or_si128(cr, tab)));
+}
+
+JSON_NO_SANITIZE static const char *scan_str_sse2(const char *ptr) {
+  size_t misalign = (uintptr_t)ptr & 15;
+  const char *block = ptr - misalign;
+  unsigned mask =
+      str_special_mask_sse2(_mm_load_si128((const __m128i *)block)) >>
+      misalign;
+  if (mask)
+    return ptr + __builtin_ctz(mask);
+  for (;;) {
+    block += 16;
+    mask = str_special_mask_sse2(_mm_load_si128((const __m128i *)block));
+    if (mask)
+      return block + __builtin_ctz(mask);
   }
-  return NULL;
 }
 
-static char internal_buf[INTERNAL_BUF_SIZE];
-static size_t realloc_increment = INITIAL_REALLOC_INCREMENT;
+static inline void classify_sse2(__m128i v, unsigned shift, StructMasks *m) {
+  m->quote |= (uint64_t)_mm_movemask_epi8(
+                  _mm_cmpeq_epi8(v, _mm_set1_epi8('"')))
+              << shift;
+  m->bslash |= (uint64_t)_mm_movemask_epi8(
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')))
+               << shift;
+  m->comma |= (uint64_t)_mm_movemask_epi8(
+                  _mm_cmpeq_epi8(v, _mm_set1_epi8(',')))
+              << shift;
+  m->nul |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()))
+            << shift;
+  // '[' and ']' differ from '{' and '}' only in bit 0x20
+  __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  m->open |= (uint64_t)_mm_movemask_epi8(
+                 _mm_cmpeq_epi8(lower, _mm_set1_epi8('{')))
+             << shift;
+  m->close |= (uint64_t)_mm_movemask_epi8(
+                  _mm_cmpeq_epi8(lower, _mm_set1_epi8('}')))
+              << shift;
+}
+
+JSON_NO_SANITIZE static void classify_block_sse2(const char *block,
+                                                 StructMasks *m) {
+  *m = (StructMasks){0};
+  for (unsigned i = 0; i < 64; i += 16)
+    classify_sse2(_mm_load_si128((const __m128i *)(block + i)), i, m);
+}
 
-static void establish_buf_len(char **buf, size_t *buf_len, size_t target_len) {
-  if (*buf_len < target_len) {
-    do {
-      *buf_len += realloc_increment;
-      realloc_increment *= 2;
-    } while (*buf_len < target_len);
-    *buf = realloc(*buf, *buf_len);
+JSON_NO_SANITIZE static const char *skip_whitespace_sse2(const char *ptr) {
+  size_t misalign = (uintptr_t)ptr & 15;
+  const char *block = ptr - misalign;
+  unsigned mask =
+      (~whitespace_mask_sse2(_mm_load_si128((const __m128i *)block)) &
+       0xFFFFu) >>
+      misalign;
+  if (mask)
+    return ptr + __builtin_ctz(mask);
+  for (;;) {
+    block += 16;
+    mask = ~whitespace_mask_sse2(_mm_load_si128((const __m128i *)block)) &
+           0xFFFFu;
+    if (mask)
+      return block + __builtin_ctz(mask);
   }
 }
 
-static void cstr_append(char **str, size_t *str_len, size_t *buf_len,
-                        char *postfix) {
-  size_t old_base_len = *str_len;
-  size_t postfix_len = strlen(postfix);
-  *str_len += postfix_len;
-  establish_buf_len(str, buf_len, *str_len + 1);
-  memcpy(*str + old_base_len, postfix, postfix_len + 1);
+__attribute__((target("avx2"))) static inline unsigned
+str_special_mask_avx2(__m256i v) {
+  __m256i quote = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+  __m256i bslash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+  __m256i ctrl = _mm256_set1_epi8(0x1F);
+  ctrl = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl);
+  return (unsigned)_mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_or_si256(quote, bslash), ctrl));
 }
 
-static void append_indent_level(char **str, size_t *str_len, size_t *buf_len,
-                                JsonStyle *style) {
-  for (size_t i = 0; i < style->indentation_level; i++)
-    cstr_append(str, str_len, buf_len, style->indentation_str);
+__attribute__((target("avx2"))) static inline unsigned
+whitespace_mask_avx2(__m256i v) {
+  __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+  __m256i nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+  __m256i cr = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'));
+  __m256i tab = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'));
+  return (unsigned)_mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_or_si256(sp, nl), _mm256_or_si256(cr, tab)));
 }
 
-static void json_serialize_jsonstr(JsonStr *json_str, char **str,
-                                   size_t *str_len, size_t *buf_len) {
-  size_t old_str_len = *str_len;
-  *str_len += json_str->len + 2; // + ""
-  establish_buf_len(str, buf_len, *str_len + 1);
-  (*str)[old_str_len] = '"';
-  memcpy(*str + old_str_len + 1, json_str->start, json_str->len);
-  (*str)[old_str_len + json_str->len + 1] = '"';
-  (*str)[old_str_len + json_str->len + 2] = '\0';
+JSON_NO_SANITIZE __attribute__((target("avx2"))) static const char *
+scan_str_avx2(const char *ptr) {
+  size_t misalign = (uintptr_t)ptr & 31;
+  const char *block = ptr - misalign;
+  unsigned mask =
+      str_special_mask_avx2(_mm256_load_si256((const __m256i *)block)) >>
+      misalign;
+  if (mask)
+    return ptr + __builtin_ctz(mask);
+  for (;;) {
+    block += 32;
+    mask = str_special_mask_avx2(_mm256_load_si256((const __m256i *)block));
+    if (mask)
+      return block + __builtin_ctz(mask);
+  }
 }
 
-static void _json_serialize_val(JsonVal *val, char **str, size_t *str_len,
-                                size_t *buf_len, JsonStyle *style);
+__attribute__((target("avx2"))) static inline uint64_t
+eq_mask_avx2(__m256i lo, __m256i hi, char c) {
+  __m256i cv = _mm256_set1_epi8(c);
+  return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, cv)) |
+         (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, cv))
+             << 32;
+}
 
-static void json_serialize_pair(JsonPair *pair, char **str, size_t *str_len,
-                                size_t *buf_len, JsonStyle *style) {
-  json_serialize_jsonstr(&pair->key, str, str_len, buf_len);
-  cstr_append(str, str_len, buf_len, style->minimal ? ":" : ": ");
-  _json_serialize_val(&pair->value, str, str_len, buf_len, style);
+JSON_NO_SANITIZE __attribute__((target("avx2"))) static void
+classify_block_avx2(const char *block, StructMasks *m) {
+  __m256i lo = _mm256_load_si256((const __m256i *)block);
+  __m256i hi = _mm256_load_si256((const __m256i *)(block + 32));
+  m->quote = eq_mask_avx2(lo, hi, '"');
+  m->bslash = eq_mask_avx2(lo, hi, '\\');
+  m->comma = eq_mask_avx2(lo, hi, ',');
+  m->nul = eq_mask_avx2(lo, hi, '\0');
+  __m256i bit = _mm256_set1_epi8(0x20);
+  lo = _mm256_or_si256(lo, bit);
+  hi = _mm256_or_si256(hi, bit);
+  m->open = eq_mask_avx2(lo, hi, '{');
+  m->close = eq_mask_avx2(lo, hi, '}');
 }
 
-static void json_serialize_obj(JsonObj *obj, char **str, size_t *str_len,
-                               size_t *buf_len, JsonStyle *style) {
-  cstr_append(str, str_len, buf_len, "{");
-  if (!style->minimal) {
-    style->indentation_level += 1;
-    cstr_append(str, str_len, buf_len, "\n");
+JSON_NO_SANITIZE __attribute__((target("avx2"))) static const char *
+skip_whitespace_avx2(const char *ptr) {
+  size_t misalign = (uintptr_t)ptr & 31;
+  const char *block = ptr - misalign;
+  unsigned mask =
+      ~whitespace_mask_avx2(_mm256_load_si256((const __m256i *)block)) >>
+      misalign;
+  if (mask)
+    return ptr + __builtin_ctz(mask);
+  for (;;) {
+    block += 32;
+    mask = ~whitespace_mask_avx2(_mm256_load_si256((const __m256i *)block));
+    if (mask)
+      return block + __builtin_ctz(mask);
   }
-  for (size_t i = 0; i < obj->len; i++) {
-    if (!style->minimal)
-      append_indent_level(str, str_len, buf_len, style);
-    json_serialize_pair(&obj->pairs[i], str, str_len, buf_len, style);
-    if (i != obj->len - 1)
-      cstr_append(str, str_len, buf_len, style->minimal ? "," : ",\n");
+}
+
+static const char *find_str_special_sse2(const char *ptr, const char *end) {
+  for (; end - ptr >= 16; ptr += 16) {
+    unsigned mask =
+        str_special_mask_sse2(_mm_loadu_si128((const __m128i *)ptr));
+    if (mask)
+      return ptr + __builtin_ctz(mask);
   }
-  if (!style->minimal) {
-    style->indentation_level -= 1;
-    cstr_append(str, str_len, buf_len, "\n");
-    append_indent_level(str, str_len, buf_len, style);
+  while (ptr < end && !is_str_special(*ptr))
+    ptr++;
+  return ptr;
+}
+
+__attribute__((target("avx2"))) static const char *
+find_str_special_avx2(const char *ptr, const char *end) {
+  for (; end - ptr >= 32; ptr += 32) {
+    unsigned mask =
+        str_special_mask_avx2(_mm256_loadu_si256((const __m256i *)ptr));
+    if (mask)
+      return ptr + __builtin_ctz(mask);
   }
-  cstr_append(str, str_len, buf_len, "}");
+  return find_str_special_sse2(ptr, end);
 }
 
-static void json_serialize_arr(JsonArr *arr, char **str, size_t *str_len,
-                               size_t *buf_len, JsonStyle *style) {
-  cstr_append(str, str_len, buf_len, "[");
-  if (!style->minimal) {
-    style->indentation_level += 1;
-    cstr_append(str, str_len, buf_len, "\n");
+// Inlined find_str_special for the serializer, where most strings are short:
+// the rest below 16 bytes is checked with one load instead of byte by byte
+JSON_NO_SANITIZE static inline const char *find_escape(const char *ptr,
+                                                      const char *end) {
+  for (; end - ptr >= 32; ptr += 32) {
+    __m128i a = str_special_sse2(_mm_loadu_si128((const __m128i *)ptr));
+    __m128i b =
+        str_special_sse2(_mm_loadu_si128((const __m128i *)(ptr + 16)));
+    if (_mm_movemask_epi8(_mm_or_si128(a, b)))
+      return ptr + __builtin_ctz((unsigned)_mm_movemask_epi8(a) |
+                                 (unsigned)_mm_movemask_epi8(b) << 16);
   }
-  for (size_t i = 0; i < arr->len; i++) {
-    if (!style->minimal)
-      append_indent_level(str, str_len, buf_len, style);
-    _json_serialize_val(&arr->values[i], str, str_len, buf_len, style);
-    if (i != arr->len - 1)
-      cstr_append(str, str_len, buf_len, style->minimal ? "," : ",\n");
+  if (end - ptr >= 16) {
+    unsigned mask =
+        str_special_mask_sse2(_mm_loadu_si128((const __m128i *)ptr));
+    if (mask)
+      return ptr + __builtin_ctz(mask);
+    ptr += 16;
   }
-  if (!style->minimal) {
-    style->indentation_level -= 1;
-    cstr_append(str, str_len, buf_len, "\n");
-    append_indent_level(str, str_len, buf_len, style);
+  size_t rest = end - ptr;
+  if (rest == 0)
+    return end;
+  // Near a page boundary the load is taken from before end instead
+  unsigned mask;
+  if (((uintptr_t)ptr & 4095) <= 4096 - 16)
+    mask = str_special_mask_sse2(_mm_loadu_si128((const __m128i *)ptr));
+  else
+    mask = str_special_mask_sse2(
+               _mm_loadu_si128((const __m128i *)(end - 16))) >>
+           (16 - rest);
+  mask &= (1u << rest) - 1;
+  return ptr + (mask ? (size_t)__builtin_ctz(mask) : rest);
+}
+
+static const char *(*scan_str_impl)(const char *) = scan_str_sse2;
+static const char *(*skip_whitespace_impl)(const char *) = skip_whitespace_sse2;
+static const char *(*find_str_special_impl)(const char *, const char *) =
+    find_str_special_sse2;
+static void (*classify_block_impl)(const char *, StructMasks *) =
+    classify_block_sse2;
+
+__attribute__((constructor)) static void json_simd_init(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    scan_str_impl = scan_str_avx2;
+    skip_whitespace_impl = skip_whitespace_avx2;
+    find_str_special_impl = find_str_special_avx2;
+    classify_block_impl = classify_block_avx2;
   }
-  cstr_append(str, str_len, buf_len, "]");
+}
+#else
+static const char *scan_str_impl(const char *ptr) {
+  while (!is_str_special(*ptr))
+    ptr++;
+  return ptr;
 }
 
-static void _json_serialize_val(JsonVal *val, char **str, size_t *str_len,
-                                size_t *buf_len, JsonStyle *style) {
-  switch (val->type) {
-  case JSON_TYPE_OBJ:
-    json_serialize_obj(val->as.obj_ptr, str, str_len, buf_len, style);
-    break;
-  case JSON_TYPE_ARR:
-    json_serialize_arr(val->as.arr_ptr, str, str_len, buf_len, style);
-    break;
-  case JSON_TYPE_STR:
-    json_serialize_jsonstr(val->as.str_ptr, str, str_len, buf_len);
+static const char *find_str_special_impl(const char *ptr, const char *end) {
+  while (ptr < end && !is_str_special(*ptr))
+    ptr++;
+  return ptr;
+}
+
+static inline const char *find_escape(const char *ptr, const char *end) {
+  return find_str_special_impl(ptr, end);
+}
+
+static const char *skip_whitespace_impl(const char *ptr) {
+  while (is_json_whitespace(*ptr))
+    ptr++;
+  return ptr;
+}
+
+JSON_NO_SANITIZE static void classify_block_impl(const char *block,
+                                                 StructMasks *m) {
+  *m = (StructMasks){0};
+  for (unsigned i = 0; i < 64; i++) {
+    uint64_t bit = UINT64_C(1) << i;
+    switch (block[i]) {
+    case '"':
+      m->quote |= bit;
+      break;
+    case '\\':
+      m->bslash |= bit;
+      break;
+    case ',':
+      m->comma |= bit;
+      break;
+    case '\0':
+      m->nul |= bit;
+      break;
+    case '[':
+    case '{':
+      m->open |= bit;
+      break;
+    case ']':
+    case '}':
+      m->close |= bit;
+      break;
+    }
+  }
+}
+#endif
+
+// Returns the first byte at or after ptr for which is_str_special holds
+static inline const char *scan_str(const char *ptr) {
+  // Most keys and short values end within a few bytes
+  for (int i = 0; i < 4; i++, ptr++)
+    if (is_str_special(*ptr))
+      return ptr;
+  return scan_str_impl(ptr);
+}
+
+// Bounded counterpart of scan_str for buffers that are not NUL-terminated:
+// never reads at or past end and returns end if no special byte was found
+static inline const char *find_str_special(const char *ptr, const char *end) {
+  return find_str_special_impl(ptr, end);
+}
+
+// Bits of the characters preceded by an odd number of backslashes, that is,
+// escaped ones. *carry tells whether the previous block ended in such a run.
+static inline uint64_t escaped_mask(uint64_t bslash, uint64_t *carry) {
+  const uint64_t even_bits = UINT64_C(0x5555555555555555);
+  uint64_t starts = bslash & ~(bslash << 1);
+  uint64_t even_start_mask = even_bits ^ *carry;
+  uint64_t even_starts = starts & even_start_mask;
+  uint64_t odd_starts = starts & ~even_start_mask;
+  // Adding the run starts carries past the end of each run
+  uint64_t even_carries = bslash + even_starts;
+  uint64_t odd_carries = bslash + odd_starts;
+  bool overflow = odd_carries < bslash;
+  odd_carries |= *carry;
+  *carry = overflow;
+  uint64_t even_start_odd_end = even_carries & ~bslash & ~even_bits;
+  uint64_t odd_start_even_end = odd_carries & ~bslash & even_bits;
+  return even_start_odd_end | odd_start_even_end;
+}
+
+// Bit i is set if an odd number of bits at or below i are
+static inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+static inline unsigned ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_ctzll(x);
+#else
+  unsigned n = 0;
+  for (; (x & 1) == 0; x >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+static inline unsigned popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_popcountll(x);
+#else
+  unsigned n = 0;
+  for (; x != 0; x &= x - 1)
+    n++;
+  return n;
+#endif
+}
+
+// Walks the text in aligned 64-byte blocks and reports the structural
+// characters outside of strings. Unescaped quotes give the string regions
+// through a prefix xor, carried over from block to block. Nothing is
+// validated.
+typedef struct {
+  const char *block;
+  uint64_t valid; // Bits at or after the start position
+  uint64_t escape_carry;
+  uint64_t in_str_carry;
+} StructScanner;
+
+static void struct_scan_init(StructScanner *sc, const char *ptr) {
+  size_t misalign = (uintptr_t)ptr & 63;
+  sc->block = ptr - misalign;
+  sc->valid = ~UINT64_C(0) << misalign;
+  sc->escape_carry = 0;
+  sc->in_str_carry = 0;
+}
+
+// Fills m for the next block and returns it. open, close and comma only keep
+// the characters outside of strings and before the terminating NUL, which is
+// the lowest bit of nul if the block has it.
+JSON_NO_SANITIZE static const char *struct_scan_next(StructScanner *sc,
+                                                     StructMasks *m) {
+  const char *block = sc->block;
+  uint64_t valid = sc->valid;
+  classify_block_impl(block, m);
+  uint64_t quote =
+      m->quote & valid & ~escaped_mask(m->bslash & valid, &sc->escape_carry);
+  uint64_t in_str = prefix_xor(quote) ^ sc->in_str_carry;
+  sc->in_str_carry = (uint64_t)((int64_t)in_str >> 63);
+  m->nul &= valid;
+  uint64_t keep = valid & ~in_str;
+  if (m->nul)
+    keep &= m->nul ^ (m->nul - 1);
+  m->open &= keep;
+  m->close &= keep;
+  m->comma &= keep;
+  sc->block += 64;
+  sc->valid = ~UINT64_C(0);
+  return block;
+}
+
+static inline void json_skip_whitespace(const char **ptr) {
+  // Compact documents have no whitespace at all between most tokens
+  if (!is_json_whitespace(**ptr))
+    return;
+  if (!is_json_whitespace(*++*ptr))
+    return;
+  *ptr = skip_whitespace_impl(*ptr);
+}
+
+// Whitespace between the tokens of a tree. Only whitespace can span lines, so
+// stopping it at the line end keeps an NDJSON record within its line: the
+// newline then fails as an unexpected character.
+static inline void parse_skip_whitespace(const JsonParser *p,
+                                         const char **text) {
+  if (!is_json_whitespace(**text))
+    return;
+  json_skip_whitespace(text);
+  if (p->line_end != NULL && *text > p->line_end)
+    *text = p->line_end;
+}
+
+// Locates the string starting at the opening quote at *text and leaves
+// *text at the closing quote. Escapes are only skipped, not validated.
+static bool json_scan_str(const char **text, const char **start, size_t *len,
+                          bool *escaped) {
+  if (**text != '"')
+    return false;
+
+  *start = ++*text;
+  *escaped = false;
+  for (;;) {
+    *text = scan_str(*text);
+    if (**text == '"')
+      break;
+    if (**text != '\\')
+      return false; // Control character or end of input
+    *escaped = true;
+    // Only rule out the terminating NUL here, json_decode_str validates the
+    // escape itself
+    if ((unsigned char)*++*text < 0x20)
+      return false;
+    (*text)++;
+  }
+  *len = *text - *start;
+  return true;
+}
+
+// With lazy set escaped strings are only validated and kept as they are
+static bool json_parse_str(JsonParser *p, JsonStr *str, const char **text,
+                           bool lazy) {
+  str->needs_dealloc = false;
+  str->escaped = false;
+  bool needs_decoding;
+  if (!json_scan_str(text, &str->start, &str->len, &needs_decoding))
+    return false;
+  stats_str(p, str->len, needs_decoding);
+
+  if (needs_decoding && lazy) {
+    if (!json_check_escapes(str->start, str->len))
+      return false;
+    str->escaped = true;
+  } else if (needs_decoding) {
+    // Decoded string is never longer than its escaped form
+    char *decoded = parser_alloc(p, str->len, 1);
+    const char *src = str->start;
+    size_t size = str->len;
+    str->start = decoded;
+    str->needs_dealloc = p->arena == NULL;
+    if (!json_decode_str_into(decoded, &str->len, src, size))
+      return false;
+    str->start = parser_fit_str(p, decoded, size, str->len);
+  }
+
+  (*text)++;
+  return true;
+}
+
+// Document mode json_parse_str that also reports the decoded copy, if it
+// made one, so that a duplicate can be given back to the arena
+static bool parse_arena_str(JsonParser *p, JsonStr *str, const char **text,
+                            bool lazy, char **decoded, size_t *decoded_size) {
+  *decoded = NULL;
+  str->needs_dealloc = false;
+  str->escaped = false;
+  bool needs_decoding;
+  if (!json_scan_str(text, &str->start, &str->len, &needs_decoding))
+    return false;
+  stats_str(p, str->len, needs_decoding);
+
+  if (needs_decoding && lazy) {
+    if (!json_check_escapes(str->start, str->len))
+      return false;
+    str->escaped = true;
+  } else if (needs_decoding) {
+    *decoded_size = str->len;
+    *decoded = arena_alloc(p->arena, str->len, 1);
+    STATS_ADD(p->stats, allocs, 1);
+    STATS_ADD(p->stats, alloc_bytes, str->len);
+    if (!json_decode_str_into(*decoded, &str->len, str->start, str->len))
+      return false;
+    str->start = *decoded;
+  }
+
+  (*text)++;
+  return true;
+}
+
+// Undoes the arena allocation if nothing was allocated after it
+static void arena_give_back(JsonArena *arena, char *ptr, size_t size) {
+  if (ptr != NULL && arena->head->cur == ptr + size)
+    arena->head->cur = ptr;
+}
+
+// Equal keys of the document share the bytes of the first one
+static bool parse_interned_key(JsonParser *p, JsonStr *key,
+                               const char **text) {
+  char *decoded;
+  size_t decoded_size;
+  if (!parse_arena_str(p, key, text, false, &decoded, &decoded_size))
+    return false;
+  InternEntry *e = intern_get(p->intern, key->start, key->len);
+  if (e->start != key->start) {
+    arena_give_back(p->arena, decoded, decoded_size);
+    key->start = e->start;
+  }
+  return true;
+}
+
+static inline bool is_digit(char c) { return (unsigned char)(c - '0') < 10; }
+
+#define POW5_MIN_EXP (-342)
+#define POW5_MAX_EXP 308
+#define MAX_FAST_DIGITS 19
+
+// Truncated 128-bit approximations of 5^q for q in [POW5_MIN_EXP,
+// POW5_MAX_EXP], most significant word first (Eisel-Lemire)
+static const uint64_t pow5_128[][2] = {
+    {0xeef453d6923bd65a, 0x113faa2906a13b3f},
+    {0x9558b4661b6565f8, 0x4ac7ca59a424c507},
+    {0xbaaee17fa23ebf76, 0x5d79bcf00d2df649},
+    {0xe95a99df8ace6f53, 0xf4d82c2c107973dc},
+    {0x91d8a02bb6c10594, 0x79071b9b8a4be869},
+    {0xb64ec836a47146f9, 0x9748e2826cdee284},
+    {0xe3e27a444d8d98b7, 0xfd1b1b2308169b25},
+    {0x8e6d8c6ab0787f72, 0xfe30f0f5e50e20f7},
+    {0xb208ef855c969f4f, 0xbdbd2d335e51a935},
+    {0xde8b2b66b3bc4723, 0xad2c788035e61382},
+    {0x8b16fb203055ac76, 0x4c3bcb5021afcc31},
+    {0xaddcb9e83c6b1793, 0xdf4abe242a1bbf3d},
+    {0xd953e8624b85dd78, 0xd71d6dad34a2af0d},
+    {0x87d4713d6f33aa6b, 0x8672648c40e5ad68},
+    {0xa9c98d8ccb009506, 0x680efdaf511f18c2},
+    {0xd43bf0effdc0ba48, 0x0212bd1b2566def2},
+    {0x84a57695fe98746d, 0x014bb630f7604b57},
+    {0xa5ced43b7e3e9188, 0x419ea3bd35385e2d},
+    {0xcf42894a5dce35ea, 0x52064cac828675b9},
+    {0x818995ce7aa0e1b2, 0x7343efebd1940993},
+    {0xa1ebfb4219491a1f, 0x1014ebe6c5f90bf8},
+    {0xca66fa129f9b60a6, 0xd41a26e077774ef6},
+    {0xfd00b897478238d0, 0x8920b098955522b4},
+    {0x9e20735e8cb16382, 0x55b46e5f5d5535b0},
+    {0xc5a890362fddbc62, 0xeb2189f734aa831d},
+    {0xf712b443bbd52b7b, 0xa5e9ec7501d523e4},
+    {0x9a6bb0aa55653b2d, 0x47b233c92125366e},
+    {0xc1069cd4eabe89f8, 0x999ec0bb696e840a},
+    {0xf148440a256e2c76, 0xc00670ea43ca250d},
+    {0x96cd2a865764dbca, 0x380406926a5e5728},
+    {0xbc807527ed3e12bc, 0xc605083704f5ecf2},
+    {0xeba09271e88d976b, 0xf7864a44c633682e},
+    {0x93445b8731587ea3, 0x7ab3ee6afbe0211d},
+    {0xb8157268fdae9e4c, 0x5960ea05bad82964},
+    {0xe61acf033d1a45df, 0x6fb92487298e33bd},
+    {0x8fd0c16206306bab, 0xa5d3b6d479f8e056},
+    {0xb3c4f1ba87bc8696, 0x8f48a4899877186c},
+    {0xe0b62e2929aba83c, 0x331acdabfe94de87},
+    {0x8c71dcd9ba0b4925, 0x9ff0c08b7f1d0b14},
+    {0xaf8e5410288e1b6f, 0x07ecf0ae5ee44dd9},
+    {0xdb71e91432b1a24a, 0xc9e82cd9f69d6150},
+    {0x892731ac9faf056e, 0xbe311c083a225cd2},
+    {0xab70fe17c79ac6ca, 0x6dbd630a48aaf406},
+    {0xd64d3d9db981787d, 0x092cbbccdad5b108},
+    {0x85f0468293f0eb4e, 0x25bbf56008c58ea5},
+    {0xa76c582338ed2621, 0xaf2af2b80af6f24e},
+    {0xd1476e2c07286faa, 0x1af5af660db4aee1},
+    {0x82cca4db847945ca, 0x50d98d9fc890ed4d},
+    {0xa37fce126597973c, 0xe50ff107bab528a0},
+    {0xcc5fc196fefd7d0c, 0x1e53ed49a96272c8},
+    {0xff77b1fcbebcdc4f, 0x25e8e89c13bb0f7a},
+    {0x9faacf3df73609b1, 0x77b191618c54e9ac},
+    {0xc795830d75038c1d, 0xd59df5b9ef6a2417},
+    {0xf97ae3d0d2446f25, 0x4b0573286b44ad1d},
+    {0x9becce62836ac577, 0x4ee367f9430aec32},
+    {0xc2e801fb244576d5, 0x229c41f793cda73f},
+    {0xf3a20279ed56d48a, 0x6b43527578c1110f},
+    {0x9845418c345644d6, 0x830a13896b78aaa9},
+    {0xbe5691ef416bd60c, 0x23cc986bc656d553},
+    {0xedec366b11c6cb8f, 0x2cbfbe86b7ec8aa8},
+    {0x94b3a202eb1c3f39, 0x7bf7d71432f3d6a9},
+    {0xb9e08a83a5e34f07, 0xdaf5ccd93fb0cc53},
+    {0xe858ad248f5c22c9, 0xd1b3400f8f9cff68},
+    {0x91376c36d99995be, 0x23100809b9c21fa1},
+    {0xb58547448ffffb2d, 0xabd40a0c2832a78a},
+    {0xe2e69915b3fff9f9, 0x16c90c8f323f516c},
+    {0x8dd01fad907ffc3b, 0xae3da7d97f6792e3},
+    {0xb1442798f49ffb4a, 0x99cd11cfdf41779c},
+    {0xdd95317f31c7fa1d, 0x40405643d711d583},
+    {0x8a7d3eef7f1cfc52, 0x482835ea666b2572},
+    {0xad1c8eab5ee43b66, 0xda3243650005eecf},
+    {0xd863b256369d4a40, 0x90bed43e40076a82},
+    {0x873e4f75e2224e68, 0x5a7744a6e804a291},
+    {0xa90de3535aaae202, 0x711515d0a205cb36},
+    {0xd3515c2831559a83, 0x0d5a5b44ca873e03},
+    {0x8412d9991ed58091, 0xe858790afe9486c2},
+    {0xa5178fff668ae0b6, 0x626e974dbe39a872},
+    {0xce5d73ff402d98e3, 0xfb0a3d212dc8128f},
+    {0x80fa687f881c7f8e, 0x7ce66634bc9d0b99},
+    {0xa139029f6a239f72, 0x1c1fffc1ebc44e80},
+    {0xc987434744ac874e, 0xa327ffb266b56220},
+    {0xfbe9141915d7a922, 0x4bf1ff9f0062baa8},
+    {0x9d71ac8fada6c9b5, 0x6f773fc3603db4a9},
+    {0xc4ce17b399107c22, 0xcb550fb4384d21d3},
+    {0xf6019da07f549b2b, 0x7e2a53a146606a48},
+    {0x99c102844f94e0fb, 0x2eda7444cbfc426d},
+    {0xc0314325637a1939, 0xfa911155fefb5308},
+    {0xf03d93eebc589f88, 0x793555ab7eba27ca},
+    {0x96267c7535b763b5, 0x4bc1558b2f3458de},
+    {0xbbb01b9283253ca2, 0x9eb1aaedfb016f16},
+    {0xea9c227723ee8bcb, 0x465e15a979c1cadc},
+    {0x92a1958a7675175f, 0x0bfacd89ec191ec9},
+    {0xb749faed14125d36, 0xcef980ec671f667b},
+    {0xe51c79a85916f484, 0x82b7e12780e7401a},
+    {0x8f31cc0937ae58d2, 0xd1b2ecb8b0908810},
+    {0xb2fe3f0b8599ef07, 0x861fa7e6dcb4aa15},
+    {0xdfbdcece67006ac9, 0x67a791e093e1d49a},
+    {0x8bd6a141006042bd, 0xe0c8bb2c5c6d24e0},
+    {0xaecc49914078536d, 0x58fae9f773886e18},
+    {0xda7f5bf590966848, 0xaf39a475506a899e},
+    {0x888f99797a5e012d, 0x6d8406c952429603},
+    {0xaab37fd7d8f58178, 0xc8e5087ba6d33b83},
+    {0xd5605fcdcf32e1d6, 0xfb1e4a9a90880a64},
+    {0x855c3be0a17fcd26, 0x5cf2eea09a55067f},
+    {0xa6b34ad8c9dfc06f, 0xf42faa48c0ea481e},
+    {0xd0601d8efc57b08b, 0xf13b94daf124da26},
+    {0x823c12795db6ce57, 0x76c53d08d6b70858},
+    {0xa2cb1717b52481ed, 0x54768c4b0c64ca6e},
+    {0xcb7ddcdda26da268, 0xa9942f5dcf7dfd09},
+    {0xfe5d54150b090b02, 0xd3f93b35435d7c4c},
+    {0x9efa548d26e5a6e1, 0xc47bc5014a1a6daf},
+    {0xc6b8e9b0709f109a, 0x359ab6419ca1091b},
+    {0xf867241c8cc6d4c0, 0xc30163d203c94b62},
+    {0x9b407691d7fc44f8, 0x79e0de63425dcf1d},
+    {0xc21094364dfb5636, 0x985915fc12f542e4},
+    {0xf294b943e17a2bc4, 0x3e6f5b7b17b2939d},
+    {0x979cf3ca6cec5b5a, 0xa705992ceecf9c42},
+    {0xbd8430bd08277231, 0x50c6ff782a838353},
+    {0xece53cec4a314ebd, 0xa4f8bf5635246428},
+    {0x940f4613ae5ed136, 0x871b7795e136be99},
+    {0xb913179899f68584, 0x28e2557b59846e3f},
+    {0xe757dd7ec07426e5, 0x331aeada2fe589cf},
+    {0x9096ea6f3848984f, 0x3ff0d2c85def7621},
+    {0xb4bca50b065abe63, 0x0fed077a756b53a9},
+    {0xe1ebce4dc7f16dfb, 0xd3e8495912c62894},
+    {0x8d3360f09cf6e4bd, 0x64712dd7abbbd95c},
+    {0xb080392cc4349dec, 0xbd8d794d96aacfb3},
+    {0xdca04777f541c567, 0xecf0d7a0fc5583a0},
+    {0x89e42caaf9491b60, 0xf41686c49db57244},
+    {0xac5d37d5b79b6239, 0x311c2875c522ced5},
+    {0xd77485cb25823ac7, 0x7d633293366b828b},
+    {0x86a8d39ef77164bc, 0xae5dff9c02033197},
+    {0xa8530886b54dbdeb, 0xd9f57f830283fdfc},
+    {0xd267caa862a12d66, 0xd072df63c324fd7b},
+    {0x8380dea93da4bc60, 0x4247cb9e59f71e6d},
+    {0xa46116538d0deb78, 0x52d9be85f074e608},
+    {0xcd795be870516656, 0x67902e276c921f8b},
+    {0x806bd9714632dff6, 0x00ba1cd8a3db53b6},
+    {0xa086cfcd97bf97f3, 0x80e8a40eccd228a4},
+    {0xc8a883c0fdaf7df0, 0x6122cd128006b2cd},
+    {0xfad2a4b13d1b5d6c, 0x796b805720085f81},
+    {0x9cc3a6eec6311a63, 0xcbe3303674053bb0},
+    {0xc3f490aa77bd60fc, 0xbedbfc4411068a9c},
+    {0xf4f1b4d515acb93b, 0xee92fb5515482d44},
+    {0x991711052d8bf3c5, 0x751bdd152d4d1c4a},
+    {0xbf5cd54678eef0b6, 0xd262d45a78a0635d},
+    {0xef340a98172aace4, 0x86fb897116c87c34},
+    {0x9580869f0e7aac0e, 0xd45d35e6ae3d4da0},
+    {0xbae0a846d2195712, 0x8974836059cca109},
+    {0xe998d258869facd7, 0x2bd1a438703fc94b},
+    {0x91ff83775423cc06, 0x7b6306a34627ddcf},
+    {0xb67f6455292cbf08, 0x1a3bc84c17b1d542},
+    {0xe41f3d6a7377eeca, 0x20caba5f1d9e4a93},
+    {0x8e938662882af53e, 0x547eb47b7282ee9c},
+    {0xb23867fb2a35b28d, 0xe99e619a4f23aa43},
+    {0xdec681f9f4c31f31, 0x6405fa00e2ec94d4},
+    {0x8b3c113c38f9f37e, 0xde83bc408dd3dd04},
+    {0xae0b158b4738705e, 0x9624ab50b148d445},
+    {0xd98ddaee19068c76, 0x3badd624dd9b0957},
+    {0x87f8a8d4cfa417c9, 0xe54ca5d70a80e5d6},
+    {0xa9f6d30a038d1dbc, 0x5e9fcf4ccd211f4c},
+    {0xd47487cc8470652b, 0x7647c3200069671f},
+    {0x84c8d4dfd2c63f3b, 0x29ecd9f40041e073},
+    {0xa5fb0a17c777cf09, 0xf468107100525890},
+    {0xcf79cc9db955c2cc, 0x7182148d4066eeb4},
+    {0x81ac1fe293d599bf, 0xc6f14cd848405530},
+    {0xa21727db38cb002f, 0xb8ada00e5a506a7c},
+    {0xca9cf1d206fdc03b, 0xa6d90811f0e4851c},
+    {0xfd442e4688bd304a, 0x908f4a166d1da663},
+    {0x9e4a9cec15763e2e, 0x9a598e4e043287fe},
+    {0xc5dd44271ad3cdba, 0x40eff1e1853f29fd},
+    {0xf7549530e188c128, 0xd12bee59e68ef47c},
+    {0x9a94dd3e8cf578b9, 0x82bb74f8301958ce},
+    {0xc13a148e3032d6e7, 0xe36a52363c1faf01},
+    {0xf18899b1bc3f8ca1, 0xdc44e6c3cb279ac1},
+    {0x96f5600f15a7b7e5, 0x29ab103a5ef8c0b9},
+    {0xbcb2b812db11a5de, 0x7415d448f6b6f0e7},
+    {0xebdf661791d60f56, 0x111b495b3464ad21},
+    {0x936b9fcebb25c995, 0xcab10dd900beec34},
+    {0xb84687c269ef3bfb, 0x3d5d514f40eea742},
+    {0xe65829b3046b0afa, 0x0cb4a5a3112a5112},
+    {0x8ff71a0fe2c2e6dc, 0x47f0e785eaba72ab},
+    {0xb3f4e093db73a093, 0x59ed216765690f56},
+    {0xe0f218b8d25088b8, 0x306869c13ec3532c},
+    {0x8c974f7383725573, 0x1e414218c73a13fb},
+    {0xafbd2350644eeacf, 0xe5d1929ef90898fa},
+    {0xdbac6c247d62a583, 0xdf45f746b74abf39},
+    {0x894bc396ce5da772, 0x6b8bba8c328eb783},
+    {0xab9eb47c81f5114f, 0x066ea92f3f326564},
+    {0xd686619ba27255a2, 0xc80a537b0efefebd},
+    {0x8613fd0145877585, 0xbd06742ce95f5f36},
+    {0xa798fc4196e952e7, 0x2c48113823b73704},
+    {0xd17f3b51fca3a7a0, 0xf75a15862ca504c5},
+    {0x82ef85133de648c4, 0x9a984d73dbe722fb},
+    {0xa3ab66580d5fdaf5, 0xc13e60d0d2e0ebba},
+    {0xcc963fee10b7d1b3, 0x318df905079926a8},
+    {0xffbbcfe994e5c61f, 0xfdf17746497f7052},
+    {0x9fd561f1fd0f9bd3, 0xfeb6ea8bedefa633},
+    {0xc7caba6e7c5382c8, 0xfe64a52ee96b8fc0},
+    {0xf9bd690a1b68637b, 0x3dfdce7aa3c673b0},
+    {0x9c1661a651213e2d, 0x06bea10ca65c084e},
+    {0xc31bfa0fe5698db8, 0x486e494fcff30a62},
+    {0xf3e2f893dec3f126, 0x5a89dba3c3efccfa},
+    {0x986ddb5c6b3a76b7, 0xf89629465a75e01c},
+    {0xbe89523386091465, 0xf6bbb397f1135823},
+    {0xee2ba6c0678b597f, 0x746aa07ded582e2c},
+    {0x94db483840b717ef, 0xa8c2a44eb4571cdc},
+    {0xba121a4650e4ddeb, 0x92f34d62616ce413},
+    {0xe896a0d7e51e1566, 0x77b020baf9c81d17},
+    {0x915e2486ef32cd60, 0x0ace1474dc1d122e},
+    {0xb5b5ada8aaff80b8, 0x0d819992132456ba},
+    {0xe3231912d5bf60e6, 0x10e1fff697ed6c69},
+    {0x8df5efabc5979c8f, 0xca8d3ffa1ef463c1},
+    {0xb1736b96b6fd83b3, 0xbd308ff8a6b17cb2},
+    {0xddd0467c64bce4a0, 0xac7cb3f6d05ddbde},
+    {0x8aa22c0dbef60ee4, 0x6bcdf07a423aa96b},
+    {0xad4ab7112eb3929d, 0x86c16c98d2c953c6},
+    {0xd89d64d57a607744, 0xe871c7bf077ba8b7},
+    {0x87625f056c7c4a8b, 0x11471cd764ad4972},
+    {0xa93af6c6c79b5d2d, 0xd598e40d3dd89bcf},
+    {0xd389b47879823479, 0x4aff1d108d4ec2c3},
+    {0x843610cb4bf160cb, 0xcedf722a585139ba},
+    {0xa54394fe1eedb8fe, 0xc2974eb4ee658828},
+    {0xce947a3da6a9273e, 0x733d226229feea32},
+    {0x811ccc668829b887, 0x0806357d5a3f525f},
+    {0xa163ff802a3426a8, 0xca07c2dcb0cf26f7},
+    {0xc9bcff6034c13052, 0xfc89b393dd02f0b5},
+    {0xfc2c3f3841f17c67, 0xbbac2078d443ace2},
+    {0x9d9ba7832936edc0, 0xd54b944b84aa4c0d},
+    {0xc5029163f384a931, 0x0a9e795e65d4df11},
+    {0xf64335bcf065d37d, 0x4d4617b5ff4a16d5},
+    {0x99ea0196163fa42e, 0x504bced1bf8e4e45},
+    {0xc06481fb9bcf8d39, 0xe45ec2862f71e1d6},
+    {0xf07da27a82c37088, 0x5d767327bb4e5a4c},
+    {0x964e858c91ba2655, 0x3a6a07f8d510f86f},
+    {0xbbe226efb628afea, 0x890489f70a55368b},
+    {0xeadab0aba3b2dbe5, 0x2b45ac74ccea842e},
+    {0x92c8ae6b464fc96f, 0x3b0b8bc90012929d},
+    {0xb77ada0617e3bbcb, 0x09ce6ebb40173744},
+    {0xe55990879ddcaabd, 0xcc420a6a101d0515},
+    {0x8f57fa54c2a9eab6, 0x9fa946824a12232d},
+    {0xb32df8e9f3546564, 0x47939822dc96abf9},
+    {0xdff9772470297ebd, 0x59787e2b93bc56f7},
+    {0x8bfbea76c619ef36, 0x57eb4edb3c55b65a},
+    {0xaefae51477a06b03, 0xede622920b6b23f1},
+    {0xdab99e59958885c4, 0xe95fab368e45eced},
+    {0x88b402f7fd75539b, 0x11dbcb0218ebb414},
+    {0xaae103b5fcd2a881, 0xd652bdc29f26a119},
+    {0xd59944a37c0752a2, 0x4be76d3346f0495f},
+    {0x857fcae62d8493a5, 0x6f70a4400c562ddb},
+    {0xa6dfbd9fb8e5b88e, 0xcb4ccd500f6bb952},
+    {0xd097ad07a71f26b2, 0x7e2000a41346a7a7},
+    {0x825ecc24c873782f, 0x8ed400668c0c28c8},
+    {0xa2f67f2dfa90563b, 0x728900802f0f32fa},
+    {0xcbb41ef979346bca, 0x4f2b40a03ad2ffb9},
+    {0xfea126b7d78186bc, 0xe2f610c84987bfa8},
+    {0x9f24b832e6b0f436, 0x0dd9ca7d2df4d7c9},
+    {0xc6ede63fa05d3143, 0x91503d1c79720dbb},
+    {0xf8a95fcf88747d94, 0x75a44c6397ce912a},
+    {0x9b69dbe1b548ce7c, 0xc986afbe3ee11aba},
+    {0xc24452da229b021b, 0xfbe85badce996168},
+    {0xf2d56790ab41c2a2, 0xfae27299423fb9c3},
+    {0x97c560ba6b0919a5, 0xdccd879fc967d41a},
+    {0xbdb6b8e905cb600f, 0x5400e987bbc1c920},
+    {0xed246723473e3813, 0x290123e9aab23b68},
+    {0x9436c0760c86e30b, 0xf9a0b6720aaf6521},
+    {0xb94470938fa89bce, 0xf808e40e8d5b3e69},
+    {0xe7958cb87392c2c2, 0xb60b1d1230b20e04},
+    {0x90bd77f3483bb9b9, 0xb1c6f22b5e6f48c2},
+    {0xb4ecd5f01a4aa828, 0x1e38aeb6360b1af3},
+    {0xe2280b6c20dd5232, 0x25c6da63c38de1b0},
+    {0x8d590723948a535f, 0x579c487e5a38ad0e},
+    {0xb0af48ec79ace837, 0x2d835a9df0c6d851},
+    {0xdcdb1b2798182244, 0xf8e431456cf88e65},
+    {0x8a08f0f8bf0f156b, 0x1b8e9ecb641b58ff},
+    {0xac8b2d36eed2dac5, 0xe272467e3d222f3f},
+    {0xd7adf884aa879177, 0x5b0ed81dcc6abb0f},
+    {0x86ccbb52ea94baea, 0x98e947129fc2b4e9},
+    {0xa87fea27a539e9a5, 0x3f2398d747b36224},
+    {0xd29fe4b18e88640e, 0x8eec7f0d19a03aad},
+    {0x83a3eeeef9153e89, 0x1953cf68300424ac},
+    {0xa48ceaaab75a8e2b, 0x5fa8c3423c052dd7},
+    {0xcdb02555653131b6, 0x3792f412cb06794d},
+    {0x808e17555f3ebf11, 0xe2bbd88bbee40bd0},
+    {0xa0b19d2ab70e6ed6, 0x5b6aceaeae9d0ec4},
+    {0xc8de047564d20a8b, 0xf245825a5a445275},
+    {0xfb158592be068d2e, 0xeed6e2f0f0d56712},
+    {0x9ced737bb6c4183d, 0x55464dd69685606b},
+    {0xc428d05aa4751e4c, 0xaa97e14c3c26b886},
+    {0xf53304714d9265df, 0xd53dd99f4b3066a8},
+    {0x993fe2c6d07b7fab, 0xe546a8038efe4029},
+    {0xbf8fdb78849a5f96, 0xde98520472bdd033},
+    {0xef73d256a5c0f77c, 0x963e66858f6d4440},
+    {0x95a8637627989aad, 0xdde7001379a44aa8},
+    {0xbb127c53b17ec159, 0x5560c018580d5d52},
+    {0xe9d71b689dde71af, 0xaab8f01e6e10b4a6},
+    {0x9226712162ab070d, 0xcab3961304ca70e8},
+    {0xb6b00d69bb55c8d1, 0x3d607b97c5fd0d22},
+    {0xe45c10c42a2b3b05, 0x8cb89a7db77c506a},
+    {0x8eb98a7a9a5b04e3, 0x77f3608e92adb242},
+    {0xb267ed1940f1c61c, 0x55f038b237591ed3},
+    {0xdf01e85f912e37a3, 0x6b6c46dec52f6688},
+    {0x8b61313bbabce2c6, 0x2323ac4b3b3da015},
+    {0xae397d8aa96c1b77, 0xabec975e0a0d081a},
+    {0xd9c7dced53c72255, 0x96e7bd358c904a21},
+    {0x881cea14545c7575, 0x7e50d64177da2e54},
+    {0xaa242499697392d2, 0xdde50bd1d5d0b9e9},
+    {0xd4ad2dbfc3d07787, 0x955e4ec64b44e864},
+    {0x84ec3c97da624ab4, 0xbd5af13bef0b113e},
+    {0xa6274bbdd0fadd61, 0xecb1ad8aeacdd58e},
+    {0xcfb11ead453994ba, 0x67de18eda5814af2},
+    {0x81ceb32c4b43fcf4, 0x80eacf948770ced7},
+    {0xa2425ff75e14fc31, 0xa1258379a94d028d},
+    {0xcad2f7f5359a3b3e, 0x096ee45813a04330},
+    {0xfd87b5f28300ca0d, 0x8bca9d6e188853fc},
+    {0x9e74d1b791e07e48, 0x775ea264cf55347e},
+    {0xc612062576589dda, 0x95364afe032a819e},
+    {0xf79687aed3eec551, 0x3a83ddbd83f52205},
+    {0x9abe14cd44753b52, 0xc4926a9672793543},
+    {0xc16d9a0095928a27, 0x75b7053c0f178294},
+    {0xf1c90080baf72cb1, 0x5324c68b12dd6339},
+    {0x971da05074da7bee, 0xd3f6fc16ebca5e04},
+    {0xbce5086492111aea, 0x88f4bb1ca6bcf585},
+    {0xec1e4a7db69561a5, 0x2b31e9e3d06c32e6},
+    {0x9392ee8e921d5d07, 0x3aff322e62439fd0},
+    {0xb877aa3236a4b449, 0x09befeb9fad487c3},
+    {0xe69594bec44de15b, 0x4c2ebe687989a9b4},
+    {0x901d7cf73ab0acd9, 0x0f9d37014bf60a11},
+    {0xb424dc35095cd80f, 0x538484c19ef38c95},
+    {0xe12e13424bb40e13, 0x2865a5f206b06fba},
+    {0x8cbccc096f5088cb, 0xf93f87b7442e45d4},
+    {0xafebff0bcb24aafe, 0xf78f69a51539d749},
+    {0xdbe6fecebdedd5be, 0xb573440e5a884d1c},
+    {0x89705f4136b4a597, 0x31680a88f8953031},
+    {0xabcc77118461cefc, 0xfdc20d2b36ba7c3e},
+    {0xd6bf94d5e57a42bc, 0x3d32907604691b4d},
+    {0x8637bd05af6c69b5, 0xa63f9a49c2c1b110},
+    {0xa7c5ac471b478423, 0x0fcf80dc33721d54},
+    {0xd1b71758e219652b, 0xd3c36113404ea4a9},
+    {0x83126e978d4fdf3b, 0x645a1cac083126ea},
+    {0xa3d70a3d70a3d70a, 0x3d70a3d70a3d70a4},
+    {0xcccccccccccccccc, 0xcccccccccccccccd},
+    {0x8000000000000000, 0x0000000000000000},
+    {0xa000000000000000, 0x0000000000000000},
+    {0xc800000000000000, 0x0000000000000000},
+    {0xfa00000000000000, 0x0000000000000000},
+    {0x9c40000000000000, 0x0000000000000000},
+    {0xc350000000000000, 0x0000000000000000},
+    {0xf424000000000000, 0x0000000000000000},
+    {0x9896800000000000, 0x0000000000000000},
+    {0xbebc200000000000, 0x0000000000000000},
+    {0xee6b280000000000, 0x0000000000000000},
+    {0x9502f90000000000, 0x0000000000000000},
+    {0xba43b74000000000, 0x0000000000000000},
+    {0xe8d4a51000000000, 0x0000000000000000},
+    {0x9184e72a00000000, 0x0000000000000000},
+    {0xb5e620f480000000, 0x0000000000000000},
+    {0xe35fa931a0000000, 0x0000000000000000},
+    {0x8e1bc9bf04000000, 0x0000000000000000},
+    {0xb1a2bc2ec5000000, 0x0000000000000000},
+    {0xde0b6b3a76400000, 0x0000000000000000},
+    {0x8ac7230489e80000, 0x0000000000000000},
+    {0xad78ebc5ac620000, 0x0000000000000000},
+    {0xd8d726b7177a8000, 0x0000000000000000},
+    {0x878678326eac9000, 0x0000000000000000},
+    {0xa968163f0a57b400, 0x0000000000000000},
+    {0xd3c21bcecceda100, 0x0000000000000000},
+    {0x84595161401484a0, 0x0000000000000000},
+    {0xa56fa5b99019a5c8, 0x0000000000000000},
+    {0xcecb8f27f4200f3a, 0x0000000000000000},
+    {0x813f3978f8940984, 0x4000000000000000},
+    {0xa18f07d736b90be5, 0x5000000000000000},
+    {0xc9f2c9cd04674ede, 0xa400000000000000},
+    {0xfc6f7c4045812296, 0x4d00000000000000},
+    {0x9dc5ada82b70b59d, 0xf020000000000000},
+    {0xc5371912364ce305, 0x6c28000000000000},
+    {0xf684df56c3e01bc6, 0xc732000000000000},
+    {0x9a130b963a6c115c, 0x3c7f400000000000},
+    {0xc097ce7bc90715b3, 0x4b9f100000000000},
+    {0xf0bdc21abb48db20, 0x1e86d40000000000},
+    {0x96769950b50d88f4, 0x1314448000000000},
+    {0xbc143fa4e250eb31, 0x17d955a000000000},
+    {0xeb194f8e1ae525fd, 0x5dcfab0800000000},
+    {0x92efd1b8d0cf37be, 0x5aa1cae500000000},
+    {0xb7abc627050305ad, 0xf14a3d9e40000000},
+    {0xe596b7b0c643c719, 0x6d9ccd05d0000000},
+    {0x8f7e32ce7bea5c6f, 0xe4820023a2000000},
+    {0xb35dbf821ae4f38b, 0xdda2802c8a800000},
+    {0xe0352f62a19e306e, 0xd50b2037ad200000},
+    {0x8c213d9da502de45, 0x4526f422cc340000},
+    {0xaf298d050e4395d6, 0x9670b12b7f410000},
+    {0xdaf3f04651d47b4c, 0x3c0cdd765f114000},
+    {0x88d8762bf324cd0f, 0xa5880a69fb6ac800},
+    {0xab0e93b6efee0053, 0x8eea0d047a457a00},
+    {0xd5d238a4abe98068, 0x72a4904598d6d880},
+    {0x85a36366eb71f041, 0x47a6da2b7f864750},
+    {0xa70c3c40a64e6c51, 0x999090b65f67d924},
+    {0xd0cf4b50cfe20765, 0xfff4b4e3f741cf6d},
+    {0x82818f1281ed449f, 0xbff8f10e7a8921a4},
+    {0xa321f2d7226895c7, 0xaff72d52192b6a0d},
+    {0xcbea6f8ceb02bb39, 0x9bf4f8a69f764490},
+    {0xfee50b7025c36a08, 0x02f236d04753d5b4},
+    {0x9f4f2726179a2245, 0x01d762422c946590},
+    {0xc722f0ef9d80aad6, 0x424d3ad2b7b97ef5},
+    {0xf8ebad2b84e0d58b, 0xd2e0898765a7deb2},
+    {0x9b934c3b330c8577, 0x63cc55f49f88eb2f},
+    {0xc2781f49ffcfa6d5, 0x3cbf6b71c76b25fb},
+    {0xf316271c7fc3908a, 0x8bef464e3945ef7a},
+    {0x97edd871cfda3a56, 0x97758bf0e3cbb5ac},
+    {0xbde94e8e43d0c8ec, 0x3d52eeed1cbea317},
+    {0xed63a231d4c4fb27, 0x4ca7aaa863ee4bdd},
+    {0x945e455f24fb1cf8, 0x8fe8caa93e74ef6a},
+    {0xb975d6b6ee39e436, 0xb3e2fd538e122b44},
+    {0xe7d34c64a9c85d44, 0x60dbbca87196b616},
+    {0x90e40fbeea1d3a4a, 0xbc8955e946fe31cd},
+    {0xb51d13aea4a488dd, 0x6babab6398bdbe41},
+    {0xe264589a4dcdab14, 0xc696963c7eed2dd1},
+    {0x8d7eb76070a08aec, 0xfc1e1de5cf543ca2},
+    {0xb0de65388cc8ada8, 0x3b25a55f43294bcb},
+    {0xdd15fe86affad912, 0x49ef0eb713f39ebe},
+    {0x8a2dbf142dfcc7ab, 0x6e3569326c784337},
+    {0xacb92ed9397bf996, 0x49c2c37f07965404},
+    {0xd7e77a8f87daf7fb, 0xdc33745ec97be906},
+    {0x86f0ac99b4e8dafd, 0x69a028bb3ded71a3},
+    {0xa8acd7c0222311bc, 0xc40832ea0d68ce0c},
+    {0xd2d80db02aabd62b, 0xf50a3fa490c30190},
+    {0x83c7088e1aab65db, 0x792667c6da79e0fa},
+    {0xa4b8cab1a1563f52, 0x577001b891185938},
+    {0xcde6fd5e09abcf26, 0xed4c0226b55e6f86},
+    {0x80b05e5ac60b6178, 0x544f8158315b05b4},
+    {0xa0dc75f1778e39d6, 0x696361ae3db1c721},
+    {0xc913936dd571c84c, 0x03bc3a19cd1e38e9},
+    {0xfb5878494ace3a5f, 0x04ab48a04065c723},
+    {0x9d174b2dcec0e47b, 0x62eb0d64283f9c76},
+    {0xc45d1df942711d9a, 0x3ba5d0bd324f8394},
+    {0xf5746577930d6500, 0xca8f44ec7ee36479},
+    {0x9968bf6abbe85f20, 0x7e998b13cf4e1ecb},
+    {0xbfc2ef456ae276e8, 0x9e3fedd8c321a67e},
+    {0xefb3ab16c59b14a2, 0xc5cfe94ef3ea101e},
+    {0x95d04aee3b80ece5, 0xbba1f1d158724a12},
+    {0xbb445da9ca61281f, 0x2a8a6e45ae8edc97},
+    {0xea1575143cf97226, 0xf52d09d71a3293bd},
+    {0x924d692ca61be758, 0x593c2626705f9c56},
+    {0xb6e0c377cfa2e12e, 0x6f8b2fb00c77836c},
+    {0xe498f455c38b997a, 0x0b6dfb9c0f956447},
+    {0x8edf98b59a373fec, 0x4724bd4189bd5eac},
+    {0xb2977ee300c50fe7, 0x58edec91ec2cb657},
+    {0xdf3d5e9bc0f653e1, 0x2f2967b66737e3ed},
+    {0x8b865b215899f46c, 0xbd79e0d20082ee74},
+    {0xae67f1e9aec07187, 0xecd8590680a3aa11},
+    {0xda01ee641a708de9, 0xe80e6f4820cc9495},
+    {0x884134fe908658b2, 0x3109058d147fdcdd},
+    {0xaa51823e34a7eede, 0xbd4b46f0599fd415},
+    {0xd4e5e2cdc1d1ea96, 0x6c9e18ac7007c91a},
+    {0x850fadc09923329e, 0x03e2cf6bc604ddb0},
+    {0xa6539930bf6bff45, 0x84db8346b786151c},
+    {0xcfe87f7cef46ff16, 0xe612641865679a63},
+    {0x81f14fae158c5f6e, 0x4fcb7e8f3f60c07e},
+    {0xa26da3999aef7749, 0xe3be5e330f38f09d},
+    {0xcb090c8001ab551c, 0x5cadf5bfd3072cc5},
+    {0xfdcb4fa002162a63, 0x73d9732fc7c8f7f6},
+    {0x9e9f11c4014dda7e, 0x2867e7fddcdd9afa},
+    {0xc646d63501a1511d, 0xb281e1fd541501b8},
+    {0xf7d88bc24209a565, 0x1f225a7ca91a4226},
+    {0x9ae757596946075f, 0x3375788de9b06958},
+    {0xc1a12d2fc3978937, 0x0052d6b1641c83ae},
+    {0xf209787bb47d6b84, 0xc0678c5dbd23a49a},
+    {0x9745eb4d50ce6332, 0xf840b7ba963646e0},
+    {0xbd176620a501fbff, 0xb650e5a93bc3d898},
+    {0xec5d3fa8ce427aff, 0xa3e51f138ab4cebe},
+    {0x93ba47c980e98cdf, 0xc66f336c36b10137},
+    {0xb8a8d9bbe123f017, 0xb80b0047445d4184},
+    {0xe6d3102ad96cec1d, 0xa60dc059157491e5},
+    {0x9043ea1ac7e41392, 0x87c89837ad68db2f},
+    {0xb454e4a179dd1877, 0x29babe4598c311fb},
+    {0xe16a1dc9d8545e94, 0xf4296dd6fef3d67a},
+    {0x8ce2529e2734bb1d, 0x1899e4a65f58660c},
+    {0xb01ae745b101e9e4, 0x5ec05dcff72e7f8f},
+    {0xdc21a1171d42645d, 0x76707543f4fa1f73},
+    {0x899504ae72497eba, 0x6a06494a791c53a8},
+    {0xabfa45da0edbde69, 0x0487db9d17636892},
+    {0xd6f8d7509292d603, 0x45a9d2845d3c42b6},
+    {0x865b86925b9bc5c2, 0x0b8a2392ba45a9b2},
+    {0xa7f26836f282b732, 0x8e6cac7768d7141e},
+    {0xd1ef0244af2364ff, 0x3207d795430cd926},
+    {0x8335616aed761f1f, 0x7f44e6bd49e807b8},
+    {0xa402b9c5a8d3a6e7, 0x5f16206c9c6209a6},
+    {0xcd036837130890a1, 0x36dba887c37a8c0f},
+    {0x802221226be55a64, 0xc2494954da2c9789},
+    {0xa02aa96b06deb0fd, 0xf2db9baa10b7bd6c},
+    {0xc83553c5c8965d3d, 0x6f92829494e5acc7},
+    {0xfa42a8b73abbf48c, 0xcb772339ba1f17f9},
+    {0x9c69a97284b578d7, 0xff2a760414536efb},
+    {0xc38413cf25e2d70d, 0xfef5138519684aba},
+    {0xf46518c2ef5b8cd1, 0x7eb258665fc25d69},
+    {0x98bf2f79d5993802, 0xef2f773ffbd97a61},
+    {0xbeeefb584aff8603, 0xaafb550ffacfd8fa},
+    {0xeeaaba2e5dbf6784, 0x95ba2a53f983cf38},
+    {0x952ab45cfa97a0b2, 0xdd945a747bf26183},
+    {0xba756174393d88df, 0x94f971119aeef9e4},
+    {0xe912b9d1478ceb17, 0x7a37cd5601aab85d},
+    {0x91abb422ccb812ee, 0xac62e055c10ab33a},
+    {0xb616a12b7fe617aa, 0x577b986b314d6009},
+    {0xe39c49765fdf9d94, 0xed5a7e85fda0b80b},
+    {0x8e41ade9fbebc27d, 0x14588f13be847307},
+    {0xb1d219647ae6b31c, 0x596eb2d8ae258fc8},
+    {0xde469fbd99a05fe3, 0x6fca5f8ed9aef3bb},
+    {0x8aec23d680043bee, 0x25de7bb9480d5854},
+    {0xada72ccc20054ae9, 0xaf561aa79a10ae6a},
+    {0xd910f7ff28069da4, 0x1b2ba1518094da04},
+    {0x87aa9aff79042286, 0x90fb44d2f05d0842},
+    {0xa99541bf57452b28, 0x353a1607ac744a53},
+    {0xd3fa922f2d1675f2, 0x42889b8997915ce8},
+    {0x847c9b5d7c2e09b7, 0x69956135febada11},
+    {0xa59bc234db398c25, 0x43fab9837e699095},
+    {0xcf02b2c21207ef2e, 0x94f967e45e03f4bb},
+    {0x8161afb94b44f57d, 0x1d1be0eebac278f5},
+    {0xa1ba1ba79e1632dc, 0x6462d92a69731732},
+    {0xca28a291859bbf93, 0x7d7b8f7503cfdcfe},
+    {0xfcb2cb35e702af78, 0x5cda735244c3d43e},
+    {0x9defbf01b061adab, 0x3a0888136afa64a7},
+    {0xc56baec21c7a1916, 0x088aaa1845b8fdd0},
+    {0xf6c69a72a3989f5b, 0x8aad549e57273d45},
+    {0x9a3c2087a63f6399, 0x36ac54e2f678864b},
+    {0xc0cb28a98fcf3c7f, 0x84576a1bb416a7dd},
+    {0xf0fdf2d3f3c30b9f, 0x656d44a2a11c51d5},
+    {0x969eb7c47859e743, 0x9f644ae5a4b1b325},
+    {0xbc4665b596706114, 0x873d5d9f0dde1fee},
+    {0xeb57ff22fc0c7959, 0xa90cb506d155a7ea},
+    {0x9316ff75dd87cbd8, 0x09a7f12442d588f2},
+    {0xb7dcbf5354e9bece, 0x0c11ed6d538aeb2f},
+    {0xe5d3ef282a242e81, 0x8f1668c8a86da5fa},
+    {0x8fa475791a569d10, 0xf96e017d694487bc},
+    {0xb38d92d760ec4455, 0x37c981dcc395a9ac},
+    {0xe070f78d3927556a, 0x85bbe253f47b1417},
+    {0x8c469ab843b89562, 0x93956d7478ccec8e},
+    {0xaf58416654a6babb, 0x387ac8d1970027b2},
+    {0xdb2e51bfe9d0696a, 0x06997b05fcc0319e},
+    {0x88fcf317f22241e2, 0x441fece3bdf81f03},
+    {0xab3c2fddeeaad25a, 0xd527e81cad7626c3},
+    {0xd60b3bd56a5586f1, 0x8a71e223d8d3b074},
+    {0x85c7056562757456, 0xf6872d5667844e49},
+    {0xa738c6bebb12d16c, 0xb428f8ac016561db},
+    {0xd106f86e69d785c7, 0xe13336d701beba52},
+    {0x82a45b450226b39c, 0xecc0024661173473},
+    {0xa34d721642b06084, 0x27f002d7f95d0190},
+    {0xcc20ce9bd35c78a5, 0x31ec038df7b441f4},
+    {0xff290242c83396ce, 0x7e67047175a15271},
+    {0x9f79a169bd203e41, 0x0f0062c6e984d386},
+    {0xc75809c42c684dd1, 0x52c07b78a3e60868},
+    {0xf92e0c3537826145, 0xa7709a56ccdf8a82},
+    {0x9bbcc7a142b17ccb, 0x88a66076400bb691},
+    {0xc2abf989935ddbfe, 0x6acff893d00ea435},
+    {0xf356f7ebf83552fe, 0x0583f6b8c4124d43},
+    {0x98165af37b2153de, 0xc3727a337a8b704a},
+    {0xbe1bf1b059e9a8d6, 0x744f18c0592e4c5c},
+    {0xeda2ee1c7064130c, 0x1162def06f79df73},
+    {0x9485d4d1c63e8be7, 0x8addcb5645ac2ba8},
+    {0xb9a74a0637ce2ee1, 0x6d953e2bd7173692},
+    {0xe8111c87c5c1ba99, 0xc8fa8db6ccdd0437},
+    {0x910ab1d4db9914a0, 0x1d9c9892400a22a2},
+    {0xb54d5e4a127f59c8, 0x2503beb6d00cab4b},
+    {0xe2a0b5dc971f303a, 0x2e44ae64840fd61d},
+    {0x8da471a9de737e24, 0x5ceaecfed289e5d2},
+    {0xb10d8e1456105dad, 0x7425a83e872c5f47},
+    {0xdd50f1996b947518, 0xd12f124e28f77719},
+    {0x8a5296ffe33cc92f, 0x82bd6b70d99aaa6f},
+    {0xace73cbfdc0bfb7b, 0x636cc64d1001550b},
+    {0xd8210befd30efa5a, 0x3c47f7e05401aa4e},
+    {0x8714a775e3e95c78, 0x65acfaec34810a71},
+    {0xa8d9d1535ce3b396, 0x7f1839a741a14d0d},
+    {0xd31045a8341ca07c, 0x1ede48111209a050},
+    {0x83ea2b892091e44d, 0x934aed0aab460432},
+    {0xa4e4b66b68b65d60, 0xf81da84d5617853f},
+    {0xce1de40642e3f4b9, 0x36251260ab9d668e},
+    {0x80d2ae83e9ce78f3, 0xc1d72b7c6b426019},
+    {0xa1075a24e4421730, 0xb24cf65b8612f81f},
+    {0xc94930ae1d529cfc, 0xdee033f26797b627},
+    {0xfb9b7cd9a4a7443c, 0x169840ef017da3b1},
+    {0x9d412e0806e88aa5, 0x8e1f289560ee864e},
+    {0xc491798a08a2ad4e, 0xf1a6f2bab92a27e2},
+    {0xf5b5d7ec8acb58a2, 0xae10af696774b1db},
+    {0x9991a6f3d6bf1765, 0xacca6da1e0a8ef29},
+    {0xbff610b0cc6edd3f, 0x17fd090a58d32af3},
+    {0xeff394dcff8a948e, 0xddfc4b4cef07f5b0},
+    {0x95f83d0a1fb69cd9, 0x4abdaf101564f98e},
+    {0xbb764c4ca7a4440f, 0x9d6d1ad41abe37f1},
+    {0xea53df5fd18d5513, 0x84c86189216dc5ed},
+    {0x92746b9be2f8552c, 0x32fd3cf5b4e49bb4},
+    {0xb7118682dbb66a77, 0x3fbc8c33221dc2a1},
+    {0xe4d5e82392a40515, 0x0fabaf3feaa5334a},
+    {0x8f05b1163ba6832d, 0x29cb4d87f2a7400e},
+    {0xb2c71d5bca9023f8, 0x743e20e9ef511012},
+    {0xdf78e4b2bd342cf6, 0x914da9246b255416},
+    {0x8bab8eefb6409c1a, 0x1ad089b6c2f7548e},
+    {0xae9672aba3d0c320, 0xa184ac2473b529b1},
+    {0xda3c0f568cc4f3e8, 0xc9e5d72d90a2741e},
+    {0x8865899617fb1871, 0x7e2fa67c7a658892},
+    {0xaa7eebfb9df9de8d, 0xddbb901b98feeab7},
+    {0xd51ea6fa85785631, 0x552a74227f3ea565},
+    {0x8533285c936b35de, 0xd53a88958f87275f},
+    {0xa67ff273b8460356, 0x8a892abaf368f137},
+    {0xd01fef10a657842c, 0x2d2b7569b0432d85},
+    {0x8213f56a67f6b29b, 0x9c3b29620e29fc73},
+    {0xa298f2c501f45f42, 0x8349f3ba91b47b8f},
+    {0xcb3f2f7642717713, 0x241c70a936219a73},
+    {0xfe0efb53d30dd4d7, 0xed238cd383aa0110},
+    {0x9ec95d1463e8a506, 0xf4363804324a40aa},
+    {0xc67bb4597ce2ce48, 0xb143c6053edcd0d5},
+    {0xf81aa16fdc1b81da, 0xdd94b7868e94050a},
+    {0x9b10a4e5e9913128, 0xca7cf2b4191c8326},
+    {0xc1d4ce1f63f57d72, 0xfd1c2f611f63a3f0},
+    {0xf24a01a73cf2dccf, 0xbc633b39673c8cec},
+    {0x976e41088617ca01, 0xd5be0503e085d813},
+    {0xbd49d14aa79dbc82, 0x4b2d8644d8a74e18},
+    {0xec9c459d51852ba2, 0xddf8e7d60ed1219e},
+    {0x93e1ab8252f33b45, 0xcabb90e5c942b503},
+    {0xb8da1662e7b00a17, 0x3d6a751f3b936243},
+    {0xe7109bfba19c0c9d, 0x0cc512670a783ad4},
+    {0x906a617d450187e2, 0x27fb2b80668b24c5},
+    {0xb484f9dc9641e9da, 0xb1f9f660802dedf6},
+    {0xe1a63853bbd26451, 0x5e7873f8a0396973},
+    {0x8d07e33455637eb2, 0xdb0b487b6423e1e8},
+    {0xb049dc016abc5e5f, 0x91ce1a9a3d2cda62},
+    {0xdc5c5301c56b75f7, 0x7641a140cc7810fb},
+    {0x89b9b3e11b6329ba, 0xa9e904c87fcb0a9d},
+    {0xac2820d9623bf429, 0x546345fa9fbdcd44},
+    {0xd732290fbacaf133, 0xa97c177947ad4095},
+    {0x867f59a9d4bed6c0, 0x49ed8eabcccc485d},
+    {0xa81f301449ee8c70, 0x5c68f256bfff5a74},
+    {0xd226fc195c6a2f8c, 0x73832eec6fff3111},
+    {0x83585d8fd9c25db7, 0xc831fd53c5ff7eab},
+    {0xa42e74f3d032f525, 0xba3e7ca8b77f5e55},
+    {0xcd3a1230c43fb26f, 0x28ce1bd2e55f35eb},
+    {0x80444b5e7aa7cf85, 0x7980d163cf5b81b3},
+    {0xa0555e361951c366, 0xd7e105bcc332621f},
+    {0xc86ab5c39fa63440, 0x8dd9472bf3fefaa7},
+    {0xfa856334878fc150, 0xb14f98f6f0feb951},
+    {0x9c935e00d4b9d8d2, 0x6ed1bf9a569f33d3},
+    {0xc3b8358109e84f07, 0x0a862f80ec4700c8},
+    {0xf4a642e14c6262c8, 0xcd27bb612758c0fa},
+    {0x98e7e9cccfbd7dbd, 0x8038d51cb897789c},
+    {0xbf21e44003acdd2c, 0xe0470a63e6bd56c3},
+    {0xeeea5d5004981478, 0x1858ccfce06cac74},
+    {0x95527a5202df0ccb, 0x0f37801e0c43ebc8},
+    {0xbaa718e68396cffd, 0xd30560258f54e6ba},
+    {0xe950df20247c83fd, 0x47c6b82ef32a2069},
+    {0x91d28b7416cdd27e, 0x4cdc331d57fa5441},
+    {0xb6472e511c81471d, 0xe0133fe4adf8e952},
+    {0xe3d8f9e563a198e5, 0x58180fddd97723a6},
+    {0x8e679c2f5e44ff8f, 0x570f09eaa7ea7648},
+};
+
+static const double exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline uint64_t umul128(uint64_t a, uint64_t b, uint64_t *hi) {
+#ifdef __SIZEOF_INT128__
+  __extension__ unsigned __int128 res = (unsigned __int128)a * b;
+  *hi = (uint64_t)(res >> 64);
+  return (uint64_t)res;
+#else
+  uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+  uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+  uint64_t lo_lo = a_lo * b_lo;
+  uint64_t hi_lo = a_hi * b_lo;
+  uint64_t lo_hi = a_lo * b_hi;
+  uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+  *hi = a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+  return (cross << 32) | (uint32_t)lo_lo;
+#endif
+}
+
+// Correctly rounded w * 10^q. Fails on results that are out of the range of
+// normal doubles, like strtod reporting ERANGE.
+static bool compute_double(uint64_t w, int64_t q, bool neg, double *res) {
+  if (w == 0) {
+    *res = neg ? -0.0 : 0.0;
+    return true;
+  }
+  // Clinger: both w and 10^|q| are exact doubles, so one operation rounds
+  if (q >= -22 && q <= 22 && w <= (UINT64_C(1) << 53)) {
+    double d = (double)w;
+    d = q < 0 ? d / exact_pow10[-q] : d * exact_pow10[q];
+    *res = neg ? -d : d;
+    return true;
+  }
+  if (q < POW5_MIN_EXP || q > POW5_MAX_EXP)
+    return false;
+
+  int lz = __builtin_clzll(w);
+  w <<= lz;
+  const uint64_t *pow5 = pow5_128[q - POW5_MIN_EXP];
+  uint64_t hi;
+  uint64_t lo = umul128(w, pow5[0], &hi);
+  if ((hi & 0x1FF) == 0x1FF) { // Low bits inconclusive, refine
+    uint64_t hi2;
+    umul128(w, pow5[1], &hi2);
+    lo += hi2;
+    if (hi2 > lo)
+      hi++;
+  }
+
+  int upperbit = (int)(hi >> 63);
+  int shift = upperbit + 64 - 52 - 3;
+  uint64_t mantissa = hi >> shift;
+  int64_t power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 1023;
+  if (power2 <= 0)
+    return false; // Subnormal or zero
+
+  // Exactly halfway between two doubles: round to even
+  if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+      (mantissa << shift) == hi)
+    mantissa &= ~UINT64_C(1);
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >= (UINT64_C(2) << 52)) {
+    mantissa = UINT64_C(1) << 52;
+    power2++;
+  }
+  mantissa &= ~(UINT64_C(1) << 52);
+  if (power2 >= 0x7FF)
+    return false; // Infinity
+
+  uint64_t bits = mantissa | ((uint64_t)power2 << 52) | ((uint64_t)neg << 63);
+  memcpy(res, &bits, sizeof(bits));
+  return true;
+}
+
+// Classifies and converts a number in a single pass. A '.' or an exponent
+// marker that is not followed by digits is left for the caller, as is
+// everything after the number. On failure *text is not moved.
+static bool json_parse_num(JsonVal *res, const char **text) {
+  const char *ptr = *text;
+  bool neg = *ptr == '-';
+  ptr += neg;
+  if (*ptr == '0' && is_digit(ptr[1]))
+    return false;
+
+  uint64_t w = 0;
+  int digits = 0; // Significant digits accumulated in w
+  int64_t exp10 = 0;
+  bool truncated = false;
+  for (; is_digit(*ptr); ptr++) {
+    if (digits < MAX_FAST_DIGITS) {
+      w = w * 10 + (uint64_t)(*ptr - '0');
+      digits += w != 0;
+    } else {
+      truncated = true;
+      exp10++;
+    }
+  }
+
+  bool is_frc = false;
+  if (*ptr == '.' && is_digit(ptr[1])) {
+    is_frc = true;
+    for (ptr++; is_digit(*ptr); ptr++) {
+      if (digits < MAX_FAST_DIGITS) {
+        w = w * 10 + (uint64_t)(*ptr - '0');
+        digits += w != 0;
+        exp10--;
+      } else
+        truncated = true;
+    }
+  }
+  if ((*ptr == 'e' || *ptr == 'E') &&
+      (is_digit(ptr[1]) ||
+       ((ptr[1] == '-' || ptr[1] == '+') && is_digit(ptr[2])))) {
+    is_frc = true;
+    bool exp_neg = *++ptr == '-';
+    ptr += *ptr == '-' || *ptr == '+';
+    int64_t exp = 0;
+    for (; is_digit(*ptr); ptr++)
+      if (exp < 100000) // Far beyond any representable magnitude
+        exp = exp * 10 + (*ptr - '0');
+    exp10 += exp_neg ? -exp : exp;
+  }
+
+  if (!is_frc) {
+    if (truncated || w > (uint64_t)LLONG_MAX + neg)
+      return false;
+    res->type = JSON_TYPE_INT;
+    res->as.integer = neg ? (long long)(0 - w) : (long long)w;
+  } else {
+    res->type = JSON_TYPE_FRC;
+    if (truncated) {
+      // More than MAX_FAST_DIGITS significant digits, rare enough for the
+      // slow path
+      char *end;
+      errno = 0;
+      res->as.fract = strtod(*text, &end);
+      if (errno == ERANGE || !isfinite(res->as.fract))
+        return false;
+    } else if (!compute_double(w, exp10, neg, &res->as.fract))
+      return false;
+  }
+  *text = ptr;
+  return true;
+}
+
+// Short string values equal to a recent one share its JsonStr node
+static bool parse_interned_val(JsonParser *p, JsonVal *res,
+                               const char **text) {
+  JsonStr str;
+  char *decoded;
+  size_t decoded_size;
+  if (!parse_arena_str(p, &str, text,
+                       (p->flags & JSON_PARSE_LAZY_STRINGS) != 0, &decoded,
+                       &decoded_size))
+    return false;
+  res->type = JSON_TYPE_STR;
+
+  InternEntry *slot = NULL;
+  uint64_t h = 0;
+  if (!str.escaped && str.len <= INTERN_MAX_VALUE_LEN) {
+    JsonInternTable *t = p->intern;
+    if (t->values == NULL)
+      t->values = calloc(INTERN_VALUE_CACHE_SIZE, sizeof(InternEntry));
+    h = hash_bytes(str.start, str.len);
+    slot = &t->values[h & (INTERN_VALUE_CACHE_SIZE - 1)];
+    if (slot->node != NULL && slot->hash == h && slot->len == str.len &&
+        memcmp(slot->start, str.start, str.len) == 0) {
+      arena_give_back(p->arena, decoded, decoded_size);
+      res->as.str_ptr = slot->node;
+      return true;
+    }
+  }
+  res->as.str_ptr = arena_alloc(p->arena, sizeof(JsonStr), ARENA_NODE_ALIGN);
+  *res->as.str_ptr = str;
+  if (slot != NULL)
+    *slot = (InternEntry){
+        .start = str.start, .len = str.len, .hash = h, .node = res->as.str_ptr};
+  return true;
+}
+
+// Strings, numbers and literals. On failure *res is still safe to free.
+static bool parse_scalar(JsonParser *p, JsonVal *res, const char **text) {
+  res->type = JSON_TYPE_NUL;
+  if (**text == '"' && p->intern != NULL &&
+      (p->flags & JSON_PARSE_INTERN_STRINGS)) {
+    if (!parse_interned_val(p, res, text))
+      return false;
+  } else if (**text == '"') {
+    res->as.str_ptr = parser_alloc(p, sizeof(JsonStr), ARENA_NODE_ALIGN);
+    res->type = JSON_TYPE_STR;
+    if (!json_parse_str(p, res->as.str_ptr, text,
+                        (p->flags & JSON_PARSE_LAZY_STRINGS) != 0)) {
+      return false;
+    }
+  } else if (is_digit(**text) || (**text == '-' && is_digit(*(*text + 1)))) {
+    if (!json_parse_num(res, text))
+      return false;
+  } else if (0 == strncmp(*text, TRUE_STR, sizeof(TRUE_STR) - 1)) {
+    // Bool: true
+    res->as.boolean = true;
+    res->type = JSON_TYPE_BOL;
+    (*text) += sizeof(TRUE_STR) - 1;
+  } else if (0 == strncmp(*text, FALSE_STR, sizeof(FALSE_STR) - 1)) {
+    // Bool: false
+    res->as.boolean = false;
+    res->type = JSON_TYPE_BOL;
+    (*text) += sizeof(FALSE_STR) - 1;
+  } else if (0 == strncmp(*text, NULL_STR, sizeof(NULL_STR) - 1)) {
+    // Null
+    res->type = JSON_TYPE_NUL;
+    (*text) += sizeof(NULL_STR) - 1;
+  } else {
+    return false;
+  }
+  STATS_ADD(p->stats, values[res->type], 1);
+  return true;
+}
+
+#define WALK_LOCAL_DEPTH 256
+
+// Doubles the explicit stack of an iterative walker, which starts out in a
+// local array and moves to the heap when the nesting gets deep
+static void *walk_grow(void *frames, const void *local, size_t *cap,
+                       size_t elem_size) {
+  void *grown = frames == local ? malloc(*cap * 2 * elem_size)
+                                : realloc(frames, *cap * 2 * elem_size);
+  if (frames == local)
+    memcpy(grown, local, *cap * elem_size);
+  *cap *= 2;
+  return grown;
+}
+
+// Open object or array. Its node is linked into the parent as soon as it is
+// opened, its elements are collected on the scratch stack from base on.
+typedef struct {
+  void *node;
+  size_t base;
+  bool is_obj;
+} ParseFrame;
+
+// Puts a parsed value into the innermost open container, or into *res at the
+// top level. In an object it completes the pair with the pending key.
+static inline void parse_link(JsonParser *p, const ParseFrame *frames,
+                              size_t depth, JsonVal *res, JsonPair *pair,
+                              const JsonVal *val) {
+  if (depth == 0)
+    *res = *val;
+  else if (frames[depth - 1].is_obj) {
+    pair->value = *val;
+    scratch_push(p, pair, sizeof(JsonPair));
+  } else
+    scratch_push(p, val, sizeof(JsonVal));
+}
+
+// JSON_PARSE_PACK_NUMBERS: elements that are all integers or all fractional
+// numbers are copied to a packed buffer instead
+static bool arr_pack(JsonParser *p, JsonArr *arr, const JsonVal *vals,
+                     size_t len) {
+  JsonType type = len > 0 ? vals[0].type : JSON_TYPE_NUL;
+  if (type != JSON_TYPE_INT && type != JSON_TYPE_FRC)
+    return false;
+  for (size_t i = 1; i < len; i++)
+    if (vals[i].type != type)
+      return false;
+  if (type == JSON_TYPE_INT) {
+    arr->ints = parser_alloc(p, len * sizeof(long long), ARENA_NODE_ALIGN);
+    for (size_t i = 0; i < len; i++)
+      arr->ints[i] = vals[i].as.integer;
+    arr->kind = JSON_ARR_INTS;
+  } else {
+    arr->fracts = parser_alloc(p, len * sizeof(double), ARENA_NODE_ALIGN);
+    for (size_t i = 0; i < len; i++)
+      arr->fracts[i] = vals[i].as.fract;
+    arr->kind = JSON_ARR_FRCS;
+  }
+  arr->len = len;
+  return true;
+}
+
+// scratch_pop of the elements of an array
+static void arr_pop(JsonParser *p, JsonArr *arr, size_t base) {
+  if ((p->flags & JSON_PARSE_PACK_NUMBERS) &&
+      arr_pack(p, arr, (const JsonVal *)(p->scratch + base),
+               (p->scratch_len - base) / sizeof(JsonVal)))
+    p->scratch_len = base;
+  else
+    arr->values = scratch_pop(p, base, sizeof(JsonVal), &arr->len);
+}
+
+// Copies the elements of the innermost container out of the scratch stack.
+// Containers closed by an error get no key index.
+static void parse_close(JsonParser *p, const ParseFrame *f, bool complete) {
+  if (f->is_obj) {
+    JsonObj *obj = f->node;
+    obj->pairs = scratch_pop(p, f->base, sizeof(JsonPair), &obj->len);
+    // From the parser's arena: in a worker thread obj->arena is the shared
+    // document arena
+    if (complete && (p->flags & JSON_PARSE_INDEX_KEYS) &&
+        obj->len >= OBJ_INDEX_MIN_LEN)
+      obj_build_index(obj, p->arena);
+  } else {
+    arr_pop(p, f->node, f->base);
+  }
+  if (complete)
+    STATS_ADD(p->stats, values[f->is_obj ? JSON_TYPE_OBJ : JSON_TYPE_ARR], 1);
+}
+
+// Not recursive: the open containers are kept on an explicit stack, so
+// hostile nesting fails at the max_depth bracket instead of exhausting the
+// C stack. On failure the open containers are closed, leaving everything
+// parsed so far in *res, and *text points at the error.
+static bool _json_parse_val(JsonParser *p, JsonVal *res, const char **text) {
+  ParseFrame local[WALK_LOCAL_DEPTH];
+  ParseFrame *frames = local;
+  size_t depth = 0, cap = WALK_LOCAL_DEPTH;
+  size_t max_depth = parser_max_depth(p);
+  JsonPair pair;        // Pending key of the innermost object
+  bool has_key = false; // pair.key is set, its value is not parsed yet
+  bool ok = false;
+  res->type = JSON_TYPE_NUL;
+
+  for (;;) {
+    JsonVal val;
+    if (**text == '{' || **text == '[') {
+      bool is_obj = **text == '{';
+      if (p->depth + depth == max_depth)
+        goto fail;
+      if (depth == cap)
+        frames = walk_grow(frames, local, &cap, sizeof(ParseFrame));
+      if (is_obj) {
+        JsonObj *obj = parser_alloc(p, sizeof(JsonObj), ARENA_NODE_ALIGN);
+        obj->pairs = NULL;
+        obj->len = 0;
+        obj->index = NULL;
+        obj->arena = p->owner;
+        obj->alloc = p->alloc;
+        val.type = JSON_TYPE_OBJ;
+        val.as.obj_ptr = obj;
+      } else {
+        JsonArr *arr = parser_alloc(p, sizeof(JsonArr), ARENA_NODE_ALIGN);
+        arr->values = NULL;
+        arr->len = 0;
+        arr->kind = JSON_ARR_VALUES;
+        val.type = JSON_TYPE_ARR;
+        val.as.arr_ptr = arr;
+      }
+      parse_link(p, frames, depth, res, &pair, &val);
+      has_key = false;
+      ParseFrame *f = &frames[depth++];
+      f->node = is_obj ? (void *)val.as.obj_ptr : (void *)val.as.arr_ptr;
+      f->base = p->scratch_len;
+      f->is_obj = is_obj;
+      stats_depth(p, p->depth + depth);
+
+      (*text)++;
+      parse_skip_whitespace(p, text);
+      if (**text != (is_obj ? '}' : ']')) {
+        if (is_obj)
+          goto key;
+        continue;
+      }
+      (*text)++;
+      parse_close(p, f, true);
+      depth--;
+    } else {
+      ok = parse_scalar(p, &val, text);
+      parse_link(p, frames, depth, res, &pair, &val);
+      has_key = false;
+      if (!ok)
+        goto fail;
+    }
+
+    // After a value: a separator, or the end of the containers it completes
+    for (;;) {
+      if (depth == 0) {
+        ok = true;
+        goto done;
+      }
+      ParseFrame *f = &frames[depth - 1];
+      parse_skip_whitespace(p, text);
+      if (**text == ',') {
+        (*text)++;
+        parse_skip_whitespace(p, text);
+        if (f->is_obj)
+          goto key;
+        break;
+      }
+      if (**text != (f->is_obj ? '}' : ']'))
+        goto fail;
+      (*text)++;
+      parse_close(p, f, true);
+      depth--;
+    }
+    continue;
+
+  key:
+    has_key = true;
+    if (p->intern != NULL && (p->flags & JSON_PARSE_INTERN_KEYS))
+      ok = parse_interned_key(p, &pair.key, text);
+    else
+      ok = json_parse_str(p, &pair.key, text, false);
+    if (!ok)
+      goto fail;
+    parse_skip_whitespace(p, text);
+    if (**text != ':')
+      goto fail;
+    (*text)++;
+    parse_skip_whitespace(p, text);
+  }
+
+fail:
+  ok = false;
+  while (depth > 0) {
+    if (has_key) {
+      // Pushed with a null value, so the key gets freed with the object
+      JsonVal nul = {.type = JSON_TYPE_NUL};
+      parse_link(p, frames, depth, res, &pair, &nul);
+      has_key = false;
+    }
+    parse_close(p, &frames[--depth], false);
+  }
+done:
+  if (frames != local)
+    free(frames);
+  return ok;
+}
+
+#ifdef JSON_THREADS
+// Parallel parsing of a top level array in two stages. First a quick scan
+// over the structural characters (skipping strings) finds the commas that
+// separate the top level elements. Then the elements are parsed by a group of
+// threads directly into their slots of the values array. The scan does not
+// validate anything: every element is parsed in full and must end exactly at
+// the separator found for it, so malformed input is rejected as usual.
+
+typedef struct {
+  JsonParser p;
+  JsonArena arena; // Merged into the document arena afterwards
+  JsonStats stats; // Merged into the attached stats afterwards
+  struct ParallelArr *arr;
+  size_t err_idx;
+  const char *err_pos;
+} ParallelWorker;
+
+typedef struct ParallelArr {
+  const char *first; // First element (after '[')
+  const char **seps; // Separator after each element: ',' or the final ']'
+  JsonVal *values;
+  size_t len;
+  atomic_size_t next;    // Start of the next unclaimed batch
+  atomic_size_t err_idx; // Lowest failed element so far
+} ParallelArr;
+
+// Records the position of the ',' or ']' after each top level element into
+// *seps. Stops early at a stray '}' or the end of input, the last entry then
+// points there.
+static size_t split_top_arr(const char *ptr, const char ***seps) {
+  size_t len = 0, cap = 1024;
+  *seps = malloc(cap * sizeof(const char *));
+  size_t depth = 0;
+  StructScanner sc;
+  struct_scan_init(&sc, ptr);
+  for (;;) {
+    StructMasks m;
+    const char *block = struct_scan_next(&sc, &m);
+    uint64_t structural = m.open | m.close | m.comma;
+    for (; structural != 0; structural &= structural - 1) {
+      const char *c = block + ctz64(structural);
+      if (*c == '[' || *c == '{')
+        depth++;
+      else if (depth > 0 && *c != ',')
+        depth--;
+      else if (depth == 0) {
+        if (len == cap) {
+          cap *= 2;
+          *seps = realloc(*seps, cap * sizeof(const char *));
+        }
+        (*seps)[len++] = c;
+        if (*c != ',')
+          return len;
+      }
+    }
+    if (m.nul) {
+      if (len == cap)
+        *seps = realloc(*seps, (cap + 1) * sizeof(const char *));
+      (*seps)[len++] = block + ctz64(m.nul);
+      return len;
+    }
+  }
+}
+
+static void *parallel_worker(void *arg) {
+  ParallelWorker *w = arg;
+  ParallelArr *arr = w->arr;
+  for (;;) {
+    size_t start = atomic_fetch_add(&arr->next, PARALLEL_BATCH);
+    if (start >= arr->len || start > atomic_load(&arr->err_idx))
+      break;
+    size_t end = start + PARALLEL_BATCH < arr->len ? start + PARALLEL_BATCH
+                                                   : arr->len;
+    for (size_t i = start; i < end; i++) {
+      const char *text = i == 0 ? arr->first : arr->seps[i - 1] + 1;
+      json_skip_whitespace(&text);
+      bool ok = _json_parse_val(&w->p, &arr->values[i], &text);
+      if (ok) {
+        json_skip_whitespace(&text);
+        ok = text == arr->seps[i] && (i + 1 < arr->len || *text == ']');
+      }
+      if (!ok) {
+        w->err_idx = i;
+        w->err_pos = text;
+        size_t cur = atomic_load(&arr->err_idx);
+        while (i < cur &&
+               !atomic_compare_exchange_weak(&arr->err_idx, &cur, i))
+          ;
+        return NULL;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Adds the blocks of a worker arena to the target, after its current block
+static void arena_merge(JsonArena *target, JsonArena *src) {
+  if (src->head == NULL)
+    return;
+  JsonArenaBlock *tail = src->head;
+  while (tail->next != NULL)
+    tail = tail->next;
+  if (target->head == NULL)
+    target->head = src->head;
+  else {
+    tail->next = target->head->next;
+    target->head->next = src->head;
+  }
+}
+
+static bool parse_arr_parallel(JsonParser *p, JsonVal *res, const char **text,
+                               unsigned threads) {
+  const char *first = *text + 1;
+  json_skip_whitespace(&first);
+  if (*first == ']')
+    return _json_parse_val(p, res, text);
+  ParallelArr arr = {.first = first};
+  arr.len = split_top_arr(first, &arr.seps);
+  if (arr.seps[arr.len - 1] - *text < PARALLEL_MIN_SIZE) {
+    free(arr.seps);
+    return _json_parse_val(p, res, text);
+  }
+
+  res->type = JSON_TYPE_ARR;
+  res->as.arr_ptr = parser_alloc(p, sizeof(JsonArr), ARENA_NODE_ALIGN);
+  arr.values = parser_alloc(p, arr.len * sizeof(JsonVal), ARENA_NODE_ALIGN);
+  for (size_t i = 0; i < arr.len; i++)
+    arr.values[i].type = JSON_TYPE_NUL;
+  atomic_init(&arr.next, 0);
+  atomic_init(&arr.err_idx, SIZE_MAX);
+
+  size_t batches = (arr.len + PARALLEL_BATCH - 1) / PARALLEL_BATCH;
+  if (threads > batches)
+    threads = (unsigned)batches;
+  ParallelWorker *workers = calloc(threads, sizeof(ParallelWorker));
+  pthread_t *tids = malloc(threads * sizeof(pthread_t));
+  unsigned started = 1; // The calling thread is worker 0
+  for (unsigned i = 0; i < threads; i++) {
+    ParallelWorker *w = &workers[i];
+    w->arr = &arr;
+    w->err_idx = SIZE_MAX;
+    w->arena.next_block_size = ARENA_MIN_BLOCK_SIZE;
+    w->arena.alloc = p->alloc;
+    w->p.arena = p->arena != NULL ? &w->arena : NULL;
+    w->p.owner = p->owner;
+    w->p.flags = p->flags;
+    w->p.stats = p->stats != NULL ? &w->stats : NULL;
+    w->p.depth = 1; // Inside the top level array
+    w->p.max_depth = p->max_depth;
+    w->p.alloc = p->alloc;
+    if (i > 0 && pthread_create(&tids[started], NULL, parallel_worker, w) == 0)
+      started++;
+  }
+  parallel_worker(&workers[0]);
+  for (unsigned i = 1; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  size_t err_idx = SIZE_MAX;
+  for (unsigned i = 0; i < threads; i++) {
+    ParallelWorker *w = &workers[i];
+    if (w->err_idx < err_idx) {
+      err_idx = w->err_idx;
+      *text = w->err_pos;
+    }
+    scratch_free(&w->p);
+    if (p->arena != NULL)
+      arena_merge(p->arena, &w->arena);
+#ifndef JSON_NO_STATS
+    if (p->stats != NULL)
+      stats_merge(p->stats, &w->stats);
+#endif
+  }
+  free(workers);
+  free(tids);
+
+  res->as.arr_ptr->values = arr.values;
+  res->as.arr_ptr->len = arr.len;
+  res->as.arr_ptr->kind = JSON_ARR_VALUES;
+  STATS_ADD(p->stats, values[JSON_TYPE_ARR], 1);
+  if (p->stats != NULL && p->stats->max_depth < 1)
+    p->stats->max_depth = 1;
+  if (err_idx != SIZE_MAX) {
+    // Keep the same partial tree as the sequential parser: elements up to
+    // the failed one
+    if (p->arena == NULL)
+      for (size_t i = err_idx + 1; i < arr.len; i++)
+        json_free_val(&arr.values[i]);
+    res->as.arr_ptr->len = err_idx + 1;
+  } else {
+    *text = arr.seps[arr.len - 1] + 1;
+    // The values array stays behind in a document arena
+    if ((p->flags & JSON_PARSE_PACK_NUMBERS) &&
+        arr_pack(p, res->as.arr_ptr, arr.values, arr.len) && p->arena == NULL)
+      mem_free(p->alloc, arr.values, arr.len * sizeof(JsonVal));
+  }
+  free(arr.seps);
+  return err_idx == SIZE_MAX;
+}
+#endif
+
+static bool parse_root(JsonParser *p, JsonVal *res, const char **text,
+                       unsigned threads) {
+#ifdef JSON_THREADS
+  // Interning needs one table for the whole document
+  if (threads > 1 && **text == '[' && p->intern == NULL &&
+      (p->alloc == NULL || p->alloc->thread_safe))
+    return parse_arr_parallel(p, res, text, threads);
+#else
+  (void)threads;
+#endif
+  return _json_parse_val(p, res, text);
+}
+
+bool json_parse_val(JsonVal *res, const char **text) {
+  JsonParser p = {.stats = STATS_CURRENT()};
+  uint64_t start = stats_start(p.stats);
+  bool ok = _json_parse_val(&p, res, text);
+  free(p.scratch);
+  STATS_STOP(p.stats, parse_ns, start);
+  return ok;
+}
+
+bool json_parse_val_opts(JsonVal *res, const char **text,
+                         const JsonParseOptions *opts) {
+  if (opts == NULL)
+    return json_parse_val(res, text);
+  JsonParser p = {.flags = opts->flags,
+                  .stats = STATS_CURRENT(),
+                  .max_depth = opts->max_depth,
+                  .alloc = opts->alloc};
+  uint64_t start = stats_start(p.stats);
+  bool ok = parse_root(&p, res, text, opts->threads);
+  scratch_free(&p);
+  STATS_STOP(p.stats, parse_ns, start);
+  return ok;
+}
+
+void json_doc_init(JsonDocument *doc) {
+  doc->root.type = JSON_TYPE_NUL;
+  doc->opts.flags = 0;
+  doc->opts.threads = 0;
+  doc->opts.alloc = NULL;
+  doc->opts.max_depth = 0;
+  doc->arena.head = NULL;
+  doc->arena.next_block_size = ARENA_MIN_BLOCK_SIZE;
+  doc->arena.alloc = NULL;
+  doc->source = NULL;
+  doc->source_len = 0;
+  doc->source_mapped = false;
+  doc->intern = NULL;
+}
+
+// Created on first use if the options ask for interning
+static JsonInternTable *doc_intern_table(JsonDocument *doc) {
+  if (!(doc->opts.flags & (JSON_PARSE_INTERN_KEYS | JSON_PARSE_INTERN_STRINGS)))
+    return NULL;
+  if (doc->intern == NULL)
+    doc->intern = intern_new();
+  return doc->intern;
+}
+
+// The allocator of the blocks is fixed once the first one is allocated
+static JsonArena *doc_arena(JsonDocument *doc) {
+  if (doc->arena.head == NULL)
+    doc->arena.alloc = doc->opts.alloc;
+  return &doc->arena;
+}
+
+bool json_doc_parse(JsonDocument *doc, const char **text) {
+  JsonParser p = {.arena = doc_arena(doc),
+                  .owner = &doc->arena,
+                  .flags = doc->opts.flags,
+                  .intern = doc_intern_table(doc),
+                  .stats = STATS_CURRENT(),
+                  .max_depth = doc->opts.max_depth,
+                  .alloc = doc->arena.alloc};
+  uint64_t start = stats_start(p.stats);
+  bool ok = parse_root(&p, &doc->root, text, doc->opts.threads);
+  scratch_free(&p);
+  STATS_STOP(p.stats, parse_ns, start);
+  return ok;
+}
+
+#ifdef JSON_MMAP
+// The file is mapped over the start of a zeroed anonymous mapping that is at
+// least one byte longer. Past the end of the file the last page is zero
+// filled, and if the file ends exactly at a page boundary the next page of
+// the reservation is, so the text is always NUL-terminated without a copy.
+// A writable mapping is private: changes never reach the file.
+static bool doc_load_file(JsonDocument *doc, const char *path, bool writable) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  size_t size = (size_t)st.st_size;
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t map_len = (size + 1 + page - 1) / page * page;
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  char *map = mmap(NULL, map_len, prot, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  int flags = MAP_PRIVATE | MAP_FIXED;
+#ifdef MAP_POPULATE
+  // Pages that are going to be written are copied in one go instead of one
+  // fault at a time
+  if (writable)
+    flags |= MAP_POPULATE;
+#endif
+  if (size > 0 && mmap(map, size, prot, flags, fd, 0) == MAP_FAILED) {
+    int err = errno;
+    munmap(map, map_len);
+    close(fd);
+    errno = err;
+    return false;
+  }
+  close(fd);
+  if (size > 0)
+    madvise(map, size, MADV_SEQUENTIAL);
+  doc->source = map;
+  doc->source_len = size;
+  doc->map_len = map_len;
+  doc->source_mapped = true;
+  return true;
+}
+#else
+static bool doc_load_file(JsonDocument *doc, const char *path, bool writable) {
+  (void)writable;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    return false;
+  size_t cap = 64 * 1024, len = 0;
+  char *buf = malloc(cap);
+  for (;;) {
+    len += fread(buf + len, 1, cap - len, f);
+    if (len < cap)
+      break;
+    cap *= 2;
+    buf = realloc(buf, cap);
+  }
+  bool ok = !ferror(f);
+  fclose(f);
+  if (!ok) {
+    free(buf);
+    return false;
+  }
+  buf[len] = '\0';
+  doc->source = buf;
+  doc->source_len = len;
+  return true;
+}
+#endif
+
+bool json_doc_load_file(JsonDocument *doc, const char *path) {
+  return doc_load_file(doc, path, false);
+}
+
+bool json_doc_parse_file(JsonDocument *doc, const char *path,
+                         const char **end) {
+  *end = NULL;
+  if (!doc_load_file(doc, path, false))
+    return false;
+  *end = doc->source;
+  return json_doc_parse(doc, end);
+}
+
+// JSON Pointer (RFC 6901) lookups. In a reference token "~1" stands for '/'
+// and "~0" for '~', array elements are addressed by decimal index.
+
+static bool pointer_valid(const char *pointer) {
+  if (*pointer != '\0' && *pointer != '/')
+    return false;
+  for (; *pointer != '\0'; pointer++)
+    if (*pointer == '~' && pointer[1] != '0' && pointer[1] != '1')
+      return false;
+  return true;
+}
+
+// Compares an unescaped key with an escaped reference token
+static bool pointer_token_eq(const char *key, size_t key_len, const char *tok,
+                             size_t tok_len) {
+  size_t i = 0;
+  for (size_t j = 0; j < tok_len; j++) {
+    char c = tok[j];
+    if (c == '~')
+      c = tok[++j] == '0' ? '~' : '/';
+    if (i == key_len || key[i++] != c)
+      return false;
+  }
+  return i == key_len;
+}
+
+static bool pointer_token_index(const char *tok, size_t len, size_t *idx) {
+  if (len == 0 || (len > 1 && tok[0] == '0'))
+    return false;
+  *idx = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (!is_digit(tok[i]) || *idx > (SIZE_MAX - 9) / 10)
+      return false;
+    *idx = *idx * 10 + (size_t)(tok[i] - '0');
+  }
+  return true;
+}
+
+static JsonVal *pointer_obj_get(JsonObj *obj, const char *tok, size_t len) {
+  if (memchr(tok, '~', len) == NULL)
+    return json_value_by_key_len(obj, tok, len);
+  char local[INTERNAL_TOKEN_SIZE];
+  char *key = len <= sizeof(local) ? local : malloc(len);
+  size_t key_len = 0;
+  for (size_t i = 0; i < len; i++) {
+    char c = tok[i];
+    if (c == '~')
+      c = tok[++i] == '0' ? '~' : '/';
+    key[key_len++] = c;
+  }
+  JsonVal *res = json_value_by_key_len(obj, key, key_len);
+  if (key != local)
+    free(key);
+  return res;
+}
+
+JsonVal json_arr_get(const JsonArr *arr, size_t i) {
+  JsonVal res;
+  switch (arr->kind) {
+  case JSON_ARR_INTS:
+    res.type = JSON_TYPE_INT;
+    res.as.integer = arr->ints[i];
+    return res;
+  case JSON_ARR_FRCS:
+    res.type = JSON_TYPE_FRC;
+    res.as.fract = arr->fracts[i];
+    return res;
+  case JSON_ARR_VALUES:
+    break;
+  }
+  return arr->values[i];
+}
+
+// Follows the pointer down to its value, or to a packed array with the rest
+// of the pointer (an index into it, or more) left in *pointer
+static JsonVal *pointer_walk(JsonVal *val, const char **pointer) {
+  while (val != NULL && **pointer == '/') {
+    if (val->type == JSON_TYPE_ARR && val->as.arr_ptr->kind != JSON_ARR_VALUES)
+      break;
+    const char *tok = *pointer + 1;
+    size_t len = strcspn(tok, "/");
+    *pointer = tok + len;
+    size_t idx;
+    if (val->type == JSON_TYPE_OBJ)
+      val = pointer_obj_get(val->as.obj_ptr, tok, len);
+    else if (val->type == JSON_TYPE_ARR && pointer_token_index(tok, len, &idx) &&
+             idx < val->as.arr_ptr->len)
+      val = &val->as.arr_ptr->values[idx];
+    else
+      val = NULL;
+  }
+  return val;
+}
+
+// The rest of a pointer that stopped at a packed array. Its elements are
+// numbers, so the index has to be the last token.
+static bool pointer_packed_index(const JsonArr *arr, const char *pointer,
+                                 size_t *idx) {
+  const char *tok = pointer + 1;
+  size_t len = strcspn(tok, "/");
+  return tok[len] == '\0' && pointer_token_index(tok, len, idx) &&
+         *idx < arr->len;
+}
+
+JsonPointerStatus json_pointer_find(JsonVal *root, const char *pointer,
+                                    JsonVal **res) {
+  if (!pointer_valid(pointer))
+    return JSON_POINTER_NOT_FOUND;
+  JsonVal *val = pointer_walk(root, &pointer);
+  size_t idx;
+  if (val == NULL)
+    return JSON_POINTER_NOT_FOUND;
+  if (*pointer == '\0') {
+    *res = val;
+    return JSON_POINTER_FOUND;
+  }
+  if (!pointer_packed_index(val->as.arr_ptr, pointer, &idx))
+    return JSON_POINTER_NOT_FOUND;
+  *res = val;
+  return JSON_POINTER_PACKED;
+}
+
+JsonVal *json_pointer_get(JsonVal *root, const char *pointer) {
+  JsonVal *val;
+  return json_pointer_find(root, pointer, &val) == JSON_POINTER_FOUND ? val
+                                                                      : NULL;
+}
+
+bool json_pointer_get_val(JsonVal *root, const char *pointer, JsonVal *res) {
+  if (!pointer_valid(pointer))
+    return false;
+  JsonVal *val = pointer_walk(root, &pointer);
+  size_t idx;
+  if (val == NULL)
+    return false;
+  if (*pointer == '\0') {
+    *res = *val;
+    return true;
+  }
+  if (!pointer_packed_index(val->as.arr_ptr, pointer, &idx))
+    return false;
+  *res = json_arr_get(val->as.arr_ptr, idx);
+  return true;
+}
+
+// Skipping of unvisited values for the lazy lookup. Only the brackets are
+// balanced and strings followed, the skipped text is not validated.
+
+static bool skip_container(const char **text) {
+  StructScanner sc;
+  struct_scan_init(&sc, *text);
+  size_t depth = 0;
+  for (;;) {
+    StructMasks m;
+    const char *block = struct_scan_next(&sc, &m);
+    unsigned closes = popcount64(m.close);
+    if (closes < depth) {
+      // The container cannot end in this block
+      depth = depth + popcount64(m.open) - closes;
+    } else {
+      for (uint64_t brackets = m.open | m.close; brackets != 0;
+           brackets &= brackets - 1) {
+        unsigned i = ctz64(brackets);
+        if (m.open >> i & 1)
+          depth++;
+        else if (--depth == 0) {
+          *text = block + i + 1;
+          return true;
+        }
+      }
+    }
+    if (m.nul) {
+      *text = block + ctz64(m.nul);
+      return false;
+    }
+  }
+}
+
+static bool json_skip_value(const char **text) {
+  if (**text == '"') {
+    const char *start;
+    size_t len;
+    bool escaped;
+    if (!json_scan_str(text, &start, &len, &escaped))
+      return false;
+    (*text)++;
+    return true;
+  }
+  if (**text == '[' || **text == '{')
+    return skip_container(text);
+  // Number or literal
+  const char *start = *text;
+  while (**text != ',' && **text != ']' && **text != '}' && **text != '\0' &&
+         !is_json_whitespace(**text))
+    (*text)++;
+  return *text != start;
+}
+
+static bool lazy_key_matches(const char *key, size_t key_len, bool escaped,
+                             const char *tok, size_t tok_len) {
+  if (!escaped)
+    return pointer_token_eq(key, key_len, tok, tok_len);
+  char *decoded = malloc(key_len);
+  bool res = json_decode_str_into(decoded, &key_len, key, key_len) &&
+             pointer_token_eq(decoded, key_len, tok, tok_len);
+  free(decoded);
+  return res;
+}
+
+// Moves text to the value at pointer, NULL if there is none
+static const char *lazy_find(const char *text, const char *pointer) {
+  json_skip_whitespace(&text);
+  while (*pointer == '/') {
+    const char *tok = pointer + 1;
+    size_t len = strcspn(tok, "/");
+    pointer = tok + len;
+    if (*text == '{') {
+      text++;
+      json_skip_whitespace(&text);
+      if (*text == '}')
+        return NULL;
+      for (;;) {
+        const char *key;
+        size_t key_len;
+        bool escaped;
+        if (!json_scan_str(&text, &key, &key_len, &escaped))
+          return NULL;
+        bool found = lazy_key_matches(key, key_len, escaped, tok, len);
+        text++;
+        json_skip_whitespace(&text);
+        if (*text != ':')
+          return NULL;
+        text++;
+        json_skip_whitespace(&text);
+        if (found)
+          break;
+        if (!json_skip_value(&text))
+          return NULL;
+        json_skip_whitespace(&text);
+        if (*text != ',')
+          return NULL;
+        text++;
+        json_skip_whitespace(&text);
+      }
+    } else if (*text == '[') {
+      size_t idx;
+      if (!pointer_token_index(tok, len, &idx))
+        return NULL;
+      text++;
+      json_skip_whitespace(&text);
+      for (; idx > 0; idx--) {
+        if (!json_skip_value(&text))
+          return NULL;
+        json_skip_whitespace(&text);
+        if (*text != ',')
+          return NULL;
+        text++;
+        json_skip_whitespace(&text);
+      }
+      if (*text == ']')
+        return NULL;
+    } else
+      return NULL;
+  }
+  return text;
+}
+
+JsonVal *json_doc_parse_pointer(JsonDocument *doc, const char *text,
+                                const char *pointer) {
+  if (!pointer_valid(pointer))
+    return NULL;
+  text = lazy_find(text, pointer);
+  if (text == NULL)
+    return NULL;
+  JsonParser p = {.arena = doc_arena(doc),
+                  .owner = &doc->arena,
+                  .flags = doc->opts.flags,
+                  .intern = doc_intern_table(doc),
+                  .max_depth = doc->opts.max_depth,
+                  .alloc = doc->arena.alloc};
+  JsonVal *res = arena_alloc(&doc->arena, sizeof(JsonVal), ARENA_NODE_ALIGN);
+  bool ok = _json_parse_val(&p, res, &text);
+  scratch_free(&p);
+  return ok ? res : NULL;
+}
+
+// Newline-delimited JSON. The buffer is cut into fixed-size chunks, each
+// holding the records whose line starts in it, and the threads claim chunks
+// until none is left. A record may not continue on the next line: a value
+// that does is rejected at the line end, like an incomplete one.
+
+typedef struct {
+  JsonNdjsonRecord *records;
+  size_t len;
+  size_t cap;
+} NdjsonChunk;
+
+typedef struct {
+  const char *text;
+  size_t len;
+  unsigned flags;
+  unsigned max_depth;
+  const JsonAllocator *alloc;
+  size_t chunk_count;
+  NdjsonChunk *chunks; // Collected records, unless passed to cb
+  JsonNdjsonCallback cb;
+  void *ctx;
+#ifdef JSON_THREADS
+  atomic_size_t next;
+  atomic_bool failed;
+  atomic_bool stop;
+#else
+  size_t next;
+  bool failed;
+  bool stop;
+#endif
+} NdjsonJob;
+
+static inline bool is_line_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool ndjson_parse_line(JsonParser *p, const char *text, const char *eol,
+                              JsonNdjsonRecord *rec) {
+  const char *start = text;
+  p->line_end = eol;
+  bool ok = _json_parse_val(p, &rec->val, &text);
+  while (ok && text < eol && is_line_blank(*text))
+    text++;
+  ok = ok && text == eol;
+  rec->ok = ok;
+  rec->err_offset = ok ? 0 : (size_t)(text - start) + rec->offset;
+  return ok;
+}
+
+static void ndjson_chunk(NdjsonJob *job, JsonParser *p, size_t idx) {
+  const char *text = job->text, *end = text + job->len;
+  const char *line = text + idx * NDJSON_CHUNK_SIZE;
+  const char *limit = idx + 1 == job->chunk_count
+                          ? end
+                          : text + (idx + 1) * NDJSON_CHUNK_SIZE;
+  // The line that started in the previous chunk belongs to it
+  if (line != text) {
+    line = memchr(line - 1, '\n', end - line + 1);
+    line = line != NULL ? line + 1 : end;
+  }
+  // Checked per record, so that a callback stopping the parse is not kept
+  // waiting for the other threads to finish their chunks
+  while (line < limit && !job->stop) {
+    const char *eol = memchr(line, '\n', end - line);
+    if (eol == NULL)
+      eol = end;
+    const char *start = line;
+    while (start < eol && is_line_blank(*start))
+      start++;
+    if (start < eol) {
+      JsonNdjsonRecord rec = {.offset = (size_t)(start - text)};
+      if (!ndjson_parse_line(p, start, eol, &rec))
+        job->failed = true;
+      if (job->cb != NULL) {
+        if (!job->cb(job->ctx, &rec)) {
+          job->stop = true;
+          return;
+        }
+      } else {
+        NdjsonChunk *chunk = &job->chunks[idx];
+        if (chunk->len == chunk->cap) {
+          chunk->cap = chunk->cap == 0 ? 64 : chunk->cap * 2;
+          chunk->records =
+              realloc(chunk->records, chunk->cap * sizeof(JsonNdjsonRecord));
+        }
+        chunk->records[chunk->len++] = rec;
+      }
+    }
+    line = eol + 1;
+  }
+}
+
+static void *ndjson_worker(void *arg) {
+  NdjsonJob *job = arg;
+  JsonParser p = {
+      .flags = job->flags, .max_depth = job->max_depth, .alloc = job->alloc};
+  for (;;) {
+#ifdef JSON_THREADS
+    size_t idx = atomic_fetch_add(&job->next, 1);
+#else
+    size_t idx = job->next++;
+#endif
+    if (idx >= job->chunk_count || job->stop)
+      break;
+    ndjson_chunk(job, &p, idx);
+  }
+  scratch_free(&p);
+  return NULL;
+}
+
+static bool ndjson_run(NdjsonJob *job, const JsonParseOptions *opts) {
+  job->flags = opts != NULL ? opts->flags : 0;
+  job->max_depth = opts != NULL ? opts->max_depth : 0;
+  job->alloc = opts != NULL ? opts->alloc : NULL;
+  job->chunk_count = (job->len + NDJSON_CHUNK_SIZE - 1) / NDJSON_CHUNK_SIZE;
+  job->next = 0;
+  job->failed = false;
+  job->stop = false;
+#ifdef JSON_THREADS
+  unsigned threads =
+      opts != NULL && (opts->alloc == NULL || opts->alloc->thread_safe)
+          ? opts->threads
+          : 0;
+  if (threads > job->chunk_count)
+    threads = (unsigned)job->chunk_count;
+  pthread_t *tids = malloc((threads > 1 ? threads : 1) * sizeof(pthread_t));
+  unsigned started = 0;
+  for (unsigned i = 1; i < threads; i++)
+    if (pthread_create(&tids[started], NULL, ndjson_worker, job) == 0)
+      started++;
+  ndjson_worker(job);
+  for (unsigned i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+  free(tids);
+#else
+  ndjson_worker(job);
+#endif
+  return !job->failed && !job->stop;
+}
+
+bool json_parse_ndjson(const char *text, size_t len,
+                       const JsonParseOptions *opts,
+                       JsonNdjsonRecord **records, size_t *count) {
+  NdjsonJob job = {.text = text, .len = len};
+  job.chunks = calloc(len / NDJSON_CHUNK_SIZE + 1, sizeof(NdjsonChunk));
+  bool ok = ndjson_run(&job, opts);
+
+  *count = 0;
+  for (size_t i = 0; i < job.chunk_count; i++)
+    *count += job.chunks[i].len;
+  *records = malloc(*count * sizeof(JsonNdjsonRecord) + 1);
+  JsonNdjsonRecord *dst = *records;
+  for (size_t i = 0; i < job.chunk_count; i++) {
+    if (job.chunks[i].len > 0)
+      memcpy(dst, job.chunks[i].records,
+             job.chunks[i].len * sizeof(JsonNdjsonRecord));
+    dst += job.chunks[i].len;
+    free(job.chunks[i].records);
+  }
+  free(job.chunks);
+  return ok;
+}
+
+bool json_parse_ndjson_cb(const char *text, size_t len,
+                          const JsonParseOptions *opts, JsonNdjsonCallback cb,
+                          void *ctx) {
+  NdjsonJob job = {.text = text, .len = len, .cb = cb, .ctx = ctx};
+  return ndjson_run(&job, opts);
+}
+
+void json_free_ndjson(JsonNdjsonRecord *records, size_t count) {
+  json_free_ndjson_alloc(records, count, NULL);
+}
+
+void json_free_ndjson_alloc(JsonNdjsonRecord *records, size_t count,
+                            const JsonAllocator *alloc) {
+  for (size_t i = 0; i < count; i++)
+    json_free_val_alloc(&records[i].val, alloc);
+  free(records);
+}
+
+// Event-driven parsing over the same tokenizer as the tree parser. Nothing
+// is allocated per value: unescaped strings are passed as slices of the input
+// and escaped ones are decoded into one reused buffer.
+
+#define NEST_LOCAL_DEPTH 128
+
+// Kinds of the open containers for the iterative walkers, on the C stack
+// unless the nesting is deep
+typedef struct {
+  bool *is_obj;
+  size_t depth;
+  size_t cap;
+  bool local[NEST_LOCAL_DEPTH];
+} NestStack;
+
+static void nest_init(NestStack *nest) {
+  nest->is_obj = nest->local;
+  nest->depth = 0;
+  nest->cap = NEST_LOCAL_DEPTH;
+}
+
+static bool nest_push(NestStack *nest, bool is_obj) {
+  if (nest->depth == nest->cap) {
+    bool *grown = nest->is_obj == nest->local
+                      ? malloc(nest->cap * 2 * sizeof(bool))
+                      : realloc(nest->is_obj, nest->cap * 2 * sizeof(bool));
+    if (grown == NULL)
+      return false;
+    if (nest->is_obj == nest->local)
+      memcpy(grown, nest->local, sizeof(nest->local));
+    nest->is_obj = grown;
+    nest->cap *= 2;
+  }
+  nest->is_obj[nest->depth++] = is_obj;
+  return true;
+}
+
+static void nest_free(NestStack *nest) {
+  if (nest->is_obj != nest->local)
+    free(nest->is_obj);
+}
+
+typedef enum {
+  SAX_VALUE,
+  SAX_KEY,
+  SAX_AFTER_VALUE,
+} SaxState;
+
+typedef struct {
+  const JsonSaxHandler *h;
+  void *ctx;
+  NestStack nest;
+  size_t max_depth; // Open containers allowed, unlike JsonParser never 0
+  char *decoded;
+  size_t decoded_cap;
+} SaxParser;
+
+// Scans a string like json_scan_str, decoding it into the reused buffer if
+// it has escape-sequences
+static bool sax_scan_str(SaxParser *sp, const char **text, const char **start,
+                         size_t *len) {
+  bool escaped;
+  if (!json_scan_str(text, start, len, &escaped))
+    return false;
+  if (escaped) {
+    if (*len > sp->decoded_cap) {
+      free(sp->decoded);
+      sp->decoded = malloc(*len);
+      sp->decoded_cap = *len;
+    }
+    if (!json_decode_str_into(sp->decoded, len, *start, *len))
+      return false;
+    *start = sp->decoded;
+  }
+  return true;
+}
+
+// Reads a string and hands it to cb (key or string callback)
+static bool sax_str(SaxParser *sp, const char **text,
+                    bool (*cb)(void *, const char *, size_t)) {
+  const char *start;
+  size_t len;
+  if (!sax_scan_str(sp, text, &start, &len))
+    return false;
+  if (cb != NULL && !cb(sp->ctx, start, len))
+    return false;
+  (*text)++;
+  return true;
+}
+
+static bool sax_value(SaxParser *sp, const char **text, SaxState *state) {
+  const JsonSaxHandler *h = sp->h;
+  *state = SAX_AFTER_VALUE;
+  if (**text == '{' || **text == '[') {
+    // Past the limit *text stays at the bracket, as in the tree parser
+    if (sp->nest.depth == sp->max_depth)
+      return false;
+    bool is_obj = **text == '{';
+    if (is_obj ? h->start_object != NULL && !h->start_object(sp->ctx)
+               : h->start_array != NULL && !h->start_array(sp->ctx))
+      return false;
+    (*text)++;
+    json_skip_whitespace(text);
+    if (**text == (is_obj ? '}' : ']')) {
+      (*text)++;
+      return is_obj ? h->end_object == NULL || h->end_object(sp->ctx)
+                    : h->end_array == NULL || h->end_array(sp->ctx);
+    }
+    *state = is_obj ? SAX_KEY : SAX_VALUE;
+    return nest_push(&sp->nest, is_obj);
+  }
+  if (**text == '"')
+    return sax_str(sp, text, h->string);
+  if (is_digit(**text) || (**text == '-' && is_digit(*(*text + 1)))) {
+    JsonVal val;
+    if (!json_parse_num(&val, text))
+      return false;
+    if (val.type == JSON_TYPE_INT)
+      return h->integer == NULL || h->integer(sp->ctx, val.as.integer);
+    return h->fract == NULL || h->fract(sp->ctx, val.as.fract);
+  }
+  if (0 == strncmp(*text, TRUE_STR, sizeof(TRUE_STR) - 1)) {
+    (*text) += sizeof(TRUE_STR) - 1;
+    return h->boolean == NULL || h->boolean(sp->ctx, true);
+  }
+  if (0 == strncmp(*text, FALSE_STR, sizeof(FALSE_STR) - 1)) {
+    (*text) += sizeof(FALSE_STR) - 1;
+    return h->boolean == NULL || h->boolean(sp->ctx, false);
+  }
+  if (0 == strncmp(*text, NULL_STR, sizeof(NULL_STR) - 1)) {
+    (*text) += sizeof(NULL_STR) - 1;
+    return h->null == NULL || h->null(sp->ctx);
+  }
+  return false;
+}
+
+static bool sax_parse(SaxParser *sp, const char **text) {
+  SaxState state = SAX_VALUE;
+  for (;;) {
+    switch (state) {
+    case SAX_VALUE:
+      if (!sax_value(sp, text, &state))
+        return false;
+      break;
+    case SAX_KEY:
+      if (!sax_str(sp, text, sp->h->key))
+        return false;
+      json_skip_whitespace(text);
+      if (**text != ':')
+        return false;
+      (*text)++;
+      json_skip_whitespace(text);
+      state = SAX_VALUE;
+      break;
+    case SAX_AFTER_VALUE: {
+      if (sp->nest.depth == 0)
+        return true;
+      json_skip_whitespace(text);
+      bool is_obj = sp->nest.is_obj[sp->nest.depth - 1];
+      if (**text == ',') {
+        (*text)++;
+        json_skip_whitespace(text);
+        state = is_obj ? SAX_KEY : SAX_VALUE;
+      } else if (**text == (is_obj ? '}' : ']')) {
+        (*text)++;
+        sp->nest.depth--;
+        if (is_obj ? sp->h->end_object != NULL && !sp->h->end_object(sp->ctx)
+                   : sp->h->end_array != NULL && !sp->h->end_array(sp->ctx))
+          return false;
+      } else
+        return false;
+      break;
+    }
+    }
+  }
+}
+
+bool json_sax_parse(const char **text, const JsonSaxHandler *handler,
+                    void *ctx) {
+  return json_sax_parse_opts(text, handler, ctx, NULL);
+}
+
+bool json_sax_parse_opts(const char **text, const JsonSaxHandler *handler,
+                         void *ctx, const JsonParseOptions *opts) {
+  SaxParser sp = {.h = handler,
+                  .ctx = ctx,
+                  .max_depth = opts != NULL && opts->max_depth != 0
+                                   ? opts->max_depth
+                                   : JSON_DEFAULT_MAX_DEPTH};
+  nest_init(&sp.nest);
+  bool ok = sax_parse(&sp, text);
+  nest_free(&sp.nest);
+  free(sp.decoded);
+  return ok;
+}
+
+// Binding into structs: the recursive descent of the tree parser, writing
+// members in place of nodes. Unknown values go through the SAX walker with
+// no callbacks, which validates them without allocating anything. A schema
+// may contain itself, so the descent is limited like in the tree parser.
+
+#define BIND_LOCAL_ELEM_SIZE 256
+
+typedef struct {
+  JsonParser p; // Only its arena, scratch stack and depth are used
+  SaxParser skip;
+} Binder;
+
+static const JsonSaxHandler bind_skip_handler = {0};
+
+static size_t bound_size(JsonType type, const JsonSchema *schema) {
+  switch (type) {
+  case JSON_TYPE_OBJ:
+    return schema->size;
+  case JSON_TYPE_ARR:
+    return sizeof(JsonBoundArr);
+  case JSON_TYPE_STR:
+    return sizeof(JsonStr);
+  case JSON_TYPE_INT:
+    return sizeof(long long);
+  case JSON_TYPE_FRC:
+    return sizeof(double);
+  case JSON_TYPE_BOL:
+    return sizeof(bool);
+  default:
+    return 0;
+  }
+}
+
+static void unbind(JsonType type, JsonType elem_type, const JsonSchema *schema,
+                   void *dst) {
+  if (type == JSON_TYPE_STR) {
+    JsonStr *str = dst;
+    if (str->needs_dealloc)
+      free((char *)str->start);
+  } else if (type == JSON_TYPE_OBJ) {
+    json_bind_free(schema, dst);
+  } else if (type == JSON_TYPE_ARR) {
+    JsonBoundArr *arr = dst;
+    size_t size = bound_size(elem_type, schema);
+    for (size_t i = 0; i < arr->len; i++)
+      unbind(elem_type, JSON_TYPE_NUL, schema, (char *)arr->items + i * size);
+    free(arr->items);
+  }
+}
+
+void json_bind_free(const JsonSchema *schema, void *out) {
+  for (size_t i = 0; i < schema->len; i++) {
+    const JsonField *f = &schema->fields[i];
+    unbind(f->type, f->elem_type, f->schema, (char *)out + f->offset);
+  }
+}
+
+// Members usually come in the order they are declared in, so the search
+// starts after the previous match
+static const JsonField *find_field(const JsonSchema *schema, const char *key,
+                                   size_t len, size_t *next) {
+  for (size_t n = 0; n < schema->len; n++) {
+    size_t i = *next + n < schema->len ? *next + n : *next + n - schema->len;
+    const JsonField *f = &schema->fields[i];
+    if (f->name_len == len && 0 == memcmp(f->name, key, len)) {
+      *next = i + 1;
+      return f;
+    }
+  }
+  return NULL;
+}
+
+static bool bind_value(Binder *b, JsonType type, JsonType elem_type,
+                       const JsonSchema *schema, void *dst, const char **text);
+
+static bool bind_obj(Binder *b, const JsonSchema *schema, void *out,
+                     const char **text) {
+  if (**text != '{')
+    return false;
+
+  (*text)++;
+  json_skip_whitespace(text);
+  if (**text == '}') {
+    (*text)++;
+    return true;
+  }
+  size_t next = 0;
+  for (;;) {
+    const char *key;
+    size_t key_len;
+    if (!sax_scan_str(&b->skip, text, &key, &key_len))
+      return false;
+    (*text)++;
+    json_skip_whitespace(text);
+    if (**text != ':')
+      return false;
+    (*text)++;
+    json_skip_whitespace(text);
+
+    const JsonField *f = find_field(schema, key, key_len, &next);
+    if (f == NULL) {
+      // The skipped value shares the limit with the bound levels around it
+      b->skip.max_depth = parser_max_depth(&b->p) - b->p.depth;
+      if (!sax_parse(&b->skip, text))
+        return false;
+    } else {
+      void *dst = (char *)out + f->offset;
+      // Repeated key: the last value wins
+      if (b->p.arena == NULL)
+        unbind(f->type, f->elem_type, f->schema, dst);
+      memset(dst, 0, bound_size(f->type, f->schema));
+      if (!bind_value(b, f->type, f->elem_type, f->schema, dst, text))
+        return false;
+    }
+
+    json_skip_whitespace(text);
+    if (**text == ',') {
+      (*text)++;
+      json_skip_whitespace(text);
+    } else
+      break;
+  }
+  if (**text != '}')
+    return false;
+
+  (*text)++;
+  return true;
+}
+
+static bool bind_arr(Binder *b, JsonType elem_type, const JsonSchema *schema,
+                     JsonBoundArr *arr, const char **text) {
+  size_t size = bound_size(elem_type, schema);
+  if (**text != '[' || elem_type == JSON_TYPE_ARR || size == 0)
+    return false;
+
+  (*text)++;
+  json_skip_whitespace(text);
+  size_t base = b->p.scratch_len;
+  bool ok = true;
+  if (**text != ']') {
+    _Alignas(max_align_t) char local[BIND_LOCAL_ELEM_SIZE];
+    void *elem = size <= sizeof(local) ? local : malloc(size);
+    for (;;) {
+      memset(elem, 0, size);
+      ok = bind_value(b, elem_type, JSON_TYPE_NUL, schema, elem, text);
+      // Pushed even on failure, so the partial element gets freed too
+      scratch_push(&b->p, elem, size);
+      if (!ok)
+        break;
+
+      json_skip_whitespace(text);
+      if (**text == ',') {
+        (*text)++;
+        json_skip_whitespace(text);
+      } else
+        break;
+    }
+    if (elem != local)
+      free(elem);
+  }
+  arr->items = scratch_pop(&b->p, base, size, &arr->len);
+  if (!ok)
+    return false;
+
+  if (**text != ']')
+    return false;
+
+  (*text)++;
+  return true;
+}
+
+// An integer literal beyond long long, which json_parse_num rejects, still
+// fits a double member
+static bool bind_long_int(double *dst, const char **text) {
+  const char *ptr = *text + (**text == '-');
+  if (*ptr == '0')
+    return false;
+  while (is_digit(*ptr))
+    ptr++;
+  if (*ptr == '.' || *ptr == 'e' || *ptr == 'E')
+    return false;
+  errno = 0;
+  *dst = strtod(*text, NULL);
+  if (errno == ERANGE || !isfinite(*dst))
+    return false;
+  *text = ptr;
+  return true;
+}
+
+// On a type mismatch *text stays at the value
+static bool bind_value(Binder *b, JsonType type, JsonType elem_type,
+                       const JsonSchema *schema, void *dst,
+                       const char **text) {
+  if (0 == strncmp(*text, NULL_STR, sizeof(NULL_STR) - 1)) {
+    (*text) += sizeof(NULL_STR) - 1;
+    return true;
+  }
+  switch (type) {
+  case JSON_TYPE_OBJ:
+  case JSON_TYPE_ARR: {
+    if (b->p.depth == parser_max_depth(&b->p))
+      return false;
+    b->p.depth++;
+    bool ok = type == JSON_TYPE_OBJ
+                  ? bind_obj(b, schema, dst, text)
+                  : bind_arr(b, elem_type, schema, dst, text);
+    b->p.depth--;
+    return ok;
+  }
+  case JSON_TYPE_STR:
+    return **text == '"' && json_parse_str(&b->p, dst, text, false);
+  case JSON_TYPE_INT:
+  case JSON_TYPE_FRC: {
+    if (!is_digit(**text) && !(**text == '-' && is_digit(*(*text + 1))))
+      return false;
+    const char *start = *text;
+    JsonVal val;
+    if (!json_parse_num(&val, text))
+      return type == JSON_TYPE_FRC && bind_long_int(dst, text);
+    if (type == JSON_TYPE_FRC)
+      *(double *)dst =
+          val.type == JSON_TYPE_INT ? (double)val.as.integer : val.as.fract;
+    else if (val.type == JSON_TYPE_INT)
+      *(long long *)dst = val.as.integer;
+    else {
+      *text = start;
+      return false;
+    }
+    return true;
+  }
+  case JSON_TYPE_BOL:
+    if (0 == strncmp(*text, TRUE_STR, sizeof(TRUE_STR) - 1)) {
+      *(bool *)dst = true;
+      (*text) += sizeof(TRUE_STR) - 1;
+      return true;
+    }
+    if (0 == strncmp(*text, FALSE_STR, sizeof(FALSE_STR) - 1)) {
+      (*text) += sizeof(FALSE_STR) - 1;
+      return true;
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+bool json_bind(const char **text, const JsonSchema *schema, void *out,
+               JsonArena *arena) {
+  return json_bind_opts(text, schema, out, arena, NULL);
+}
+
+bool json_bind_opts(const char **text, const JsonSchema *schema, void *out,
+                    JsonArena *arena, const JsonParseOptions *opts) {
+  Binder b = {.p = {.arena = arena,
+                    .owner = arena,
+                    .depth = 1,
+                    .max_depth = opts != NULL ? opts->max_depth : 0},
+              .skip = {.h = &bind_skip_handler}};
+  nest_init(&b.skip.nest);
+  memset(out, 0, schema->size);
+  bool ok = bind_obj(&b, schema, out, text);
+  nest_free(&b.skip.nest);
+  free(b.skip.decoded);
+  free(b.p.scratch);
+  return ok;
+}
+
+// Tape: the whole document in one array of 64-bit words, in text order. Each
+// entry starts with a word holding the tag in the top byte and a payload:
+//   object/array start  index past the matching end entry
+//   end                 number of pairs/values
+//   string              byte length, then the bytes and a NUL in
+//                       ceil((len + 1) / 8) words
+//   int/fract           nothing, the value is in the next word
+//   bool                the value
+// Keys are string entries followed by their value.
+
+#define TAPE_END 7 // After the JsonType tags
+#define TAPE_PAYLOAD_MASK ((UINT64_C(1) << 56) - 1)
+#define TAPE_INITIAL_CAP 256
+
+static inline unsigned tape_tag(uint64_t word) {
+  return (unsigned)(word >> 56);
+}
+
+static inline uint64_t tape_word(unsigned tag, uint64_t payload) {
+  return (uint64_t)tag << 56 | payload;
+}
+
+// The tape is built from the events of the SAX parser
+typedef struct {
+  JsonTape *tape;
+  size_t *open; // Start entries of the open containers
+  size_t depth;
+  size_t cap;
+} TapeBuilder;
+
+static uint64_t *tape_reserve(JsonTape *tape, size_t words) {
+  if (tape->cap - tape->len < words) {
+    do
+      tape->cap = tape->cap == 0 ? TAPE_INITIAL_CAP : tape->cap * 2;
+    while (tape->cap - tape->len < words);
+    tape->words = realloc(tape->words, tape->cap * sizeof(uint64_t));
+  }
+  uint64_t *res = tape->words + tape->len;
+  tape->len += words;
+  return res;
+}
+
+// Start entries count the elements while the container is open
+static inline void tape_count_value(TapeBuilder *b) {
+  if (b->depth > 0) {
+    uint64_t *start = &b->tape->words[b->open[b->depth - 1]];
+    if (tape_tag(*start) == JSON_TYPE_ARR)
+      (*start)++;
+  }
+}
+
+static bool tape_open(TapeBuilder *b, unsigned tag) {
+  tape_count_value(b);
+  if (b->depth == b->cap) {
+    b->cap = b->cap == 0 ? NEST_LOCAL_DEPTH : b->cap * 2;
+    b->open = realloc(b->open, b->cap * sizeof(size_t));
+  }
+  b->open[b->depth++] = b->tape->len;
+  *tape_reserve(b->tape, 1) = tape_word(tag, 0);
+  return true;
+}
+
+static bool tape_close(void *ctx) {
+  TapeBuilder *b = ctx;
+  uint64_t *start = &b->tape->words[b->open[--b->depth]];
+  uint64_t count = *start & TAPE_PAYLOAD_MASK;
+  *tape_reserve(b->tape, 1) = tape_word(TAPE_END, count);
+  // The reserve may have moved the words
+  start = &b->tape->words[b->open[b->depth]];
+  *start = tape_word(tape_tag(*start), b->tape->len);
+  return true;
+}
+
+static bool tape_start_object(void *ctx) {
+  return tape_open(ctx, JSON_TYPE_OBJ);
+}
+
+static bool tape_start_array(void *ctx) {
+  return tape_open(ctx, JSON_TYPE_ARR);
+}
+
+static void tape_add_str(JsonTape *tape, const char *str, size_t len) {
+  size_t words = (len + 8) / 8; // Bytes and the NUL
+  uint64_t *dst = tape_reserve(tape, 1 + words);
+  dst[0] = tape_word(JSON_TYPE_STR, len);
+  dst[words] = 0;
+  memcpy(dst + 1, str, len);
+}
+
+static bool tape_key(void *ctx, const char *str, size_t len) {
+  TapeBuilder *b = ctx;
+  b->tape->words[b->open[b->depth - 1]]++;
+  tape_add_str(b->tape, str, len);
+  return true;
+}
+
+static bool tape_string(void *ctx, const char *str, size_t len) {
+  tape_count_value(ctx);
+  tape_add_str(((TapeBuilder *)ctx)->tape, str, len);
+  return true;
+}
+
+static bool tape_integer(void *ctx, long long value) {
+  tape_count_value(ctx);
+  uint64_t *dst = tape_reserve(((TapeBuilder *)ctx)->tape, 2);
+  dst[0] = tape_word(JSON_TYPE_INT, 0);
+  dst[1] = (uint64_t)value;
+  return true;
+}
+
+static bool tape_fract(void *ctx, double value) {
+  tape_count_value(ctx);
+  uint64_t *dst = tape_reserve(((TapeBuilder *)ctx)->tape, 2);
+  dst[0] = tape_word(JSON_TYPE_FRC, 0);
+  memcpy(&dst[1], &value, sizeof(double));
+  return true;
+}
+
+static bool tape_boolean(void *ctx, bool value) {
+  tape_count_value(ctx);
+  *tape_reserve(((TapeBuilder *)ctx)->tape, 1) =
+      tape_word(JSON_TYPE_BOL, value);
+  return true;
+}
+
+static bool tape_null(void *ctx) {
+  tape_count_value(ctx);
+  *tape_reserve(((TapeBuilder *)ctx)->tape, 1) = tape_word(JSON_TYPE_NUL, 0);
+  return true;
+}
+
+static const JsonSaxHandler TAPE_HANDLER = {
+    .start_object = tape_start_object,
+    .end_object = tape_close,
+    .start_array = tape_start_array,
+    .end_array = tape_close,
+    .key = tape_key,
+    .string = tape_string,
+    .integer = tape_integer,
+    .fract = tape_fract,
+    .boolean = tape_boolean,
+    .null = tape_null,
+};
+
+bool json_tape_parse(JsonTape *tape, const char **text) {
+  return json_tape_parse_opts(tape, text, NULL);
+}
+
+bool json_tape_parse_opts(JsonTape *tape, const char **text,
+                          const JsonParseOptions *opts) {
+  tape->words = NULL;
+  tape->len = 0;
+  tape->cap = 0;
+  TapeBuilder b = {.tape = tape};
+  bool ok = json_sax_parse_opts(text, &TAPE_HANDLER, &b, opts);
+  free(b.open);
+  return ok;
+}
+
+void json_tape_free(JsonTape *tape) {
+  free(tape->words);
+  tape->words = NULL;
+  tape->len = 0;
+  tape->cap = 0;
+}
+
+JsonType json_tape_type(const JsonTape *tape, size_t ref) {
+  return (JsonType)tape_tag(tape->words[ref]);
+}
+
+size_t json_tape_len(const JsonTape *tape, size_t ref) {
+  uint64_t word = tape->words[ref];
+  if (tape_tag(word) == JSON_TYPE_STR)
+    return (size_t)(word & TAPE_PAYLOAD_MASK);
+  return (size_t)(tape->words[(word & TAPE_PAYLOAD_MASK) - 1] &
+                  TAPE_PAYLOAD_MASK);
+}
+
+size_t json_tape_end(const JsonTape *tape, size_t ref) {
+  return (size_t)(tape->words[ref] & TAPE_PAYLOAD_MASK) - 1;
+}
+
+size_t json_tape_next(const JsonTape *tape, size_t ref) {
+  uint64_t word = tape->words[ref];
+  switch (tape_tag(word)) {
+  case JSON_TYPE_OBJ:
+  case JSON_TYPE_ARR:
+    return (size_t)(word & TAPE_PAYLOAD_MASK);
+  case JSON_TYPE_STR:
+    return ref + 1 + (size_t)((word & TAPE_PAYLOAD_MASK) + 8) / 8;
+  case JSON_TYPE_INT:
+  case JSON_TYPE_FRC:
+    return ref + 2;
+  default:
+    return ref + 1;
+  }
+}
+
+const char *json_tape_str(const JsonTape *tape, size_t ref) {
+  return (const char *)&tape->words[ref + 1];
+}
+
+long long json_tape_int(const JsonTape *tape, size_t ref) {
+  return (long long)tape->words[ref + 1];
+}
+
+double json_tape_frc(const JsonTape *tape, size_t ref) {
+  double res;
+  memcpy(&res, &tape->words[ref + 1], sizeof(double));
+  return res;
+}
+
+bool json_tape_bool(const JsonTape *tape, size_t ref) {
+  return (tape->words[ref] & TAPE_PAYLOAD_MASK) != 0;
+}
+
+size_t json_tape_value_by_key_len(const JsonTape *tape, size_t obj,
+                                  const char *key, size_t len) {
+  size_t end = json_tape_end(tape, obj);
+  for (size_t it = obj + 1; it != end;) {
+    size_t val = json_tape_next(tape, it);
+    if ((tape->words[it] & TAPE_PAYLOAD_MASK) == len &&
+        0 == memcmp(json_tape_str(tape, it), key, len))
+      return val;
+    it = json_tape_next(tape, val);
+  }
+  return JSON_TAPE_NONE;
+}
+
+size_t json_tape_value_by_key(const JsonTape *tape, size_t obj,
+                              const char *key) {
+  return json_tape_value_by_key_len(tape, obj, key, strlen(key));
+}
+
+// Incremental parsing. The stream keeps an explicit stack of the containers
+// being built plus the bytes of a token cut by the end of a chunk, and picks
+// up from there on the next chunk. Chunks are transient, so unlike
+// json_parse_val every string is copied out of the input.
+
+#define STREAM_MAX_LITERAL_LEN 5
+
+typedef enum {
+  STREAM_EXPECT_VALUE,
+  STREAM_EXPECT_VALUE_OR_END, // Right after '['
+  STREAM_EXPECT_KEY,
+  STREAM_EXPECT_KEY_OR_END, // Right after '{'
+  STREAM_EXPECT_COLON,
+  STREAM_EXPECT_COMMA_OR_END,
+} StreamExpect;
+
+typedef enum {
+  STREAM_TOK_NONE,
+  STREAM_TOK_STR,
+  STREAM_TOK_NUM,
+  STREAM_TOK_LIT,
+} StreamToken;
+
+typedef struct {
+  bool is_obj;
+  bool has_key;
+  size_t base; // Scratch offset of the container's first element
+  JsonStr key; // Key of the pair whose value is being parsed
+} StreamFrame;
+
+struct JsonStream {
+  JsonParser p;
+  JsonVal *res;
+  JsonStreamStatus status;
+  StreamExpect expect;
+  StreamFrame *frames;
+  size_t depth;
+  size_t frames_cap;
+  StreamToken tok;
+  bool tok_is_key;
+  bool str_esc;     // Chunk ended right after a backslash
+  bool str_has_esc; // String needs decoding
+  char *tok_buf;
+  size_t tok_len;
+  size_t tok_cap;
+  size_t offset;
+};
+
+static JsonStream *stream_new(JsonVal *res, JsonArena *arena, unsigned flags,
+                              unsigned max_depth, const JsonAllocator *alloc) {
+  JsonStream *s = calloc(1, sizeof(JsonStream));
+  if (s == NULL)
+    return NULL;
+  s->p.arena = arena;
+  s->p.flags = flags;
+  s->p.max_depth = max_depth;
+  s->p.alloc = alloc;
+  s->res = res;
+  s->status = JSON_STREAM_NEED_MORE;
+  s->expect = STREAM_EXPECT_VALUE;
+  res->type = JSON_TYPE_NUL;
+  return s;
+}
+
+JsonStream *json_stream_new(JsonVal *res, const JsonParseOptions *opts) {
+  return stream_new(res, NULL, opts != NULL ? opts->flags : 0,
+                    opts != NULL ? opts->max_depth : 0,
+                    opts != NULL ? opts->alloc : NULL);
+}
+
+JsonStream *json_doc_stream_new(JsonDocument *doc) {
+  return stream_new(&doc->root, doc_arena(doc), doc->opts.flags,
+                    doc->opts.max_depth, doc->arena.alloc);
+}
+
+static void tok_append(JsonStream *s, const char *data, size_t len) {
+  if (s->tok_len + len + 1 > s->tok_cap) { // + \0 for numbers
+    size_t new_cap = s->tok_cap ? s->tok_cap * 2 : INTERNAL_TOKEN_SIZE;
+    while (new_cap < s->tok_len + len + 1)
+      new_cap *= 2;
+    s->tok_buf = realloc(s->tok_buf, new_cap);
+    s->tok_cap = new_cap;
+  }
+  memcpy(s->tok_buf + s->tok_len, data, len);
+  s->tok_len += len;
+}
+
+static void stream_add_value(JsonStream *s, const JsonVal *val) {
+  s->expect = STREAM_EXPECT_COMMA_OR_END;
+  if (s->depth == 0) {
+    *s->res = *val;
+    s->status = JSON_STREAM_DONE;
+    return;
+  }
+  StreamFrame *frame = &s->frames[s->depth - 1];
+  if (frame->is_obj) {
+    JsonPair pair = {.key = frame->key, .value = *val};
+    frame->has_key = false;
+    scratch_push(&s->p, &pair, sizeof(JsonPair));
+  } else
+    scratch_push(&s->p, val, sizeof(JsonVal));
+}
+
+static void stream_open(JsonStream *s, bool is_obj) {
+  if (s->depth == s->frames_cap) {
+    s->frames_cap = s->frames_cap ? s->frames_cap * 2 : 16;
+    s->frames = realloc(s->frames, s->frames_cap * sizeof(StreamFrame));
+  }
+  StreamFrame *frame = &s->frames[s->depth++];
+  frame->is_obj = is_obj;
+  frame->has_key = false;
+  frame->base = s->p.scratch_len;
+  s->expect = is_obj ? STREAM_EXPECT_KEY_OR_END : STREAM_EXPECT_VALUE_OR_END;
+}
+
+static void stream_close(JsonStream *s) {
+  StreamFrame *frame = &s->frames[--s->depth];
+  JsonVal val;
+  if (frame->is_obj) {
+    JsonObj *obj = parser_alloc(&s->p, sizeof(JsonObj), ARENA_NODE_ALIGN);
+    obj->pairs = scratch_pop(&s->p, frame->base, sizeof(JsonPair), &obj->len);
+    obj->index = NULL;
+    obj->arena = s->p.arena;
+    obj->alloc = s->p.alloc;
+    if ((s->p.flags & JSON_PARSE_INDEX_KEYS) && obj->len >= OBJ_INDEX_MIN_LEN)
+      json_obj_build_index(obj);
+    val.type = JSON_TYPE_OBJ;
+    val.as.obj_ptr = obj;
+  } else {
+    JsonArr *arr = parser_alloc(&s->p, sizeof(JsonArr), ARENA_NODE_ALIGN);
+    arr->kind = JSON_ARR_VALUES;
+    arr_pop(&s->p, arr, frame->base);
+    val.type = JSON_TYPE_ARR;
+    val.as.arr_ptr = arr;
+  }
+  stream_add_value(s, &val);
+}
+
+// Closes every open container, leaving the partial tree in *res
+static void stream_unwind(JsonStream *s) {
+  while (s->depth > 0) {
+    StreamFrame *frame = &s->frames[s->depth - 1];
+    if (frame->is_obj && frame->has_key) {
+      JsonVal nul = {.type = JSON_TYPE_NUL};
+      stream_add_value(s, &nul);
+    }
+    stream_close(s);
+  }
+}
+
+static void stream_fail(JsonStream *s) {
+  stream_unwind(s);
+  s->status = JSON_STREAM_ERROR;
+  s->tok = STREAM_TOK_NONE;
+  s->tok_len = 0;
+}
+
+static bool stream_finish_str(JsonStream *s, const char *data, size_t len) {
+  JsonStr str;
+  char *copy = parser_alloc(&s->p, len, 1);
+  str.start = copy;
+  str.len = len;
+  str.needs_dealloc = s->p.arena == NULL;
+  str.escaped = false;
+  if (s->str_has_esc) {
+    if (!json_decode_str_into(copy, &str.len, data, len)) {
+      if (str.needs_dealloc)
+        mem_free(s->p.alloc, copy, len);
+      return false;
+    }
+    str.start = parser_fit_str(&s->p, copy, len, str.len);
+  } else if (len != 0)
+    memcpy(copy, data, len);
+  s->tok = STREAM_TOK_NONE;
+  s->tok_len = 0;
+
+  if (s->tok_is_key) {
+    StreamFrame *frame = &s->frames[s->depth - 1];
+    frame->key = str;
+    frame->has_key = true;
+    s->expect = STREAM_EXPECT_COLON;
+  } else {
+    JsonVal val = {.type = JSON_TYPE_STR};
+    val.as.str_ptr = parser_alloc(&s->p, sizeof(JsonStr), ARENA_NODE_ALIGN);
+    *val.as.str_ptr = str;
+    stream_add_value(s, &val);
+  }
+  return true;
+}
+
+// Each scanner consumes as much of its token as [*ptr, end) holds and
+// returns false on malformed input with *ptr at the offending byte.
+// Reaching end leaves the token pending.
+
+static bool stream_scan_str(JsonStream *s, const char **ptr, const char *end) {
+  const char *start = *ptr;
+  const char *cur = *ptr;
+  if (s->str_esc) {
+    if ((unsigned char)*cur < 0x20)
+      goto fail;
+    s->str_esc = false;
+    cur++;
+  }
+  for (;;) {
+    cur = find_str_special(cur, end);
+    if (cur == end) {
+      tok_append(s, start, cur - start);
+      *ptr = cur;
+      return true;
+    }
+    if (*cur == '"')
+      break;
+    if (*cur != '\\')
+      goto fail;
+    s->str_has_esc = true;
+    if (++cur == end) {
+      s->str_esc = true;
+      tok_append(s, start, cur - start);
+      *ptr = cur;
+      return true;
+    }
+    if ((unsigned char)*cur < 0x20)
+      goto fail;
+    cur++;
+  }
+  *ptr = cur + 1;
+  if (s->tok_len == 0) // Whole string within this chunk
+    return stream_finish_str(s, start, cur - start);
+  tok_append(s, start, cur - start);
+  return stream_finish_str(s, s->tok_buf, s->tok_len);
+
+fail:
+  *ptr = cur;
+  return false;
+}
+
+static bool stream_finish_num(JsonStream *s) {
+  s->tok_buf[s->tok_len] = '\0';
+  const char *text = s->tok_buf;
+  JsonVal val;
+  if (!(is_digit(text[0]) || (text[0] == '-' && is_digit(text[1]))) ||
+      !json_parse_num(&val, &text) || text != s->tok_buf + s->tok_len)
+    return false;
+  s->tok = STREAM_TOK_NONE;
+  s->tok_len = 0;
+  stream_add_value(s, &val);
+  return true;
+}
+
+static inline bool is_num_char(char c) {
+  return is_digit(c) || c == '-' || c == '+' || c == '.' || c == 'e' ||
+         c == 'E';
+}
+
+static bool stream_scan_num(JsonStream *s, const char **ptr, const char *end) {
+  const char *cur = *ptr;
+  while (cur < end && is_num_char(*cur))
+    cur++;
+  tok_append(s, *ptr, cur - *ptr);
+  *ptr = cur;
+  if (cur == end)
+    return true;
+  return stream_finish_num(s);
+}
+
+static bool stream_finish_lit(JsonStream *s) {
+  JsonVal val = {.type = JSON_TYPE_NUL};
+  if (s->tok_len == sizeof(TRUE_STR) - 1 &&
+      0 == memcmp(s->tok_buf, TRUE_STR, s->tok_len)) {
+    val.type = JSON_TYPE_BOL;
+    val.as.boolean = true;
+  } else if (s->tok_len == sizeof(FALSE_STR) - 1 &&
+             0 == memcmp(s->tok_buf, FALSE_STR, s->tok_len)) {
+    val.type = JSON_TYPE_BOL;
+    val.as.boolean = false;
+  } else if (s->tok_len != sizeof(NULL_STR) - 1 ||
+             0 != memcmp(s->tok_buf, NULL_STR, s->tok_len))
+    return false;
+  s->tok = STREAM_TOK_NONE;
+  s->tok_len = 0;
+  stream_add_value(s, &val);
+  return true;
+}
+
+static bool stream_scan_lit(JsonStream *s, const char **ptr, const char *end) {
+  const char *cur = *ptr;
+  while (cur < end && *cur >= 'a' && *cur <= 'z')
+    cur++;
+  tok_append(s, *ptr, cur - *ptr);
+  if (s->tok_len > STREAM_MAX_LITERAL_LEN)
+    return false;
+  *ptr = cur;
+  if (cur == end)
+    return true;
+  return stream_finish_lit(s);
+}
+
+static bool stream_resume_token(JsonStream *s, const char **ptr,
+                                const char *end) {
+  switch (s->tok) {
+  case STREAM_TOK_STR:
+    return stream_scan_str(s, ptr, end);
+  case STREAM_TOK_NUM:
+    return stream_scan_num(s, ptr, end);
+  case STREAM_TOK_LIT:
+    return stream_scan_lit(s, ptr, end);
+  case STREAM_TOK_NONE:
+    break;
+  }
+  return true;
+}
+
+static bool stream_start_value(JsonStream *s, const char **ptr,
+                               const char *end) {
+  char c = **ptr;
+  if (c == '{' || c == '[') {
+    if (s->depth == parser_max_depth(&s->p))
+      return false;
+    (*ptr)++;
+    stream_open(s, c == '{');
+    return true;
+  }
+  if (c == '"') {
+    (*ptr)++;
+    s->tok = STREAM_TOK_STR;
+    s->tok_is_key = false;
+    s->str_has_esc = false;
+  } else if (is_digit(c) || c == '-')
+    s->tok = STREAM_TOK_NUM;
+  else if (c == 't' || c == 'f' || c == 'n')
+    s->tok = STREAM_TOK_LIT;
+  else
+    return false;
+  return stream_resume_token(s, ptr, end);
+}
+
+JsonStreamStatus json_stream_feed(JsonStream *s, const char *chunk,
+                                  size_t len) {
+  if (s->status != JSON_STREAM_NEED_MORE)
+    return s->status;
+
+  const char *ptr = chunk;
+  const char *end = chunk + len;
+  bool ok = true;
+  if (s->tok != STREAM_TOK_NONE && ptr < end)
+    ok = stream_resume_token(s, &ptr, end);
+
+  while (ok && ptr < end && s->tok == STREAM_TOK_NONE &&
+         s->status == JSON_STREAM_NEED_MORE) {
+    char c = *ptr;
+    if (is_json_whitespace(c)) {
+      ptr++;
+      continue;
+    }
+    switch (s->expect) {
+    case STREAM_EXPECT_KEY_OR_END:
+      if (c == '}') {
+        ptr++;
+        stream_close(s);
+        break;
+      }
+      // fallthrough
+    case STREAM_EXPECT_KEY:
+      if (c != '"') {
+        ok = false;
+        break;
+      }
+      ptr++;
+      s->tok = STREAM_TOK_STR;
+      s->tok_is_key = true;
+      s->str_has_esc = false;
+      ok = stream_scan_str(s, &ptr, end);
+      break;
+    case STREAM_EXPECT_COLON:
+      if (c != ':') {
+        ok = false;
+        break;
+      }
+      ptr++;
+      s->expect = STREAM_EXPECT_VALUE;
+      break;
+    case STREAM_EXPECT_COMMA_OR_END: {
+      bool is_obj = s->frames[s->depth - 1].is_obj;
+      if (c == ',') {
+        ptr++;
+        s->expect = is_obj ? STREAM_EXPECT_KEY : STREAM_EXPECT_VALUE;
+      } else if (c == (is_obj ? '}' : ']')) {
+        ptr++;
+        stream_close(s);
+      } else
+        ok = false;
+      break;
+    }
+    case STREAM_EXPECT_VALUE_OR_END:
+      if (c == ']') {
+        ptr++;
+        stream_close(s);
+        break;
+      }
+      // fallthrough
+    case STREAM_EXPECT_VALUE:
+      ok = stream_start_value(s, &ptr, end);
+      break;
+    }
+  }
+
+  s->offset += ptr - chunk;
+  if (!ok)
+    stream_fail(s);
+  return s->status;
+}
+
+JsonStreamStatus json_stream_finish(JsonStream *s) {
+  if (s->status != JSON_STREAM_NEED_MORE)
+    return s->status;
+  // Only a top level number or literal can end exactly at the end of input
+  bool ok = false;
+  if (s->tok == STREAM_TOK_NUM)
+    ok = stream_finish_num(s);
+  else if (s->tok == STREAM_TOK_LIT)
+    ok = stream_finish_lit(s);
+  if (!ok || s->status != JSON_STREAM_DONE)
+    stream_fail(s);
+  return s->status;
+}
+
+size_t json_stream_offset(const JsonStream *s) { return s->offset; }
+
+void json_stream_free(JsonStream *s) {
+  if (s->status == JSON_STREAM_NEED_MORE) {
+    // Abandoned halfway: the partial tree is not handed out to anyone
+    stream_unwind(s);
+    if (s->p.arena == NULL)
+      json_free_val_alloc(s->res, s->p.alloc);
+    s->res->type = JSON_TYPE_NUL;
+  }
+  free(s->frames);
+  free(s->tok_buf);
+  scratch_free(&s->p);
+  free(s);
+}
+
+static int hexval(unsigned char c) {
+  if (c >= '0' && c <= '9')
+    return (int)(c - '0');
+  if (c >= 'a' && c <= 'f')
+    return (int)(c - 'a' + 10);
+  if (c >= 'A' && c <= 'F')
+    return (int)(c - 'A' + 10);
+  return -1;
+}
+
+static bool parse_u16_4hex(const char *p, const char *end, uint16_t *out) {
+  if (end - p < 4)
+    return false;
+  int h0 = hexval((unsigned char)p[0]);
+  int h1 = hexval((unsigned char)p[1]);
+  int h2 = hexval((unsigned char)p[2]);
+  int h3 = hexval((unsigned char)p[3]);
+  if (h0 < 0 || h1 < 0 || h2 < 0 || h3 < 0)
+    return false;
+  *out = (uint16_t)((h0 << 12) | (h1 << 8) | (h2 << 4) | h3);
+  return true;
+}
+
+static size_t utf8_encode(uint32_t cp, char out[4]) {
+  if (cp <= 0x7F) {
+    out[0] = (char)cp;
+    return 1;
+  } else if (cp <= 0x7FF) {
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+  } else if (cp <= 0xFFFF) {
+    out[0] = (char)(0xE0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (cp & 0x3F));
+    return 3;
+  } else {
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+  }
+}
+
+// Decodes the escape-sequence whose backslash precedes src into out (at most
+// 4 bytes, never more than the sequence itself). Returns the position after
+// it, NULL if it is malformed.
+static const char *decode_escape(const char *src, const char *end, char *out,
+                                 size_t *out_len) {
+  if (src >= end)
+    return NULL;
+  *out_len = 1;
+  switch (*src++) {
+  case 'b':
+    *out = '\b';
+    return src;
+  case 'f':
+    *out = '\f';
+    return src;
+  case 'n':
+    *out = '\n';
+    return src;
+  case 'r':
+    *out = '\r';
+    return src;
+  case 't':
+    *out = '\t';
+    return src;
+  case '\\':
+    *out = '\\';
+    return src;
+  case '"':
+    *out = '"';
+    return src;
+  case '/':
+    *out = '/';
+    return src;
+  case 'u': {
+    uint16_t u1;
+    if (!parse_u16_4hex(src, end, &u1))
+      return NULL;
+    src += 4; // Cause four HEX-digits
+    uint32_t cp;
+
+    if (u1 >= 0xD800 && u1 <= 0xDBFF) { // High surrogate
+      if (end - src < 6)
+        return NULL; // Need \uXXXX
+      if (src[0] != '\\' || src[1] != 'u')
+        return NULL;
+      uint16_t u2;
+      src += 2;
+      if (!parse_u16_4hex(src, end, &u2))
+        return NULL;
+      if (u2 < 0xDC00 || u2 > 0xDFFF) // Must be low surrogate
+        return NULL;
+      src += 4;
+      cp = 0x10000u +
+           (((uint32_t)(u1 - 0xD800) << 10) | (uint32_t)(u2 - 0xDC00));
+    } else if (u1 >= 0xDC00 && u1 <= 0xDFFF)
+      return NULL;
+    else
+      cp = (uint32_t)u1;
+
+    if (cp > 0x10FFFFu)
+      return NULL;
+
+    *out_len = utf8_encode(cp, out);
+    return src;
+  }
+  default:
+    return NULL;
+  }
+}
+
+static bool json_decode_str_into(char *res, size_t *res_len, const char *src,
+                                 size_t len) {
+  char *cur = res;
+  const char *end = src + len;
+
+  while (src < end) {
+    if (*src == '\\') {
+      size_t n;
+      if ((src = decode_escape(src + 1, end, cur, &n)) == NULL)
+        return false;
+      cur += n;
+    } else
+      *cur++ = *src++;
+  }
+  *res_len = cur - res;
+  return true;
+}
+
+// Fails exactly where json_decode_str_into would, without decoding
+static bool json_check_escapes(const char *src, size_t len) {
+  const char *end = src + len;
+  char buf[4];
+  size_t n;
+  while ((src = memchr(src, '\\', end - src)) != NULL)
+    if ((src = decode_escape(src + 1, end, buf, &n)) == NULL)
+      return false;
+  return true;
+}
+
+bool json_decode_str(const char **res, size_t *res_len, const char *src,
+                     size_t len) {
+  *res = malloc(len);
+  return json_decode_str_into((char *)*res, res_len, src, len);
+}
+
+static void str_unescape(JsonStr *str, JsonArena *arena,
+                         const JsonAllocator *alloc) {
+  if (!str->escaped)
+    return;
+  // Validated while parsing, and never longer than the escaped form
+  size_t size = str->len;
+  char *decoded =
+      arena != NULL ? json_arena_alloc(arena, size) : mem_alloc(alloc, size);
+  json_decode_str_into(decoded, &str->len, str->start, size);
+  // Heap strings are released by their length, as in parser_fit_str
+  if (arena == NULL && alloc != NULL && str->len != size)
+    decoded = alloc->resize(alloc->ctx, decoded, size, str->len);
+  str->start = decoded;
+  str->needs_dealloc = arena == NULL;
+  str->escaped = false;
+}
+
+void json_str_unescape(JsonStr *str, JsonArena *arena) {
+  str_unescape(str, arena, NULL);
+}
+
+void json_str_unescape_alloc(JsonStr *str, const JsonAllocator *alloc) {
+  str_unescape(str, NULL, alloc);
+}
+
+// Container whose elements are being freed, next is the first one left
+typedef struct {
+  JsonVal *val;
+  size_t next;
+} FreeFrame;
+
+static void free_str(JsonStr *str, const JsonAllocator *alloc) {
+  if (str->needs_dealloc)
+    mem_free(alloc, (void *)str->start, str->len);
+  mem_free(alloc, str, sizeof(JsonStr));
+}
+
+static size_t arr_elem_size(const JsonArr *arr) {
+  switch (arr->kind) {
+  case JSON_ARR_INTS:
+    return sizeof(long long);
+  case JSON_ARR_FRCS:
+    return sizeof(double);
+  case JSON_ARR_VALUES:
+    break;
+  }
+  return sizeof(JsonVal);
+}
+
+static void free_container(JsonVal *val, const JsonAllocator *alloc) {
+  if (val->type == JSON_TYPE_OBJ) {
+    JsonObj *obj = val->as.obj_ptr;
+    obj_free_index(obj);
+    mem_free(alloc, obj->pairs, obj->len * sizeof(JsonPair));
+    mem_free(alloc, obj, sizeof(JsonObj));
+  } else {
+    JsonArr *arr = val->as.arr_ptr;
+    mem_free(alloc, arr->values, arr->len * arr_elem_size(arr));
+    mem_free(alloc, arr, sizeof(JsonArr));
+  }
+}
+
+// Depth-first with an explicit stack, so trees of any depth can be freed
+static void free_val(JsonVal *val, const JsonAllocator *alloc) {
+  if (val->type == JSON_TYPE_STR)
+    free_str(val->as.str_ptr, alloc);
+  if (val->type != JSON_TYPE_OBJ && val->type != JSON_TYPE_ARR)
+    return;
+  FreeFrame local[WALK_LOCAL_DEPTH];
+  FreeFrame *frames = local;
+  size_t depth = 0, cap = WALK_LOCAL_DEPTH;
+push:
+  if (depth == cap)
+    frames = walk_grow(frames, local, &cap, sizeof(FreeFrame));
+  frames[depth++] = (FreeFrame){val, 0};
+
+  while (depth > 0) {
+    FreeFrame *f = &frames[depth - 1];
+    if (f->val->type == JSON_TYPE_OBJ) {
+      JsonObj *obj = f->val->as.obj_ptr;
+      for (size_t i = f->next; i < obj->len; i++) {
+        JsonStr *key = &obj->pairs[i].key;
+        if (key->needs_dealloc)
+          mem_free(alloc, (void *)key->start, key->len);
+        val = &obj->pairs[i].value;
+        if (val->type == JSON_TYPE_OBJ || val->type == JSON_TYPE_ARR) {
+          f->next = i + 1;
+          goto push;
+        }
+        if (val->type == JSON_TYPE_STR)
+          free_str(val->as.str_ptr, alloc);
+      }
+    } else {
+      JsonArr *arr = f->val->as.arr_ptr;
+      size_t len = arr->kind == JSON_ARR_VALUES ? arr->len : 0;
+      for (size_t i = f->next; i < len; i++) {
+        val = &arr->values[i];
+        if (val->type == JSON_TYPE_OBJ || val->type == JSON_TYPE_ARR) {
+          f->next = i + 1;
+          goto push;
+        }
+        if (val->type == JSON_TYPE_STR)
+          free_str(val->as.str_ptr, alloc);
+      }
+    }
+    free_container(f->val, alloc);
+    depth--;
+  }
+  if (frames != local)
+    free(frames);
+}
+
+void json_free_val_alloc(JsonVal *val, const JsonAllocator *alloc) {
+  JsonStats *stats = STATS_CURRENT();
+  uint64_t start = stats_start(stats);
+  free_val(val, alloc);
+  STATS_STOP(stats, free_ns, start);
+}
+
+void json_free_val(JsonVal *val) { json_free_val_alloc(val, NULL); }
+
+static void doc_free_source(JsonDocument *doc) {
+#ifdef JSON_MMAP
+  if (doc->source_mapped)
+    munmap((void *)doc->source, doc->map_len);
+  else
+#endif
+    free((void *)doc->source);
+  doc->source = NULL;
+  doc->source_len = 0;
+  doc->source_mapped = false;
+}
+
+void json_doc_free(JsonDocument *doc) {
+  JsonArenaBlock *block = doc->arena.head;
+  while (block != NULL) {
+    JsonArenaBlock *next = block->next;
+    mem_free(doc->arena.alloc, block, (size_t)(block->end - (char *)block));
+    block = next;
+  }
+  doc_free_source(doc);
+  intern_free(doc->intern);
+  json_doc_init(doc);
+}
+
+const char *json_doc_intern(const JsonDocument *doc, const char *key,
+                            size_t len) {
+  if (doc->intern == NULL)
+    return NULL;
+  InternEntry *e = intern_slot(doc->intern, key, len, hash_bytes(key, len));
+  return e->start;
+}
+
+// Open addressing table over the pairs array, kept at most half full
+typedef struct {
+  uint32_t pair_idx; // Index into pairs + 1, 0 marks an empty slot
+  uint32_t hash;     // Upper half of the key hash, saves most key compares
+} JsonObjIndexSlot;
+
+struct JsonObjIndex {
+  size_t mask; // Slot count - 1
+  JsonObjIndexSlot slots[];
+};
+
+static uint64_t hash_bytes(const char *data, size_t len) {
+  uint64_t h = UINT64_C(0x9E3779B97F4A7C15) ^ len;
+  for (; len >= 8; data += 8, len -= 8) {
+    uint64_t k;
+    memcpy(&k, data, 8);
+    h = (h ^ k) * UINT64_C(0xBF58476D1CE4E5B9);
+    h ^= h >> 31;
+  }
+  uint64_t k = 0;
+  memcpy(&k, data, len);
+  h = (h ^ k) * UINT64_C(0x94D049BB133111EB);
+  return h ^ (h >> 29);
+}
+
+static inline bool json_str_eq(const JsonStr *str, const char *data,
+                               size_t len) {
+  return str->len == len &&
+         (str->start == data || 0 == memcmp(str->start, data, len));
+}
+
+static size_t obj_index_cap(size_t len) {
+  size_t cap = 2;
+  while (cap < len * 2)
+    cap *= 2;
+  return cap;
+}
+
+// Fills an index of cap slots over pairs
+static void obj_index_fill(JsonObjIndex *index, size_t cap,
+                           const JsonPair *pairs, size_t len) {
+  index->mask = cap - 1;
+  memset(index->slots, 0, cap * sizeof(JsonObjIndexSlot));
+
+  for (size_t i = 0; i < len; i++) {
+    const JsonStr *key = &pairs[i].key;
+    uint64_t h = hash_bytes(key->start, key->len);
+    for (size_t slot = h & index->mask;; slot = (slot + 1) & index->mask) {
+      JsonObjIndexSlot *s = &index->slots[slot];
+      if (s->pair_idx == 0) {
+        s->pair_idx = (uint32_t)i + 1;
+        s->hash = (uint32_t)(h >> 32);
+        break;
+      }
+      // Duplicate key: the first occurrence wins, as with the linear scan
+      if (s->hash == (uint32_t)(h >> 32) &&
+          json_str_eq(&pairs[s->pair_idx - 1].key, key->start, key->len))
+        break;
+    }
+  }
+}
+
+static size_t obj_index_size(size_t cap) {
+  return sizeof(JsonObjIndex) + cap * sizeof(JsonObjIndexSlot);
+}
+
+// arena is NULL for heap objects, otherwise the document arena or one that
+// is merged into it
+static void obj_build_index(JsonObj *obj, JsonArena *arena) {
+  if (obj->len >= UINT32_MAX)
+    return;
+  size_t cap = obj_index_cap(obj->len);
+  size_t size = obj_index_size(cap);
+  JsonObjIndex *index = arena != NULL
+                            ? arena_alloc(arena, size, ARENA_NODE_ALIGN)
+                            : mem_alloc(obj->alloc, size);
+  if (index == NULL)
+    return;
+  obj_index_fill(index, cap, obj->pairs, obj->len);
+  obj->index = index;
+}
+
+static void json_obj_build_index(JsonObj *obj) {
+  obj_build_index(obj, obj->arena);
+}
+
+// Of a heap object. The size follows from the slot count, the pairs may
+// have changed since the index was built.
+static void obj_free_index(JsonObj *obj) {
+  if (obj->index != NULL)
+    mem_free(obj->alloc, obj->index, obj_index_size(obj->index->mask + 1));
+}
+
+void json_obj_drop_index(JsonObj *obj) {
+  if (obj->arena == NULL)
+    obj_free_index(obj);
+  obj->index = NULL;
+}
+
+JsonVal *json_value_by_key_len(JsonObj *obj, const char *key, size_t len) {
+  if (obj->index == NULL && obj->len >= OBJ_INDEX_MIN_LEN)
+    json_obj_build_index(obj);
+
+  if (obj->index != NULL) {
+    const JsonObjIndex *index = obj->index;
+    uint64_t h = hash_bytes(key, len);
+    for (size_t slot = h & index->mask;; slot = (slot + 1) & index->mask) {
+      const JsonObjIndexSlot *s = &index->slots[slot];
+      if (s->pair_idx == 0)
+        return NULL;
+      if (s->hash == (uint32_t)(h >> 32) &&
+          json_str_eq(&obj->pairs[s->pair_idx - 1].key, key, len))
+        return &obj->pairs[s->pair_idx - 1].value;
+    }
+  }
+
+  for (size_t i = 0; i < obj->len; i++) {
+    if (json_str_eq(&obj->pairs[i].key, key, len))
+      return &obj->pairs[i].value;
+  }
+  return NULL;
+}
+
+JsonVal *json_value_by_key(JsonObj *obj, const char *to_find) {
+  return json_value_by_key_len(obj, to_find, strlen(to_find));
+}
+
+// Equal interned keys share their bytes, so other pointers are other keys
+JsonVal *json_value_by_interned_key(JsonObj *obj, const char *key,
+                                    size_t len) {
+  if (obj->index != NULL || obj->len >= OBJ_INDEX_MIN_LEN)
+    return json_value_by_key_len(obj, key, len);
+  for (size_t i = 0; i < obj->len; i++)
+    if (obj->pairs[i].key.start == key)
+      return &obj->pairs[i].value;
+  return NULL;
+}
+
+// Binary snapshot: the tree in its in-memory layout (JsonVal, JsonObj,
+// JsonArr, JsonStr, pairs/values arrays, key indexes and string bytes) with
+// every pointer replaced by its offset from the start of the image. Nodes
+// follow their parent, so all offsets point forward. Loading maps the file
+// and turns the offsets back into pointers in one pass over the nodes; string
+// bytes are not touched.
+
+#define SNAPSHOT_MAGIC UINT64_C(0x3170616e736e736a) // "jsnsnap1"
+#define SNAPSHOT_ALIGN 8
+
+typedef struct {
+  uint64_t magic; // Also rejects the other byte order
+  uint64_t layout;
+  uint64_t len; // Of the whole image
+  JsonVal root;
+} SnapshotHeader;
+
+// Images are only readable by builds with the same node layout
+static uint64_t snapshot_layout(void) {
+  return (uint64_t)sizeof(JsonVal) | (uint64_t)sizeof(JsonObj) << 8 |
+         (uint64_t)sizeof(JsonArr) << 16 | (uint64_t)sizeof(JsonStr) << 24 |
+         (uint64_t)sizeof(JsonPair) << 32 | (uint64_t)sizeof(void *) << 40 |
+         (uint64_t)offsetof(JsonVal, type) << 48;
+}
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+} SnapshotWriter;
+
+// Zeroed, so the padding in the image is deterministic
+static size_t snapshot_alloc(SnapshotWriter *s, size_t size) {
+  size_t off = s->len;
+  size = (size + SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1);
+  if (s->len + size > s->cap) {
+    while (s->len + size > s->cap)
+      s->cap *= 2;
+    s->buf = realloc(s->buf, s->cap);
+  }
+  memset(s->buf + off, 0, size);
+  s->len += size;
+  return off;
+}
+
+// Offsets are stored in the pointer fields
+#define SNAPSHOT_PTR(off) ((void *)(uintptr_t)(off))
+
+static void snapshot_str(SnapshotWriter *s, const JsonStr *str, size_t dst) {
+  JsonStr out = {0};
+  size_t bytes = snapshot_alloc(s, str->len);
+  memcpy(s->buf + bytes, str->start, str->len);
+  out.start = SNAPSHOT_PTR(bytes);
+  out.len = str->len;
+  out.escaped = str->escaped;
+  memcpy(s->buf + dst, &out, sizeof(JsonStr));
+}
+
+// Writes the node of val at dst. Returns where the pairs/values array of a
+// container went, for the walk over its elements.
+static size_t snapshot_node(SnapshotWriter *s, const JsonVal *val,
+                            size_t dst) {
+  JsonVal out;
+  memset(&out, 0, sizeof(JsonVal));
+  out.type = val->type;
+  size_t elems = 0;
+  switch (val->type) {
+  case JSON_TYPE_OBJ: {
+    const JsonObj *obj = val->as.obj_ptr;
+    JsonObj node = {0};
+    size_t node_off = snapshot_alloc(s, sizeof(JsonObj));
+    elems = snapshot_alloc(s, obj->len * sizeof(JsonPair));
+    node.pairs = obj->len > 0 ? SNAPSHOT_PTR(elems) : NULL;
+    node.len = obj->len;
+    if (obj->len >= OBJ_INDEX_MIN_LEN && obj->len < UINT32_MAX) {
+      size_t cap = obj_index_cap(obj->len);
+      size_t index = snapshot_alloc(
+          s, sizeof(JsonObjIndex) + cap * sizeof(JsonObjIndexSlot));
+      obj_index_fill((JsonObjIndex *)(s->buf + index), cap, obj->pairs,
+                     obj->len);
+      node.index = SNAPSHOT_PTR(index);
+    }
+    memcpy(s->buf + node_off, &node, sizeof(JsonObj));
+    out.as.obj_ptr = SNAPSHOT_PTR(node_off);
+    break;
+  }
+  case JSON_TYPE_ARR: {
+    const JsonArr *arr = val->as.arr_ptr;
+    JsonArr node = {0};
+    size_t node_off = snapshot_alloc(s, sizeof(JsonArr));
+    elems = snapshot_alloc(s, arr->len * arr_elem_size(arr));
+    node.values = arr->len > 0 ? SNAPSHOT_PTR(elems) : NULL;
+    node.len = arr->len;
+    node.kind = arr->kind;
+    memcpy(s->buf + node_off, &node, sizeof(JsonArr));
+    if (arr->kind != JSON_ARR_VALUES)
+      memcpy(s->buf + elems, arr->values, arr->len * arr_elem_size(arr));
+    out.as.arr_ptr = SNAPSHOT_PTR(node_off);
+    break;
+  }
+  case JSON_TYPE_STR: {
+    size_t node_off = snapshot_alloc(s, sizeof(JsonStr));
+    snapshot_str(s, val->as.str_ptr, node_off);
+    out.as.str_ptr = SNAPSHOT_PTR(node_off);
+    break;
+  }
+  case JSON_TYPE_INT:
+    out.as.integer = val->as.integer;
+    break;
+  case JSON_TYPE_FRC:
+    out.as.fract = val->as.fract;
+    break;
+  case JSON_TYPE_BOL:
+    out.as.boolean = val->as.boolean;
+    break;
+  case JSON_TYPE_NUL:
+    break;
+  }
+  memcpy(s->buf + dst, &out, sizeof(JsonVal));
+  return elems;
+}
+
+// Container whose elements are being written to the pairs/values array at
+// elems, next is the first one left
+typedef struct {
+  const JsonVal *val;
+  size_t elems;
+  size_t next;
+} SnapshotFrame;
+
+static inline bool snapshot_has_elems(const JsonVal *val) {
+  return val->type == JSON_TYPE_OBJ ||
+         (val->type == JSON_TYPE_ARR &&
+          val->as.arr_ptr->kind == JSON_ARR_VALUES);
+}
+
+// Depth-first with an explicit stack like free_val, so every node still
+// follows its parent
+static void snapshot_val(SnapshotWriter *s, const JsonVal *val, size_t dst) {
+  SnapshotFrame local[WALK_LOCAL_DEPTH];
+  SnapshotFrame *frames = local;
+  size_t depth = 0, cap = WALK_LOCAL_DEPTH;
+  size_t elems = snapshot_node(s, val, dst);
+push:
+  if (snapshot_has_elems(val)) {
+    if (depth == cap)
+      frames = walk_grow(frames, local, &cap, sizeof(SnapshotFrame));
+    frames[depth++] = (SnapshotFrame){val, elems, 0};
+  }
+  while (depth > 0) {
+    SnapshotFrame *f = &frames[depth - 1];
+    size_t i = f->next++;
+    if (f->val->type == JSON_TYPE_OBJ) {
+      const JsonObj *obj = f->val->as.obj_ptr;
+      if (i < obj->len) {
+        size_t pair = f->elems + i * sizeof(JsonPair);
+        snapshot_str(s, &obj->pairs[i].key, pair + offsetof(JsonPair, key));
+        val = &obj->pairs[i].value;
+        elems = snapshot_node(s, val, pair + offsetof(JsonPair, value));
+        goto push;
+      }
+    } else if (i < f->val->as.arr_ptr->len) {
+      val = &f->val->as.arr_ptr->values[i];
+      elems = snapshot_node(s, val, f->elems + i * sizeof(JsonVal));
+      goto push;
+    }
+    depth--;
+  }
+  if (frames != local)
+    free(frames);
+}
+
+bool json_snapshot_save(const JsonVal *val, const char *path) {
+  SnapshotWriter s = {.buf = malloc(ARENA_MIN_BLOCK_SIZE),
+                      .cap = ARENA_MIN_BLOCK_SIZE};
+  size_t hdr = snapshot_alloc(&s, sizeof(SnapshotHeader));
+  snapshot_val(&s, val, hdr + offsetof(SnapshotHeader, root));
+  SnapshotHeader *header = (SnapshotHeader *)(s.buf + hdr);
+  header->magic = SNAPSHOT_MAGIC;
+  header->layout = snapshot_layout();
+  header->len = s.len;
+
+  FILE *f = fopen(path, "wb");
+  bool ok = f != NULL && fwrite(s.buf, 1, s.len, f) == s.len;
+  if (f != NULL && fclose(f) != 0)
+    ok = false;
+  free(s.buf);
+  return ok;
+}
+
+typedef struct {
+  char *base;
+  size_t len;
+  JsonArena *arena;
+} SnapshotLoader;
+
+// Turns the offset in *ptr into a pointer to size bytes at or after min
+static bool snapshot_reloc(const SnapshotLoader *l, void *ptr, size_t min,
+                           size_t size) {
+  uintptr_t off;
+  memcpy(&off, ptr, sizeof(off));
+  if (off < min || off > l->len || size > l->len - off ||
+      off % SNAPSHOT_ALIGN != 0)
+    return false;
+  void *res = l->base + off;
+  memcpy(ptr, &res, sizeof(res));
+  return true;
+}
+
+// Reading a bool that is neither 0 nor 1 is undefined
+static bool snapshot_bool_ok(const bool *b) {
+  unsigned char byte;
+  memcpy(&byte, b, 1);
+  return byte <= 1;
+}
+
+static bool snapshot_reloc_str(const SnapshotLoader *l, JsonStr *str,
+                               size_t min) {
+  return snapshot_bool_ok(&str->escaped) &&
+         snapshot_bool_ok(&str->needs_dealloc) && !str->needs_dealloc &&
+         snapshot_reloc(l, &str->start, min, str->len);
+}
+
+// Relocates the node of val. *min is the end of the node holding val, past
+// which its node has to lie; for a container it becomes the end of its own
+// arrays, past which the nodes of its elements lie.
+static bool snapshot_reloc_node(const SnapshotLoader *l, JsonVal *val,
+                                size_t *min) {
+  switch (val->type) {
+  case JSON_TYPE_OBJ: {
+    if (!snapshot_reloc(l, &val->as.obj_ptr, *min, sizeof(JsonObj)))
+      return false;
+    JsonObj *obj = val->as.obj_ptr;
+    *min = (size_t)((char *)obj - l->base) + sizeof(JsonObj);
+    obj->arena = l->arena;
+    obj->alloc = NULL;
+    // Empty containers are written with NULL, anything else is an alias
+    if (obj->len == 0) {
+      if (obj->pairs != NULL)
+        return false;
+    } else {
+      if (obj->len > l->len / sizeof(JsonPair) ||
+          !snapshot_reloc(l, &obj->pairs, *min, obj->len * sizeof(JsonPair)))
+        return false;
+      *min =
+          (size_t)((char *)obj->pairs - l->base) + obj->len * sizeof(JsonPair);
+    }
+    if (obj->index != NULL) {
+      size_t cap = obj_index_cap(obj->len);
+      size_t size = sizeof(JsonObjIndex) + cap * sizeof(JsonObjIndexSlot);
+      if (obj->len < OBJ_INDEX_MIN_LEN || obj->len >= UINT32_MAX ||
+          !snapshot_reloc(l, &obj->index, *min, size) ||
+          obj->index->mask != cap - 1)
+        return false;
+      *min = (size_t)((char *)obj->index - l->base) + size;
+    }
+    return true;
+  }
+  case JSON_TYPE_ARR: {
+    if (!snapshot_reloc(l, &val->as.arr_ptr, *min, sizeof(JsonArr)))
+      return false;
+    JsonArr *arr = val->as.arr_ptr;
+    *min = (size_t)((char *)arr - l->base) + sizeof(JsonArr);
+    // Any bytes are valid packed numbers, only the kind is checked
+    if ((unsigned)arr->kind > JSON_ARR_FRCS)
+      return false;
+    size_t elem_size = arr_elem_size(arr);
+    if (arr->len == 0)
+      return arr->values == NULL;
+    if (arr->len > l->len / elem_size ||
+        !snapshot_reloc(l, &arr->values, *min, arr->len * elem_size))
+      return false;
+    *min = (size_t)((char *)arr->values - l->base) + arr->len * elem_size;
+    return true;
+  }
+  case JSON_TYPE_STR:
+    if (!snapshot_reloc(l, &val->as.str_ptr, *min, sizeof(JsonStr)))
+      return false;
+    return snapshot_reloc_str(l, val->as.str_ptr,
+                              (size_t)((char *)val->as.str_ptr - l->base) +
+                                  sizeof(JsonStr));
+  case JSON_TYPE_BOL:
+    return snapshot_bool_ok(&val->as.boolean);
+  case JSON_TYPE_INT:
+  case JSON_TYPE_FRC:
+  case JSON_TYPE_NUL:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Container whose elements are being relocated, min is the end of its arrays
+typedef struct {
+  JsonVal *val;
+  size_t min;
+  size_t next;
+} SnapshotRelocFrame;
+
+// Iterative like snapshot_val: images of any depth load without recursion
+static bool snapshot_reloc_val(const SnapshotLoader *l, JsonVal *val,
+                               size_t min) {
+  SnapshotRelocFrame local[WALK_LOCAL_DEPTH];
+  SnapshotRelocFrame *frames = local;
+  size_t depth = 0, cap = WALK_LOCAL_DEPTH;
+  bool ok = snapshot_reloc_node(l, val, &min);
+push:
+  if (ok && snapshot_has_elems(val)) {
+    if (depth == cap)
+      frames = walk_grow(frames, local, &cap, sizeof(SnapshotRelocFrame));
+    frames[depth++] = (SnapshotRelocFrame){val, min, 0};
+  }
+  while (ok && depth > 0) {
+    SnapshotRelocFrame *f = &frames[depth - 1];
+    size_t i = f->next++;
+    if (f->val->type == JSON_TYPE_OBJ) {
+      JsonObj *obj = f->val->as.obj_ptr;
+      if (i < obj->len) {
+        val = &obj->pairs[i].value;
+        min = f->min;
+        ok = snapshot_reloc_str(l, &obj->pairs[i].key, min) &&
+             snapshot_reloc_node(l, val, &min);
+        goto push;
+      }
+    } else if (i < f->val->as.arr_ptr->len) {
+      val = &f->val->as.arr_ptr->values[i];
+      min = f->min;
+      ok = snapshot_reloc_node(l, val, &min);
+      goto push;
+    }
+    depth--;
+  }
+  if (frames != local)
+    free(frames);
+  return ok;
+}
+
+bool json_doc_load_snapshot(JsonDocument *doc, const char *path) {
+  if (!doc_load_file(doc, path, true))
+    return false;
+  SnapshotHeader *header = (SnapshotHeader *)doc->source;
+  SnapshotLoader l = {.base = (char *)doc->source,
+                      .len = doc->source_len,
+                      .arena = &doc->arena};
+  if (doc->source_len < sizeof(SnapshotHeader) ||
+      header->magic != SNAPSHOT_MAGIC || header->layout != snapshot_layout() ||
+      header->len != doc->source_len ||
+      !snapshot_reloc_val(&l, &header->root, sizeof(SnapshotHeader))) {
+    // Relocation allocates nothing, only the file has to be released
+    doc_free_source(doc);
+    errno = EINVAL;
+    return false;
+  }
+  doc->root = header->root;
+  return true;
+}
+
+static const char DIGIT_PAIRS[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+// Writes the decimal digits of value and returns their count (at most 20)
+static size_t format_u64(char *buf, uint64_t value) {
+  char tmp[20];
+  char *cur = tmp + sizeof(tmp);
+  while (value >= 100) {
+    unsigned pair = (unsigned)(value % 100) * 2;
+    value /= 100;
+    *--cur = DIGIT_PAIRS[pair + 1];
+    *--cur = DIGIT_PAIRS[pair];
+  }
+  if (value >= 10) {
+    *--cur = DIGIT_PAIRS[value * 2 + 1];
+    *--cur = DIGIT_PAIRS[value * 2];
+  } else
+    *--cur = (char)('0' + value);
+  size_t len = tmp + sizeof(tmp) - cur;
+  memcpy(buf, cur, len);
+  return len;
+}
+
+static size_t json_format_int(char *buf, long long value) {
+  if (value < 0) {
+    *buf = '-';
+    return 1 + format_u64(buf + 1, 0 - (uint64_t)value);
+  }
+  return format_u64(buf, (uint64_t)value);
+}
+
+// Grisu3 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+// with Integers"): produces the shortest digit string that reads back as the
+// same double, and the closest one of that length, or detects that the
+// approximated powers of ten leave that undecided. For the ~0.5% of values
+// where it gives up the digits are found by trial with printf and strtod.
+
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+typedef struct {
+  uint64_t f;
+  int e;
+  int k;
+} CachedPower;
+
+#define GRISU_ALPHA (-60)
+#define GRISU_GAMMA (-32)
+#define CACHED_POWERS_MIN_DEC_EXP (-300)
+#define CACHED_POWERS_DEC_STEP 8
+
+// Normalized 64-bit approximations of 10^k for k = -300, -292, ..., 324
+static const CachedPower CACHED_POWERS[] = {
+    {0xAB70FE17C79AC6CA, -1060, -300},
+    {0xFF77B1FCBEBCDC4F, -1034, -292},
+    {0xBE5691EF416BD60C, -1007, -284},
+    {0x8DD01FAD907FFC3C, -980, -276},
+    {0xD3515C2831559A83, -954, -268},
+    {0x9D71AC8FADA6C9B5, -927, -260},
+    {0xEA9C227723EE8BCB, -901, -252},
+    {0xAECC49914078536D, -874, -244},
+    {0x823C12795DB6CE57, -847, -236},
+    {0xC21094364DFB5637, -821, -228},
+    {0x9096EA6F3848984F, -794, -220},
+    {0xD77485CB25823AC7, -768, -212},
+    {0xA086CFCD97BF97F4, -741, -204},
+    {0xEF340A98172AACE5, -715, -196},
+    {0xB23867FB2A35B28E, -688, -188},
+    {0x84C8D4DFD2C63F3B, -661, -180},
+    {0xC5DD44271AD3CDBA, -635, -172},
+    {0x936B9FCEBB25C996, -608, -164},
+    {0xDBAC6C247D62A584, -582, -156},
+    {0xA3AB66580D5FDAF6, -555, -148},
+    {0xF3E2F893DEC3F126, -529, -140},
+    {0xB5B5ADA8AAFF80B8, -502, -132},
+    {0x87625F056C7C4A8B, -475, -124},
+    {0xC9BCFF6034C13053, -449, -116},
+    {0x964E858C91BA2655, -422, -108},
+    {0xDFF9772470297EBD, -396, -100},
+    {0xA6DFBD9FB8E5B88F, -369, -92},
+    {0xF8A95FCF88747D94, -343, -84},
+    {0xB94470938FA89BCF, -316, -76},
+    {0x8A08F0F8BF0F156B, -289, -68},
+    {0xCDB02555653131B6, -263, -60},
+    {0x993FE2C6D07B7FAC, -236, -52},
+    {0xE45C10C42A2B3B06, -210, -44},
+    {0xAA242499697392D3, -183, -36},
+    {0xFD87B5F28300CA0E, -157, -28},
+    {0xBCE5086492111AEB, -130, -20},
+    {0x8CBCCC096F5088CC, -103, -12},
+    {0xD1B71758E219652C, -77, -4},
+    {0x9C40000000000000, -50, 4},
+    {0xE8D4A51000000000, -24, 12},
+    {0xAD78EBC5AC620000, 3, 20},
+    {0x813F3978F8940984, 30, 28},
+    {0xC097CE7BC90715B3, 56, 36},
+    {0x8F7E32CE7BEA5C70, 83, 44},
+    {0xD5D238A4ABE98068, 109, 52},
+    {0x9F4F2726179A2245, 136, 60},
+    {0xED63A231D4C4FB27, 162, 68},
+    {0xB0DE65388CC8ADA8, 189, 76},
+    {0x83C7088E1AAB65DB, 216, 84},
+    {0xC45D1DF942711D9A, 242, 92},
+    {0x924D692CA61BE758, 269, 100},
+    {0xDA01EE641A708DEA, 295, 108},
+    {0xA26DA3999AEF774A, 322, 116},
+    {0xF209787BB47D6B85, 348, 124},
+    {0xB454E4A179DD1877, 375, 132},
+    {0x865B86925B9BC5C2, 402, 140},
+    {0xC83553C5C8965D3D, 428, 148},
+    {0x952AB45CFA97A0B3, 455, 156},
+    {0xDE469FBD99A05FE3, 481, 164},
+    {0xA59BC234DB398C25, 508, 172},
+    {0xF6C69A72A3989F5C, 534, 180},
+    {0xB7DCBF5354E9BECE, 561, 188},
+    {0x88FCF317F22241E2, 588, 196},
+    {0xCC20CE9BD35C78A5, 614, 204},
+    {0x98165AF37B2153DF, 641, 212},
+    {0xE2A0B5DC971F303A, 667, 220},
+    {0xA8D9D1535CE3B396, 694, 228},
+    {0xFB9B7CD9A4A7443C, 720, 236},
+    {0xBB764C4CA7A44410, 747, 244},
+    {0x8BAB8EEFB6409C1A, 774, 252},
+    {0xD01FEF10A657842C, 800, 260},
+    {0x9B10A4E5E9913129, 827, 268},
+    {0xE7109BFBA19C0C9D, 853, 276},
+    {0xAC2820D9623BF429, 880, 284},
+    {0x80444B5E7AA7CF85, 907, 292},
+    {0xBF21E44003ACDD2D, 933, 300},
+    {0x8E679C2F5E44FF8F, 960, 308},
+    {0xD433179D9C8CB841, 986, 316},
+    {0x9E19DB92B4E31BA9, 1013, 324},
+};
+
+static DiyFp diyfp_mul(DiyFp x, DiyFp y) {
+  uint64_t hi;
+  uint64_t lo = umul128(x.f, y.f, &hi);
+  hi += lo >> 63; // Round, ties up
+  return (DiyFp){hi, x.e + y.e + 64};
+}
+
+static DiyFp diyfp_normalize(DiyFp x) {
+  int lz = __builtin_clzll(x.f);
+  return (DiyFp){x.f << lz, x.e - lz};
+}
+
+// Splits value into v and the boundaries m- and m+ of its rounding interval,
+// with m- and m+ sharing the exponent of the normalized m+
+static void compute_boundaries(double value, DiyFp *m_minus, DiyFp *v,
+                               DiyFp *m_plus) {
+  const uint64_t hidden_bit = UINT64_C(1) << 52;
+  const int min_exp = 1 - 1075;
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int biased_e = (int)(bits >> 52);
+  uint64_t f = bits & (hidden_bit - 1);
+
+  DiyFp w = biased_e == 0 ? (DiyFp){f, min_exp}
+                          : (DiyFp){f + hidden_bit, biased_e - 1075};
+  bool lower_boundary_is_closer = f == 0 && biased_e > 1;
+  DiyFp plus = diyfp_normalize((DiyFp){2 * w.f + 1, w.e - 1});
+  DiyFp minus = lower_boundary_is_closer ? (DiyFp){4 * w.f - 1, w.e - 2}
+                                         : (DiyFp){2 * w.f - 1, w.e - 1};
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  *m_minus = minus;
+  *v = diyfp_normalize(w);
+  *m_plus = plus;
+}
+
+static CachedPower cached_power_for_binary_exponent(int e) {
+  // k = ceil((alpha - e - 1) * log10(2))
+  int f = GRISU_ALPHA - e - 1;
+  int k = (f * 78913) / (1 << 18) + (f > 0);
+  int index = (-CACHED_POWERS_MIN_DEC_EXP + k + (CACHED_POWERS_DEC_STEP - 1)) /
+              CACHED_POWERS_DEC_STEP;
+  return CACHED_POWERS[index];
+}
+
+static int find_largest_pow10(uint32_t n, uint32_t *pow10) {
+  static const uint32_t pows[] = {1,      10,      100,      1000,
+                                  10000,  100000,  1000000,  10000000,
+                                  100000000, 1000000000};
+  int k = 10;
+  while (k > 1 && n < pows[k - 1])
+    k--;
+  *pow10 = pows[k - 1];
+  return k;
+}
+
+// Moves the last digit towards w while that keeps it inside the safe
+// interval and gets closer, then checks that the result is the closest and
+// within the interval whatever the rounding errors of the scaling (unit).
+// dist is from the upper end of the unsafe interval down to w.
+static bool grisu3_round_weed(char *buf, int len, uint64_t dist,
+                              uint64_t unsafe, uint64_t rest, uint64_t ten_k,
+                              uint64_t unit) {
+  uint64_t small_dist = dist - unit;
+  uint64_t big_dist = dist + unit;
+  while (rest < small_dist && unsafe - rest >= ten_k &&
+         (rest + ten_k < small_dist ||
+          small_dist - rest >= rest + ten_k - small_dist)) {
+    buf[len - 1]--;
+    rest += ten_k;
+  }
+  if (rest < big_dist && unsafe - rest >= ten_k &&
+      (rest + ten_k < big_dist || big_dist - rest > rest + ten_k - big_dist))
+    return false;
+  return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+// Generates digits of m_plus until they fall into the interval widened by
+// one unit each side, the error of the scaled boundaries
+static bool grisu3_digit_gen(char *buf, int *len, int *kappa, DiyFp m_minus,
+                             DiyFp w, DiyFp m_plus) {
+  uint64_t unit = 1;
+  uint64_t too_low = m_minus.f - unit;
+  uint64_t too_high = m_plus.f + unit;
+  uint64_t unsafe = too_high - too_low;
+  int one_e = w.e;
+  uint64_t one_f = UINT64_C(1) << -one_e;
+
+  uint32_t p1 = (uint32_t)(too_high >> -one_e);
+  uint64_t p2 = too_high & (one_f - 1);
+
+  uint32_t pow10;
+  *kappa = find_largest_pow10(p1, &pow10);
+  *len = 0;
+  while (*kappa > 0) {
+    uint32_t d = p1 / pow10;
+    p1 %= pow10;
+    buf[(*len)++] = (char)('0' + d);
+    (*kappa)--;
+    uint64_t rest = ((uint64_t)p1 << -one_e) + p2;
+    if (rest < unsafe)
+      return grisu3_round_weed(buf, *len, too_high - w.f, unsafe, rest,
+                               (uint64_t)pow10 << -one_e, unit);
+    pow10 /= 10;
+  }
+
+  for (;;) {
+    p2 *= 10;
+    unit *= 10;
+    unsafe *= 10;
+    buf[(*len)++] = (char)('0' + (p2 >> -one_e));
+    p2 &= one_f - 1;
+    (*kappa)--;
+    if (p2 < unsafe)
+      return grisu3_round_weed(buf, *len, (too_high - w.f) * unit, unsafe, p2,
+                               one_f, unit);
+  }
+}
+
+// Tries the closest decimals of prec digits to value: the correctly rounded
+// one from printf, then its neighbour on the side of value in case it falls
+// just outside the rounding interval (which is narrower below powers of
+// two). Leaves the digits of one that reads back in buf, without trailing
+// zeros, and returns their count; 0 if neither does.
+static int trial_digits(char *buf, int *decimal_exponent, double value,
+                        int prec) {
+  char tmp[40];
+  snprintf(tmp, sizeof(tmp), "%.*e", prec - 1, value);
+  uint64_t m = 0;
+  const char *c = tmp;
+  for (; *c != 'e'; c++)
+    if (is_digit(*c)) // Skips the locale's decimal point
+      m = m * 10 + (uint64_t)(*c - '0');
+  int e = atoi(c + 1) - (prec - 1);
+  for (int tries = 0; tries < 2; tries++) {
+    double back = value; // 17 digits always read back
+    if (prec < 17) {
+      snprintf(tmp, sizeof(tmp), "%llue%d", (unsigned long long)m, e);
+      back = strtod(tmp, NULL);
+    }
+    if (back == value) {
+      int len = (int)format_u64(buf, m);
+      while (len > 1 && buf[len - 1] == '0') {
+        len--;
+        e++;
+      }
+      *decimal_exponent = e;
+      return len;
+    }
+    m = back < value ? m + 1 : m - 1;
+  }
+  return 0;
+}
+
+// The fallback. A length that reads back stays so with more digits, so past
+// min_len the shortest one is found by bisection.
+static int shortest_by_trial(char *buf, int *decimal_exponent, double value,
+                             int min_len) {
+  int len = trial_digits(buf, decimal_exponent, value, min_len);
+  if (len != 0)
+    return len;
+  int lo = min_len, hi = 17;
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    if (trial_digits(buf, decimal_exponent, value, mid) != 0)
+      hi = mid;
+    else
+      lo = mid;
+  }
+  return trial_digits(buf, decimal_exponent, value, hi);
+}
+
+// value must be finite and positive. Leaves the digits in buf, value being
+// buf * 10^decimal_exponent.
+static int shortest_digits(char *buf, int *decimal_exponent, double value) {
+  DiyFp m_minus, v, m_plus;
+  compute_boundaries(value, &m_minus, &v, &m_plus);
+
+  CachedPower cached = cached_power_for_binary_exponent(m_plus.e);
+  DiyFp c_minus_k = {cached.f, cached.e};
+  DiyFp w = diyfp_mul(v, c_minus_k);
+  DiyFp w_minus = diyfp_mul(m_minus, c_minus_k);
+  DiyFp w_plus = diyfp_mul(m_plus, c_minus_k);
+
+  // Failed or not, no fewer digits fit into the widened interval
+  int len, kappa;
+  if (!grisu3_digit_gen(buf, &len, &kappa, w_minus, w, w_plus))
+    return shortest_by_trial(buf, decimal_exponent, value,
+                             len < 17 ? len : 17);
+  *decimal_exponent = kappa - cached.k;
+  return len;
+}
+
+#define FRC_MIN_EXP (-4)
+#define FRC_MAX_EXP 15
+
+// Formats a finite double as the shortest text that parses back to it. Plain
+// notation is used for decimal exponents in (FRC_MIN_EXP, FRC_MAX_EXP] and
+// integral values keep a ".0" so they are read back as JSON_TYPE_FRC.
+static size_t json_format_frc(char *buf, double value) {
+  char *start = buf;
+  if (signbit(value)) {
+    value = -value;
+    *buf++ = '-';
+  }
+  if (value == 0) {
+    memcpy(buf, "0.0", 3);
+    return buf + 3 - start;
+  }
+
+  int decimal_exponent;
+  int k = shortest_digits(buf, &decimal_exponent, value);
+  int n = k + decimal_exponent; // Position of the decimal point
+
+  if (k <= n && n <= FRC_MAX_EXP) {
+    memset(buf + k, '0', n - k);
+    buf[n] = '.';
+    buf[n + 1] = '0';
+    return buf + n + 2 - start;
+  }
+  if (0 < n && n <= FRC_MAX_EXP) {
+    memmove(buf + n + 1, buf + n, k - n);
+    buf[n] = '.';
+    return buf + k + 1 - start;
+  }
+  if (FRC_MIN_EXP < n && n <= 0) {
+    memmove(buf + 2 - n, buf, k);
+    buf[0] = '0';
+    buf[1] = '.';
+    memset(buf + 2, '0', -n);
+    return buf + 2 - n + k - start;
+  }
+
+  if (k == 1)
+    buf += 1;
+  else {
+    memmove(buf + 2, buf + 1, k - 1);
+    buf[1] = '.';
+    buf += 1 + k;
+  }
+  *buf++ = 'e';
+  int e = n - 1;
+  *buf++ = e < 0 ? '-' : '+';
+  unsigned ue = e < 0 ? -e : e;
+  if (ue >= 100) {
+    *buf++ = (char)('0' + ue / 100);
+    ue %= 100;
+  }
+  memcpy(buf, &DIGIT_PAIRS[ue * 2], 2);
+  return buf + 2 - start;
+}
+
+static void establish_buf_len(JsonWriter *w, size_t target_len) {
+  if (w->buf_len < target_len) {
+    size_t old_len = w->buf_len;
+    do {
+      w->buf_len += w->realloc_increment;
+      w->realloc_increment *= 2;
+    } while (w->buf_len < target_len);
+    w->str = mem_resize(w->alloc, w->str, old_len, w->buf_len);
+    STATS_ADD(STATS_CURRENT(), writer_growths, 1);
+  }
+}
+
+// Empties the buffer of a sink writer. After the first failed write the
+// output is dropped.
+static void writer_flush_buf(JsonWriter *w) {
+  if (w->sink_ok && w->str_len > 0)
+    w->sink_ok = w->sink(w->sink_ctx, w->str, w->str_len);
+  w->str_len = 0;
+}
+
+// Makes room for len more bytes and returns where they go. For sink writers
+// len must not exceed WRITER_MIN_SINK_BUF_SIZE.
+static inline char *writer_reserve(JsonWriter *w, size_t len) {
+  if (w->buf_len - w->str_len < len) {
+    if (w->sink != NULL)
+      writer_flush_buf(w);
+    else
+      establish_buf_len(w, w->str_len + len);
+  }
+  return w->str + w->str_len;
+}
+
+// Data larger than the buffer of a sink writer goes to the sink directly
+static void writer_sink_append(JsonWriter *w, const char *data, size_t len) {
+  writer_flush_buf(w);
+  if (len < w->buf_len) {
+    memcpy(w->str, data, len);
+    w->str_len = len;
+  } else if (w->sink_ok)
+    w->sink_ok = w->sink(w->sink_ctx, data, len);
+}
+
+static inline void writer_append(JsonWriter *w, const char *data,
+                                 size_t len) {
+  if (w->buf_len - w->str_len < len && w->sink != NULL) {
+    writer_sink_append(w, data, len);
+    return;
+  }
+  memcpy(writer_reserve(w, len), data, len);
+  w->str_len += len;
+}
+
+// Keeps the collected output a C string, sink output is not terminated
+static inline void writer_terminate(JsonWriter *w) {
+  if (w->sink == NULL)
+    *writer_reserve(w, 1) = '\0';
+}
+
+static inline void cstr_append(JsonWriter *w, const char *postfix) {
+  writer_append(w, postfix, strlen(postfix));
+}
+
+static void append_indent_level(JsonWriter *w) {
+  for (size_t i = 0; i < w->indentation_level; i++)
+    writer_append(w, w->style->indentation_str, w->indentation_len);
+}
+
+// Length of the escape-sequence for a byte for which is_str_special holds
+static inline size_t escape_len(unsigned char c) {
+  switch (c) {
+  case '"':
+  case '\\':
+  case '\b':
+  case '\f':
+  case '\n':
+  case '\r':
+  case '\t':
+    return 2;
+  default:
+    return 6;
+  }
+}
+
+static size_t escape_char(char *buf, unsigned char c) {
+  static const char hex[] = "0123456789ABCDEF";
+  buf[0] = '\\';
+  switch (c) {
+  case '"':
+  case '\\':
+    buf[1] = (char)c;
+    return 2;
+  case '\b':
+    buf[1] = 'b';
+    return 2;
+  case '\f':
+    buf[1] = 'f';
+    return 2;
+  case '\n':
+    buf[1] = 'n';
+    return 2;
+  case '\r':
+    buf[1] = 'r';
+    return 2;
+  case '\t':
+    buf[1] = 't';
+    return 2;
+  default:
+    memcpy(buf + 1, "u00", 3);
+    buf[4] = hex[c >> 4];
+    buf[5] = hex[c & 0xF];
+    return 6;
+  }
+}
+
+// Quoted and escaped length of a string
+static size_t measure_str(const JsonStyle *style, const JsonStr *str) {
+  const char *cur = str->start;
+  const char *end = cur + str->len;
+  size_t len = str->len + 2;
+  if (style->raw_strings || str->escaped)
+    return len;
+  while ((cur = find_escape(cur, end)) != end)
+    len += escape_len((unsigned char)*cur++) - 1;
+  return len;
+}
+
+// Through a sink writer the string may have to be split between flushes
+static void serialize_str_sink(JsonWriter *w, const char *cur,
+                               const char *end, bool verbatim) {
+  writer_append(w, "\"", 1);
+  for (;;) {
+    const char *special = verbatim ? end : find_escape(cur, end);
+    writer_append(w, cur, special - cur);
+    if (special == end)
+      break;
+    w->str_len += escape_char(writer_reserve(w, 6), (unsigned char)*special);
+    cur = special + 1;
+  }
+  writer_append(w, "\"", 1);
+}
+
+// Runs without special bytes are found by the vector kernel and copied at
+// once, only the bytes at escape sites are handled one by one. Strings kept
+// escaped by the parser are valid JSON already and are copied as they are.
+static void json_serialize_jsonstr(JsonWriter *w, const JsonStr *json_str) {
+  const char *cur = json_str->start;
+  const char *end = cur + json_str->len;
+  bool verbatim = w->style->raw_strings || json_str->escaped;
+  if (w->sink != NULL) {
+    serialize_str_sink(w, cur, end, verbatim);
+    return;
+  }
+  char *dst = writer_reserve(w, json_str->len + 2); // + ""
+  *dst++ = '"';
+  if (verbatim) {
+    memcpy(dst, cur, json_str->len);
+    dst += json_str->len;
+  } else {
+    for (;;) {
+      const char *special = find_escape(cur, end);
+      memcpy(dst, cur, special - cur);
+      dst += special - cur;
+      if (special == end)
+        break;
+      // Room for the escape-sequence, the rest and the closing quote
+      w->str_len = dst - w->str;
+      dst = writer_reserve(w, 6 + (end - special));
+      dst += escape_char(dst, (unsigned char)*special);
+      cur = special + 1;
+    }
+  }
+  *dst++ = '"';
+  w->str_len = dst - w->str;
+}
+
+static void serialize_scalar(JsonWriter *w, const JsonVal *val) {
+  switch (val->type) {
+  case JSON_TYPE_STR:
+    json_serialize_jsonstr(w, val->as.str_ptr);
     break;
   case JSON_TYPE_INT:
-    snprintf(internal_buf, sizeof(internal_buf), "%lld", val->as.integer);
-    cstr_append(str, str_len, buf_len, internal_buf);
+    w->str_len += json_format_int(writer_reserve(w, MAX_NUMBER_LEN),
+                                  val->as.integer);
     break;
   case JSON_TYPE_FRC:
-    snprintf(internal_buf, sizeof(internal_buf), "%lf", val->as.fract);
-    cstr_append(str, str_len, buf_len, internal_buf);
+    // JSON has no representation for NaN and infinities
+    if (!isfinite(val->as.fract))
+      cstr_append(w, "null");
+    else
+      w->str_len += json_format_frc(writer_reserve(w, MAX_NUMBER_LEN),
+                                    val->as.fract);
     break;
   case JSON_TYPE_BOL:
-    cstr_append(str, str_len, buf_len, val->as.boolean ? "true" : "false");
+    cstr_append(w, val->as.boolean ? "true" : "false");
+    break;
+  case JSON_TYPE_NUL:
+    cstr_append(w, "null");
     break;
+  case JSON_TYPE_OBJ:
+  case JSON_TYPE_ARR:
+    break; // Handled by the caller
+  }
+}
+
+#define PACKED_BATCH 64
+#define PACKED_SEP_MAX 128
+
+// Elements of a packed array, formatted back to back into room reserved for
+// a whole batch of them. In the pretty style every element but the first is
+// preceded by the same newline and indentation, prepared once in sep.
+static void serialize_packed(JsonWriter *w, const JsonArr *arr) {
+  bool minimal = w->style->minimal;
+  size_t sep_len = minimal ? 0 : 1 + w->indentation_level * w->indentation_len;
+  size_t elem_len = 1 + sep_len + MAX_NUMBER_LEN;
+  // Deeply nested, or more than the buffer of a sink writer (which is never
+  // grown) holds: one element at a time
+  if (sep_len > PACKED_SEP_MAX || (w->sink != NULL && elem_len > w->buf_len)) {
+    for (size_t i = 0; i < arr->len; i++) {
+      if (i > 0)
+        cstr_append(w, minimal ? "," : ",\n");
+      if (!minimal)
+        append_indent_level(w);
+      JsonVal val = json_arr_get(arr, i);
+      serialize_scalar(w, &val);
+    }
+    return;
+  }
+  char sep[PACKED_SEP_MAX];
+  if (!minimal) {
+    sep[0] = '\n';
+    for (size_t i = 0; i < w->indentation_level; i++)
+      memcpy(sep + 1 + i * w->indentation_len, w->style->indentation_str,
+             w->indentation_len);
+    append_indent_level(w);
+  }
+  size_t batch = PACKED_BATCH;
+  if (w->sink != NULL && w->buf_len / elem_len < batch)
+    batch = w->buf_len / elem_len;
+  for (size_t i = 0; i < arr->len;) {
+    size_t end = arr->len - i > batch ? i + batch : arr->len;
+    char *dst = writer_reserve(w, (end - i) * elem_len);
+    if (arr->kind == JSON_ARR_INTS)
+      for (; i < end; i++) {
+        if (i > 0) {
+          *dst++ = ',';
+          memcpy(dst, sep, sep_len);
+          dst += sep_len;
+        }
+        dst += json_format_int(dst, arr->ints[i]);
+      }
+    else
+      for (; i < end; i++) {
+        if (i > 0) {
+          *dst++ = ',';
+          memcpy(dst, sep, sep_len);
+          dst += sep_len;
+        }
+        if (isfinite(arr->fracts[i]))
+          dst += json_format_frc(dst, arr->fracts[i]);
+        else {
+          memcpy(dst, "null", 4);
+          dst += 4;
+        }
+      }
+    w->str_len = dst - w->str;
+  }
+}
+
+// Container being written, next is the index of its next element
+typedef struct {
+  const JsonVal *val;
+  size_t next;
+} SerializeFrame;
+
+// Iterative like the parser: the elements of the innermost container are
+// written in a loop that only leaves it to open a nested one
+static void _json_serialize_val(JsonWriter *w, const JsonVal *val) {
+  if (val->type != JSON_TYPE_OBJ && val->type != JSON_TYPE_ARR) {
+    serialize_scalar(w, val);
+    return;
+  }
+  SerializeFrame local[WALK_LOCAL_DEPTH];
+  SerializeFrame *frames = local;
+  size_t depth = 0, cap = WALK_LOCAL_DEPTH;
+  bool minimal = w->style->minimal;
+open:
+  cstr_append(w, val->type == JSON_TYPE_OBJ ? "{" : "[");
+  if (!minimal) {
+    w->indentation_level += 1;
+    cstr_append(w, "\n");
+  }
+  if (depth == cap)
+    frames = walk_grow(frames, local, &cap, sizeof(SerializeFrame));
+  frames[depth++] = (SerializeFrame){val, 0};
+
+  while (depth > 0) {
+    SerializeFrame *f = &frames[depth - 1];
+    bool is_obj = f->val->type == JSON_TYPE_OBJ;
+    if (is_obj) {
+      const JsonObj *obj = f->val->as.obj_ptr;
+      for (size_t i = f->next; i < obj->len; i++) {
+        if (i > 0)
+          cstr_append(w, minimal ? "," : ",\n");
+        if (!minimal)
+          append_indent_level(w);
+        json_serialize_jsonstr(w, &obj->pairs[i].key);
+        cstr_append(w, minimal ? ":" : ": ");
+        val = &obj->pairs[i].value;
+        if (val->type == JSON_TYPE_OBJ || val->type == JSON_TYPE_ARR) {
+          f->next = i + 1;
+          goto open;
+        }
+        serialize_scalar(w, val);
+      }
+    } else if (f->val->as.arr_ptr->kind != JSON_ARR_VALUES)
+      serialize_packed(w, f->val->as.arr_ptr);
+    else {
+      const JsonArr *arr = f->val->as.arr_ptr;
+      for (size_t i = f->next; i < arr->len; i++) {
+        if (i > 0)
+          cstr_append(w, minimal ? "," : ",\n");
+        if (!minimal)
+          append_indent_level(w);
+        val = &arr->values[i];
+        if (val->type == JSON_TYPE_OBJ || val->type == JSON_TYPE_ARR) {
+          f->next = i + 1;
+          goto open;
+        }
+        serialize_scalar(w, val);
+      }
+    }
+    if (!minimal) {
+      w->indentation_level -= 1;
+      cstr_append(w, "\n");
+      append_indent_level(w);
+    }
+    cstr_append(w, is_obj ? "}" : "]");
+    depth--;
+  }
+  if (frames != local)
+    free(frames);
+}
+
+// Same as the length json_format_int produces, without formatting
+static size_t measure_int(long long value) {
+  uint64_t u = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+  size_t len = value < 0 ? 2 : 1;
+  for (; u >= 10000; u /= 10000)
+    len += 4;
+  return len + (u >= 10) + (u >= 100) + (u >= 1000);
+}
+
+// Brackets, separators and indentation around n elements at the given
+// nesting level
+static size_t measure_container(const JsonStyle *style, size_t indent_len,
+                                size_t level, size_t n) {
+  if (style->minimal)
+    return 2 + (n > 0 ? n - 1 : 0);
+  return 4 + n * (level + 1) * indent_len +
+         (n > 0 ? 2 * (n - 1) : 0) + level * indent_len;
+}
+
+// With exact false fractional numbers are not formatted but counted at the
+// longest length any of them can have
+static size_t measure_scalar(const JsonVal *val, const JsonStyle *style,
+                             bool exact) {
+  char buf[MAX_NUMBER_LEN];
+  switch (val->type) {
+  case JSON_TYPE_STR:
+    return measure_str(style, val->as.str_ptr);
+  case JSON_TYPE_INT:
+    return measure_int(val->as.integer);
+  case JSON_TYPE_FRC:
+    // Only formatting tells the length of the shortest representation
+    if (!isfinite(val->as.fract))
+      return 4;
+    return exact ? json_format_frc(buf, val->as.fract) : MAX_NUMBER_LEN;
+  case JSON_TYPE_BOL:
+    return val->as.boolean ? 4 : 5;
   case JSON_TYPE_NUL:
-    cstr_append(str, str_len, buf_len, "null");
+    return 4;
+  case JSON_TYPE_OBJ:
+  case JSON_TYPE_ARR:
     break;
   }
+  return 0;
+}
+
+static size_t measure_packed(const JsonArr *arr, bool exact) {
+  char buf[MAX_NUMBER_LEN];
+  size_t len = 0;
+  if (arr->kind == JSON_ARR_INTS)
+    for (size_t i = 0; i < arr->len; i++)
+      len += measure_int(arr->ints[i]);
+  else if (!exact)
+    len = arr->len * MAX_NUMBER_LEN;
+  else
+    for (size_t i = 0; i < arr->len; i++)
+      len += isfinite(arr->fracts[i]) ? json_format_frc(buf, arr->fracts[i])
+                                      : 4;
+  return len;
+}
+
+static size_t container_len(const JsonVal *val) {
+  return val->type == JSON_TYPE_OBJ ? val->as.obj_ptr->len
+                                    : val->as.arr_ptr->len;
+}
+
+// Walks the tree in the order _json_serialize_val writes it
+static size_t measure_val(const JsonVal *val, const JsonStyle *style,
+                          size_t indent_len, size_t level, bool exact) {
+  if (val->type != JSON_TYPE_OBJ && val->type != JSON_TYPE_ARR)
+    return measure_scalar(val, style, exact);
+  SerializeFrame local[WALK_LOCAL_DEPTH];
+  SerializeFrame *frames = local;
+  size_t depth = 0, cap = WALK_LOCAL_DEPTH;
+  size_t len =
+      measure_container(style, indent_len, level, container_len(val));
+  frames[depth++] = (SerializeFrame){val, 0};
+  while (depth > 0) {
+    SerializeFrame *f = &frames[depth - 1];
+    if (f->val->type == JSON_TYPE_ARR &&
+        f->val->as.arr_ptr->kind != JSON_ARR_VALUES) {
+      len += measure_packed(f->val->as.arr_ptr, exact);
+      depth--;
+      continue;
+    }
+    if (f->next == container_len(f->val)) {
+      depth--;
+      continue;
+    }
+    const JsonVal *child;
+    if (f->val->type == JSON_TYPE_OBJ) {
+      const JsonPair *pair = &f->val->as.obj_ptr->pairs[f->next];
+      len += measure_str(style, &pair->key) + (style->minimal ? 1 : 2);
+      child = &pair->value;
+    } else
+      child = &f->val->as.arr_ptr->values[f->next];
+    f->next++;
+    if (child->type != JSON_TYPE_OBJ && child->type != JSON_TYPE_ARR) {
+      len += measure_scalar(child, style, exact);
+      continue;
+    }
+    len += measure_container(style, indent_len, level + depth,
+                             container_len(child));
+    if (depth == cap)
+      frames = walk_grow(frames, local, &cap, sizeof(SerializeFrame));
+    frames[depth++] = (SerializeFrame){child, 0};
+  }
+  if (frames != local)
+    free(frames);
+  return len;
+}
+
+size_t json_serialized_size(const JsonVal *val, const JsonStyle *style) {
+  return measure_val(val, style, strlen(style->indentation_str),
+                     style->indentation_level, true);
+}
+
+size_t json_serialized_size_bound(const JsonVal *val,
+                                  const JsonStyle *style) {
+  return measure_val(val, style, strlen(style->indentation_str),
+                     style->indentation_level, false);
+}
+
+size_t json_serialize_into(const JsonVal *val, const JsonStyle *style,
+                           char *buf) {
+  JsonWriter w;
+  json_writer_init(&w, style);
+  // The buffer is known to be large enough, so it never has to grow
+  w.str = buf;
+  w.buf_len = SIZE_MAX;
+  JsonStats *stats = STATS_CURRENT();
+  uint64_t start = stats_start(stats);
+  _json_serialize_val(&w, val);
+  buf[w.str_len] = '\0';
+  STATS_STOP(stats, serialize_ns, start);
+  return w.str_len;
+}
+
+void json_writer_init(JsonWriter *w, const JsonStyle *style) {
+  w->str = NULL;
+  w->str_len = 0;
+  w->buf_len = 0;
+  w->realloc_increment = INITIAL_REALLOC_INCREMENT;
+  w->style = style;
+  w->indentation_level = style->indentation_level;
+  w->indentation_len = strlen(style->indentation_str);
+  w->sink = NULL;
+  w->sink_ctx = NULL;
+  w->sink_ok = true;
+  w->alloc = NULL;
+}
+
+void json_writer_init_sink(JsonWriter *w, const JsonStyle *style,
+                           JsonSinkFn sink, void *ctx, size_t buf_size) {
+  json_writer_init(w, style);
+  if (buf_size == 0)
+    buf_size = JSON_WRITER_SINK_BUF_SIZE;
+  else if (buf_size < WRITER_MIN_SINK_BUF_SIZE)
+    buf_size = WRITER_MIN_SINK_BUF_SIZE;
+  w->str = malloc(buf_size);
+  w->buf_len = buf_size;
+  w->sink = sink;
+  w->sink_ctx = ctx;
+}
+
+static bool fd_sink(void *ctx, const char *data, size_t len) {
+#ifdef JSON_MMAP
+  int fd = (int)(intptr_t)ctx;
+  while (len > 0) {
+    ssize_t written = write(fd, data, len);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    len -= (size_t)written;
+  }
+  return true;
+#else
+  (void)ctx;
+  (void)data;
+  (void)len;
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+static bool file_sink(void *ctx, const char *data, size_t len) {
+  return fwrite(data, 1, len, (FILE *)ctx) == len;
+}
+
+void json_writer_init_fd(JsonWriter *w, const JsonStyle *style, int fd) {
+  json_writer_init_sink(w, style, fd_sink, (void *)(intptr_t)fd, 0);
+}
+
+void json_writer_init_file(JsonWriter *w, const JsonStyle *style,
+                           FILE *file) {
+  json_writer_init_sink(w, style, file_sink, file, 0);
+}
+
+bool json_writer_flush(JsonWriter *w) {
+  if (w->sink != NULL)
+    writer_flush_buf(w);
+  return w->sink_ok;
+}
+
+void json_writer_set_allocator(JsonWriter *w, const JsonAllocator *alloc) {
+  if (w->str != NULL) { // Buffer of a sink writer
+    char *buf = mem_alloc(alloc, w->buf_len);
+    mem_free(w->alloc, w->str, w->buf_len);
+    w->str = buf;
+  }
+  w->alloc = alloc;
+}
+
+void json_writer_reset(JsonWriter *w) {
+  w->str_len = 0;
+  w->indentation_level = w->style->indentation_level;
+}
+
+void json_writer_free(JsonWriter *w) {
+  mem_free(w->alloc, w->str, w->buf_len);
+  w->str = NULL;
+  w->str_len = 0;
+  w->buf_len = 0;
+}
+
+void json_write_val(JsonWriter *w, const JsonVal *val) {
+  JsonStats *stats = STATS_CURRENT();
+  uint64_t start = stats_start(stats);
+  _json_serialize_val(w, val);
+  writer_terminate(w);
+  STATS_STOP(stats, serialize_ns, start);
 }
 
 void json_serialize_val(JsonVal *val, char **str, size_t *str_len,
                         size_t *buf_len, JsonStyle *style) {
-  size_t initial_realloc_increment = realloc_increment;
-  _json_serialize_val(val, str, str_len, buf_len, style);
-  realloc_increment = initial_realloc_increment;
+  JsonWriter w;
+  json_writer_init(&w, style);
+  w.str = *str;
+  w.str_len = *str_len;
+  w.buf_len = *buf_len;
+  json_write_val(&w, val);
+  *str = w.str;
+  *str_len = w.str_len;
+  *buf_len = w.buf_len;
+}
+
+// One pass over the words, without recursion
+void json_tape_write(JsonWriter *w, const JsonTape *tape, size_t ref) {
+  const uint64_t *words = tape->words;
+  bool minimal = w->style->minimal;
+  NestStack nest;
+  nest_init(&nest);
+  bool in_obj = false;    // Kind of the innermost open container
+  bool first = true;      // No separator before the first element
+  bool after_key = false; // Neither before a value of a pair
+  size_t end = json_tape_next(tape, ref);
+  for (size_t i = ref; i < end;) {
+    uint64_t word = words[i];
+    unsigned tag = tape_tag(word);
+    if (tag == TAPE_END) {
+      if (!minimal) {
+        w->indentation_level -= 1;
+        cstr_append(w, "\n");
+        append_indent_level(w);
+      }
+      cstr_append(w, in_obj ? "}" : "]");
+      nest.depth--;
+      in_obj = nest.depth > 0 && nest.is_obj[nest.depth - 1];
+      first = false; // Even if the container was empty
+      i++;
+      continue;
+    }
+
+    bool is_key = in_obj && !after_key;
+    if (after_key)
+      after_key = false;
+    else if (nest.depth > 0) {
+      if (!first)
+        cstr_append(w, minimal ? "," : ",\n");
+      if (!minimal)
+        append_indent_level(w);
+    }
+    first = false;
+
+    switch (tag) {
+    case JSON_TYPE_OBJ:
+    case JSON_TYPE_ARR:
+      in_obj = tag == JSON_TYPE_OBJ;
+      cstr_append(w, in_obj ? "{" : "[");
+      if (!minimal) {
+        w->indentation_level += 1;
+        cstr_append(w, "\n");
+      }
+      nest_push(&nest, in_obj);
+      first = true;
+      i++;
+      break;
+    case JSON_TYPE_STR: {
+      JsonStr str = {.start = (const char *)&words[i + 1],
+                     .len = (size_t)(word & TAPE_PAYLOAD_MASK)};
+      json_serialize_jsonstr(w, &str);
+      if (is_key) {
+        cstr_append(w, minimal ? ":" : ": ");
+        after_key = true;
+      }
+      i += 1 + (str.len + 8) / 8;
+      break;
+    }
+    case JSON_TYPE_INT:
+      w->str_len += json_format_int(writer_reserve(w, MAX_NUMBER_LEN),
+                                    (long long)words[i + 1]);
+      i += 2;
+      break;
+    case JSON_TYPE_FRC: {
+      double fract;
+      memcpy(&fract, &words[i + 1], sizeof(double));
+      if (!isfinite(fract))
+        cstr_append(w, "null");
+      else
+        w->str_len +=
+            json_format_frc(writer_reserve(w, MAX_NUMBER_LEN), fract);
+      i += 2;
+      break;
+    }
+    case JSON_TYPE_BOL:
+      cstr_append(w, (word & TAPE_PAYLOAD_MASK) != 0 ? "true" : "false");
+      i++;
+      break;
+    default: // JSON_TYPE_NUL
+      cstr_append(w, "null");
+      i++;
+      break;
+    }
+  }
+  nest_free(&nest);
+  writer_terminate(w);
 }
 
 bool json_str_needs_encoding(const char *str, size_t *res_buf_size) {
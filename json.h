@@ -1,6 +1,8 @@
 #pragma once
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 typedef enum {
   JSON_TYPE_OBJ,
@@ -17,11 +19,18 @@ typedef struct JsonObj JsonObj;
 typedef struct JsonArr JsonArr;
 typedef struct JsonVal JsonVal;
 typedef struct JsonPair JsonPair;
+typedef struct JsonObjIndex JsonObjIndex;
+typedef struct JsonArena JsonArena;
+typedef struct JsonAllocator JsonAllocator;
+typedef struct JsonInternTable JsonInternTable;
 
 struct JsonStr {
   const char *start;
   size_t len;
   bool needs_dealloc;
+  // start/len is the undecoded text between the quotes, as kept by
+  // JSON_PARSE_LAZY_STRINGS. Strings built by hand must set it to false.
+  bool escaped;
 };
 
 struct JsonVal {
@@ -44,24 +53,430 @@ struct JsonPair {
 struct JsonObj {
   JsonPair *pairs;
   size_t len;
+  // Hash index over the keys, NULL until built. Objects assembled by hand
+  // must start with index, arena and alloc set to NULL.
+  JsonObjIndex *index;
+  JsonArena *arena; // Document arena the object lives in, NULL for the heap
+  const JsonAllocator *alloc; // Of the index of a heap object, NULL: malloc
 };
 
+// Storage of the elements of an array. Only JSON_PARSE_PACK_NUMBERS produces
+// the packed kinds, arrays built by hand must use JSON_ARR_VALUES.
+typedef enum {
+  JSON_ARR_VALUES, // values
+  JSON_ARR_INTS,   // ints, all elements are JSON_TYPE_INT
+  JSON_ARR_FRCS,   // fracts, all elements are JSON_TYPE_FRC
+} JsonArrKind;
+
 struct JsonArr {
-  JsonVal *values;
+  union {
+    JsonVal *values;
+    long long *ints;
+    double *fracts;
+  };
   size_t len;
+  JsonArrKind kind;
+};
+
+// Element i < arr->len of an array of any kind
+JsonVal json_arr_get(const JsonArr *arr, size_t i);
+
+// Build the key index of every object with enough keys while parsing,
+// instead of on its first lookup
+#define JSON_PARSE_INDEX_KEYS (1u << 0)
+// Keep string values with escape-sequences undecoded (they are still
+// validated): they point into the input like other strings and are
+// serialized as they are. json_str_unescape decodes one when it is read.
+// Keys are always decoded.
+#define JSON_PARSE_LAZY_STRINGS (1u << 1)
+// Document mode (json_doc_parse, json_doc_parse_file, json_doc_parse_pointer)
+// only: equal keys share one copy of their bytes, so they can be compared by
+// pointer, see json_doc_intern. Parsing stays on the calling thread.
+#define JSON_PARSE_INTERN_KEYS (1u << 2)
+// Document mode only, like JSON_PARSE_INTERN_KEYS: short string values equal
+// to a recently seen one share its JsonStr node (and bytes), so changing one
+// of them changes all. Other parsers ignore both flags.
+#define JSON_PARSE_INTERN_STRINGS (1u << 3)
+// Non-empty arrays of only integers or only fractional numbers are stored
+// packed, 8 bytes per element (see JsonArrKind). Mixed arrays stay JsonVals.
+#define JSON_PARSE_PACK_NUMBERS (1u << 4)
+
+// Nesting limit of json_parse_val, json_sax_parse, json_tape_parse, json_bind
+// and of the options that leave it at 0
+#define JSON_DEFAULT_MAX_DEPTH 1024
+
+// Memory for trees, documents and writers. Every block is released with the
+// size it was allocated or last resized with. resize gets blocks of at least
+// one byte, release may get NULL.
+struct JsonAllocator {
+  void *(*alloc)(void *ctx, size_t size);
+  void *(*resize)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+  void (*release)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+  // The functions may be called from several threads at once. Without it
+  // parsing with this allocator stays on the calling thread.
+  bool thread_safe;
 };
 
+typedef struct {
+  unsigned flags;
+  // A top level array is parsed by up to this many threads, its elements in
+  // parallel. 0 and 1 parse on the calling thread only.
+  unsigned threads;
+  // NULL: malloc. With an allocator that is not thread_safe parsing stays on
+  // the calling thread.
+  const JsonAllocator *alloc;
+  // Objects and arrays nested deeper than this are rejected at their opening
+  // bracket. 0: JSON_DEFAULT_MAX_DEPTH.
+  unsigned max_depth;
+} JsonParseOptions;
+
 bool json_parse_val(JsonVal *res, const char **text);
+// opts may be NULL, then it is json_parse_val
+bool json_parse_val_opts(JsonVal *res, const char **text,
+                         const JsonParseOptions *opts);
 void json_free_val(JsonVal *val);
+// For trees parsed with opts->alloc, whose lazy strings must be decoded by
+// json_str_unescape_alloc with the same allocator
+void json_free_val_alloc(JsonVal *val, const JsonAllocator *alloc);
+
+// Allocator with free lists for blocks of up to JSON_POOL_MAX_SIZE bytes in
+// size classes of 8 (all tree nodes but long pairs/values arrays), carved from
+// large chunks. Larger blocks go to malloc. A pool is thread-safe: every
+// thread allocates from a cache of its own, blocks released on another thread
+// go to the cache of that thread.
+typedef struct JsonPool JsonPool;
+
+#define JSON_POOL_MAX_SIZE 256
+
+JsonPool *json_pool_new(void);
+const JsonAllocator *json_pool_allocator(JsonPool *pool);
+// Releases all chunks at once, small blocks still in use included. Large
+// blocks have to be released before.
+void json_pool_free(JsonPool *pool);
+
+// Counters filled in by the tree parser (json_parse_val, json_parse_val_opts
+// including its worker threads, json_doc_parse and json_doc_parse_file),
+// json_free_val and the serializer (json_write_val, json_serialize_val,
+// json_serialize_into) while attached to the calling thread. They add up
+// over calls until the caller zeroes them. Compiling json.c with
+// JSON_NO_STATS removes the counting, the struct then stays zeroed.
+typedef struct {
+  size_t values[JSON_TYPE_NUL + 1]; // Parsed values by JsonType
+  size_t max_depth;                 // Deepest nesting of objects/arrays
+  size_t plain_str_bytes;   // Keys and strings without escapes (zero-copy)
+  size_t escaped_str_bytes; // Keys and strings with escape-sequences
+  size_t allocs;            // Nodes and decoded strings, heap or arena
+  size_t alloc_bytes;
+  size_t scratch_growths; // Reallocations of the stack collecting pairs/values
+  size_t writer_growths;  // Reallocations of serializer output buffers
+  uint64_t parse_ns;
+  uint64_t free_ns;
+  uint64_t serialize_ns;
+} JsonStats;
+
+// NULL detaches. Returns the previously attached stats.
+JsonStats *json_stats_attach(JsonStats *stats);
+
+typedef struct JsonArenaBlock JsonArenaBlock;
+
+// Bump allocator: memory is handed out from large blocks and released all at
+// once, individual allocations are never freed
+struct JsonArena {
+  JsonArenaBlock *head;
+  size_t next_block_size;
+  const JsonAllocator *alloc; // Of the blocks, NULL for malloc
+};
+
+void *json_arena_alloc(JsonArena *arena, size_t size);
+
+// Parsed tree whose nodes (JsonObj, JsonArr, JsonStr, pairs/values arrays and
+// decoded strings) all live in the document's arena. Such a tree must be
+// released with json_doc_free and never with json_free_val.
+typedef struct {
+  JsonVal root;
+  // Used by json_doc_parse, zeroed by json_doc_init. opts.alloc provides the
+  // arena blocks.
+  JsonParseOptions opts;
+  JsonArena arena;
+  const char *source; // Text loaded by json_doc_parse_file, NUL-terminated
+  size_t source_len;
+  size_t map_len;
+  bool source_mapped;
+  JsonInternTable *intern; // Strings seen so far with JSON_PARSE_INTERN_*
+} JsonDocument;
+
+void json_doc_init(JsonDocument *doc);
+bool json_doc_parse(JsonDocument *doc, const char **text);
+// Memory-maps the file (reads it where mmap is unavailable) and parses it
+// without copying: unescaped strings point into doc->source, which lives
+// until json_doc_free. The file must not be truncated meanwhile. *end is
+// NULL if the file could not be loaded (see errno), otherwise the end of the
+// value or the position of the error in doc->source.
+bool json_doc_parse_file(JsonDocument *doc, const char *path,
+                         const char **end);
+// Only maps the file into doc->source, for json_doc_parse_pointer
+bool json_doc_load_file(JsonDocument *doc, const char *path);
+// Binary snapshot of a tree: its nodes with offsets in place of pointers,
+// plus a key index for every object with many keys. Loading maps the file
+// (privately writable) into doc->source and only relocates the nodes, the
+// result is used like any parsed document. Snapshots are only readable by
+// builds with the same node layout and byte order; they are checked against
+// truncation and foreign files, not against deliberate corruption. On failure
+// nothing stays loaded in doc and errno is set, to EINVAL for an invalid
+// snapshot.
+bool json_snapshot_save(const JsonVal *val, const char *path);
+bool json_doc_load_snapshot(JsonDocument *doc, const char *path);
+
+// JSON Pointer (RFC 6901) lookup in a parsed tree, e.g. "/items/3/price".
+// Keys are matched as by json_value_by_key. Elements of packed arrays have no
+// JsonVal to point to, they are told apart from missing values.
+typedef enum {
+  JSON_POINTER_FOUND,     // *res is the value
+  JSON_POINTER_NOT_FOUND, // Also for invalid pointers, *res is unchanged
+  JSON_POINTER_PACKED,    // *res is the packed array holding the element
+} JsonPointerStatus;
+
+JsonPointerStatus json_pointer_find(JsonVal *root, const char *pointer,
+                                    JsonVal **res);
+// The value at pointer, NULL if there is none and for elements of packed
+// arrays
+JsonVal *json_pointer_get(JsonVal *root, const char *pointer);
+// Copies the value at pointer to *res, elements of packed arrays included.
+// False if there is no such value.
+bool json_pointer_get_val(JsonVal *root, const char *pointer, JsonVal *res);
+// Lazy lookup: parses only the value at pointer in text into doc's arena.
+// Everything off the path is skipped by a scan that only follows brackets and
+// strings, so errors there go unnoticed. NULL if there is no such value or it
+// is malformed.
+JsonVal *json_doc_parse_pointer(JsonDocument *doc, const char *text,
+                                const char *pointer);
+void json_doc_free(JsonDocument *doc);
+// The shared copy of a key of the document, NULL if it has no such key
+const char *json_doc_intern(const JsonDocument *doc, const char *key,
+                            size_t len);
 bool json_decode_str(const char **res, size_t *res_len, const char *src,
                      size_t len);
+// Decodes a string kept escaped by JSON_PARSE_LAZY_STRINGS in place, into
+// arena for document trees (&doc->arena) or the heap (NULL) for trees of
+// json_parse_val. Does nothing for other strings. Like building a key index,
+// this modifies the tree.
+void json_str_unescape(JsonStr *str, JsonArena *arena);
+// Same into alloc, for trees parsed with opts->alloc
+void json_str_unescape_alloc(JsonStr *str, const JsonAllocator *alloc);
+
+// Newline-delimited JSON (JSON Lines): one value per line, blank lines are
+// skipped. Records are parsed by up to opts->threads threads (opts may be
+// NULL), by the calling thread only if opts->alloc is not thread_safe. A
+// record never reads past the end of its line. text[len] must be the
+// terminating NUL.
+typedef struct {
+  JsonVal val;       // The partial tree on error, as with json_parse_val
+  size_t offset;     // Start of the record in text
+  size_t err_offset; // Position of the error in text, if !ok
+  bool ok;
+} JsonNdjsonRecord;
+
+// Collects the records in input order. Returns false if any of them failed,
+// the others are still parsed. Release with json_free_ndjson, or with
+// json_free_ndjson_alloc and the same allocator as opts->alloc.
+bool json_parse_ndjson(const char *text, size_t len,
+                       const JsonParseOptions *opts,
+                       JsonNdjsonRecord **records, size_t *count);
+void json_free_ndjson(JsonNdjsonRecord *records, size_t count);
+void json_free_ndjson_alloc(JsonNdjsonRecord *records, size_t count,
+                            const JsonAllocator *alloc);
+
+// Hands every record to cb as soon as it is parsed, from several threads at
+// once and in no particular order (record->offset gives the order). cb takes
+// over record->val and returning false stops parsing early: the other threads
+// finish the record they are parsing, which may still reach cb.
+typedef bool (*JsonNdjsonCallback)(void *ctx, JsonNdjsonRecord *record);
+bool json_parse_ndjson_cb(const char *text, size_t len,
+                          const JsonParseOptions *opts, JsonNdjsonCallback cb,
+                          void *ctx);
 
+// Callbacks for json_sax_parse. Any of them may be NULL to ignore the event,
+// returning false stops parsing. String and key slices are only valid during
+// the call: they point into the input, or into a decoding buffer for strings
+// with escape-sequences.
+typedef struct {
+  bool (*start_object)(void *ctx);
+  bool (*end_object)(void *ctx);
+  bool (*start_array)(void *ctx);
+  bool (*end_array)(void *ctx);
+  bool (*key)(void *ctx, const char *str, size_t len);
+  bool (*string)(void *ctx, const char *str, size_t len);
+  bool (*integer)(void *ctx, long long value);
+  bool (*fract)(void *ctx, double value);
+  bool (*boolean)(void *ctx, bool value);
+  bool (*null)(void *ctx);
+} JsonSaxHandler;
+
+// Reports the value at *text as events without building a tree. On failure
+// (or when a callback returns false) *text points at the problematic place.
+// Only max_depth of the options is used, opts may be NULL.
+bool json_sax_parse(const char **text, const JsonSaxHandler *handler,
+                    void *ctx);
+bool json_sax_parse_opts(const char **text, const JsonSaxHandler *handler,
+                         void *ctx, const JsonParseOptions *opts);
+
+// Binding: an object is parsed straight into a C struct described by a
+// schema, without building a tree. The C type of a member follows from its
+// field type:
+//   JSON_TYPE_INT  long long
+//   JSON_TYPE_FRC  double, integers are accepted too
+//   JSON_TYPE_BOL  bool
+//   JSON_TYPE_STR  JsonStr, pointing into the input unless it has escapes
+//   JSON_TYPE_OBJ  struct described by schema
+//   JSON_TYPE_ARR  JsonBoundArr of elem_type items (structs described by
+//                  schema for JSON_TYPE_OBJ), arrays of arrays are not
+//                  supported
+typedef struct JsonSchema JsonSchema;
+
+typedef struct {
+  const char *name;
+  size_t name_len;
+  size_t offset;
+  JsonType type;
+  JsonType elem_type;
+  const JsonSchema *schema;
+} JsonField;
+
+struct JsonSchema {
+  size_t size;
+  const JsonField *fields;
+  size_t len;
+};
+
+typedef struct {
+  void *items;
+  size_t len;
+} JsonBoundArr;
+
+// Members named like their keys:
+// typedef struct { long long id; JsonStr name; JsonBoundArr tags; } User;
+// static const JsonField user_fields[] = {
+//     JSON_FIELD(User, id, JSON_TYPE_INT),
+//     JSON_FIELD(User, name, JSON_TYPE_STR),
+//     JSON_FIELD_ARR(User, tags, JSON_TYPE_STR),
+// };
+// static const JsonSchema user_schema = JSON_SCHEMA(User, user_fields);
+#define JSON_FIELD(type, member, json_type)                                    \
+  {#member, sizeof(#member) - 1, offsetof(type, member), json_type,            \
+   JSON_TYPE_NUL, NULL}
+#define JSON_FIELD_OBJ(type, member, member_schema)                            \
+  {#member, sizeof(#member) - 1, offsetof(type, member), JSON_TYPE_OBJ,        \
+   JSON_TYPE_NUL, &(member_schema)}
+#define JSON_FIELD_ARR(type, member, item_type)                                \
+  {#member, sizeof(#member) - 1, offsetof(type, member), JSON_TYPE_ARR,        \
+   item_type, NULL}
+#define JSON_FIELD_OBJ_ARR(type, member, item_schema)                          \
+  {#member, sizeof(#member) - 1, offsetof(type, member), JSON_TYPE_ARR,        \
+   JSON_TYPE_OBJ, &(item_schema)}
+#define JSON_SCHEMA(type, fields)                                              \
+  {sizeof(type), fields, sizeof(fields) / sizeof((fields)[0])}
+
+// Fills *out (zeroed first) from the object at *text. Missing keys and null
+// values leave their members zeroed, unknown keys are skipped (but
+// validated), of repeated keys the last one wins. A value of another type is
+// an error, *text points at it. Double members also take integers too long
+// for long long. Objects and arrays nested deeper than max_depth of the
+// options (possible with a schema that contains itself) are rejected at their
+// opening bracket, the other options are not used and opts may be NULL.
+// Arrays and strings with escape-sequences are allocated in arena, or with
+// malloc if it is NULL: then *out has to be released with json_bind_free,
+// even if binding failed.
+bool json_bind(const char **text, const JsonSchema *schema, void *out,
+               JsonArena *arena);
+bool json_bind_opts(const char **text, const JsonSchema *schema, void *out,
+                    JsonArena *arena, const JsonParseOptions *opts);
+void json_bind_free(const JsonSchema *schema, void *out);
+
+// Alternative representation: the whole document in one contiguous array of
+// words (strings inline), so walking it is sequential memory access instead
+// of chasing pointers. Values are referred to by their index in the tape, the
+// root is at 0. The tape does not reference the input text.
+typedef struct {
+  uint64_t *words;
+  size_t len;
+  size_t cap;
+} JsonTape;
+
+#define JSON_TAPE_NONE SIZE_MAX
+
+// The tape has to be freed even if parsing fails. As with json_sax_parse only
+// max_depth of the options is used.
+bool json_tape_parse(JsonTape *tape, const char **text);
+bool json_tape_parse_opts(JsonTape *tape, const char **text,
+                          const JsonParseOptions *opts);
+void json_tape_free(JsonTape *tape);
+JsonType json_tape_type(const JsonTape *tape, size_t ref);
+// Elements of an object/array, bytes of a string
+size_t json_tape_len(const JsonTape *tape, size_t ref);
+// Children of an object/array are [ref + 1, json_tape_end(ref)), in an object
+// every key is followed by its value:
+// for (size_t it = arr + 1; it != json_tape_end(tape, arr);
+//      it = json_tape_next(tape, it))
+size_t json_tape_end(const JsonTape *tape, size_t ref);
+// The entry after the value at ref, skipping its subtree in O(1)
+size_t json_tape_next(const JsonTape *tape, size_t ref);
+// NUL-terminated, json_tape_len gives the length
+const char *json_tape_str(const JsonTape *tape, size_t ref);
+long long json_tape_int(const JsonTape *tape, size_t ref);
+double json_tape_frc(const JsonTape *tape, size_t ref);
+bool json_tape_bool(const JsonTape *tape, size_t ref);
+// Returns the value ref or JSON_TAPE_NONE
+size_t json_tape_value_by_key(const JsonTape *tape, size_t obj,
+                              const char *key);
+size_t json_tape_value_by_key_len(const JsonTape *tape, size_t obj,
+                                  const char *key, size_t len);
+
+// Incremental parser for input arriving in chunks of any size. Tokens cut by
+// the end of a chunk are kept and resumed with the next one. The chunks are
+// not referenced after json_stream_feed returns: all strings are copied.
+typedef struct JsonStream JsonStream;
+
+typedef enum {
+  JSON_STREAM_NEED_MORE,
+  JSON_STREAM_DONE,  // *res holds the value, the rest of the chunk is unused
+  JSON_STREAM_ERROR, // *res holds the partial tree, as with json_parse_val
+} JsonStreamStatus;
+
+// res receives the parsed value, opts may be NULL
+JsonStream *json_stream_new(JsonVal *res, const JsonParseOptions *opts);
+// Builds into the document arena, the value goes to doc->root
+JsonStream *json_doc_stream_new(JsonDocument *doc);
+JsonStreamStatus json_stream_feed(JsonStream *s, const char *chunk,
+                                  size_t len);
+// Signals the end of input, needed to complete a top level number
+JsonStreamStatus json_stream_finish(JsonStream *s);
+// Bytes consumed so far: the end of the value or the position of an error
+size_t json_stream_offset(const JsonStream *s);
+// An unfinished tree is released too, a finished one stays with the caller
+void json_stream_free(JsonStream *s);
+
+// Objects with many keys get a hash index on their first lookup (unless
+// JSON_PARSE_INDEX_KEYS built it during parsing). Building it modifies the
+// object, so concurrent first lookups on a shared tree need the flag.
 JsonVal *json_value_by_key(JsonObj *obj, const char *to_find);
+JsonVal *json_value_by_key_len(JsonObj *obj, const char *key, size_t len);
+// Lookup by a key from json_doc_intern in an object of that document: small
+// objects compare pointers instead of bytes
+JsonVal *json_value_by_interned_key(JsonObj *obj, const char *key,
+                                    size_t len);
+// Must be called after changing the pairs of an object that has an index
+void json_obj_drop_index(JsonObj *obj);
 
 typedef struct {
   bool minimal;
   size_t indentation_level;
   char *indentation_str;
+  // Write strings verbatim instead of escaping quotes, backslashes and
+  // control characters, for strings already encoded with
+  // json_str_encode_into_buf. Strings are escaped by default, so without it
+  // such strings come out escaped twice (a\"b as a\\\"b).
+  bool raw_strings;
 } JsonStyle;
 
 #define JSON_STYLE_MINIMAL                                                     \
@@ -94,7 +509,67 @@ typedef struct {
 
 void json_serialize_val(JsonVal *val, char **str, size_t *str_len,
                         size_t *buf_len, JsonStyle *style);
+// Exact length of the output of val in the given style, without the NUL.
+// Fractional numbers have to be formatted to be measured.
+size_t json_serialized_size(const JsonVal *val, const JsonStyle *style);
+// Upper bound of the same that counts every fractional number at its longest
+// possible length, cheaper to compute for documents with many of them
+size_t json_serialized_size_bound(const JsonVal *val, const JsonStyle *style);
+// Serializes into buf, which must hold json_serialized_size() (or the bound)
+// + 1 bytes, without any reallocation. Returns the length written before the
+// NUL.
+size_t json_serialize_into(const JsonVal *val, const JsonStyle *style,
+                           char *buf);
+
+// Receives the output of a sink writer piece by piece, returning false
+// reports a write error
+typedef bool (*JsonSinkFn)(void *ctx, const char *data, size_t len);
+
+// Serialization state. Each writer owns its output buffer and growth policy,
+// so any number of writers can be used concurrently. The style is read-only
+// and may be shared between writers.
+typedef struct {
+  char *str;
+  size_t str_len;
+  size_t buf_len;
+  size_t realloc_increment;
+  const JsonStyle *style;
+  size_t indentation_level;
+  size_t indentation_len;
+  JsonSinkFn sink; // NULL for writers that collect the output in str
+  void *sink_ctx;
+  bool sink_ok;
+  const JsonAllocator *alloc; // Of str, NULL for malloc
+} JsonWriter;
+
+#define JSON_WRITER_SINK_BUF_SIZE (64 * 1024)
+
+void json_writer_init(JsonWriter *w, const JsonStyle *style);
+// Sink writers keep at most buf_size bytes (0 for JSON_WRITER_SINK_BUF_SIZE)
+// in a buffer that never grows and hand them to the sink whenever it fills
+// up, so memory use does not depend on the size of the output. The output is
+// not NUL-terminated. json_writer_flush must be called to pass on the rest.
+void json_writer_init_sink(JsonWriter *w, const JsonStyle *style,
+                           JsonSinkFn sink, void *ctx, size_t buf_size);
+// Writes to a file descriptor (retrying partial writes) or a FILE*
+void json_writer_init_fd(JsonWriter *w, const JsonStyle *style, int fd);
+void json_writer_init_file(JsonWriter *w, const JsonStyle *style, FILE *file);
+// Hands the buffered output to the sink. Returns false if any write failed
+// since the writer was initialized, the output after a failure is dropped.
+bool json_writer_flush(JsonWriter *w);
+// Moves the buffer to alloc, for writers that have not written anything yet
+void json_writer_set_allocator(JsonWriter *w, const JsonAllocator *alloc);
+// Drops the output not yet flushed
+void json_writer_reset(JsonWriter *w);
+// Does not flush
+void json_writer_free(JsonWriter *w);
+// Appends val to w->str and keeps it NUL-terminated (passes it to the sink)
+void json_write_val(JsonWriter *w, const JsonVal *val);
+// Same output as json_write_val for the value at ref
+void json_tape_write(JsonWriter *w, const JsonTape *tape, size_t ref);
 
 bool json_str_needs_encoding(const char *str, size_t *res_buf_size);
 
+// The serializer escapes strings itself: output of this is only written as
+// intended with raw_strings set in the style
 void json_str_encode_into_buf(const char *str, char *buf);
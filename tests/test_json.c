@@ -0,0 +1,2494 @@
+// Regression tests, one group of checks per feature.
+//
+// Usage: json_test [group...], all groups without arguments. Nothing here
+// relies on assert, so the tests also check Release builds. Without a build
+// system: cc -std=c11 -I. tests/test_json.c json.c -lm -lpthread
+
+// fileno() is hidden by glibc in strict ISO C modes
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "json.h"
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+static const char *context = ""; // Input of the check, printed on failure
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static bool check(bool ok, const char *expr, const char *file, int line) {
+  if (!ok) {
+    failures++;
+    fprintf(stderr, "%s:%d: CHECK(%s) failed for %.200s\n", file, line, expr,
+            context);
+  }
+  return ok;
+}
+
+// Growing string for generated inputs
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+} Text;
+
+static void text_append(Text *t, const char *data, size_t len) {
+  if (t->len + len + 1 > t->cap) {
+    t->cap = (t->len + len + 1) * 2;
+    t->buf = realloc(t->buf, t->cap);
+  }
+  memcpy(t->buf + t->len, data, len);
+  t->len += len;
+  t->buf[t->len] = '\0';
+}
+
+static void text_printf(Text *t, const char *fmt, long long value) {
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), fmt, value);
+  text_append(t, buf, (size_t)len);
+}
+
+static void text_repeat(Text *t, const char *s, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    text_append(t, s, strlen(s));
+}
+
+static const JsonStyle STYLES[] = {
+    JSON_STYLE_MINIMAL,
+    JSON_STYLE_PRETTY_PRINT_TABS,
+    JSON_STYLE_PRETTY_PRINT_DOUBLESPACES,
+};
+#define STYLE_COUNT (sizeof(STYLES) / sizeof(STYLES[0]))
+
+static char *write_val(const JsonVal *val, const JsonStyle *style) {
+  JsonStyle copy = *style;
+  size_t len = 0, buf_len = 1;
+  char *str = malloc(buf_len);
+  *str = '\0';
+  json_serialize_val((JsonVal *)val, &str, &len, &buf_len, &copy);
+  return str;
+}
+
+// Documents in the form the minimal serializer writes them
+static const char *const ROUNDTRIP_DOCS[] = {
+    "null",
+    "true",
+    "false",
+    "0",
+    "-1",
+    "9223372036854775807",
+    "-9223372036854775808",
+    "1.5",
+    "-0.0",
+    "2.0",
+    "0.1",
+    "1e+300",
+    "1.5e-07",
+    "1.7976931348623157e+308",
+    "2.2250738585072014e-308",
+    "\"\"",
+    "\"plain\"",
+    "\"h\xc3\xa9llo \xe2\x82\xac \xf0\x9f\x98\x80\"",
+    "\"q\\\"b\\\\s/\\n\\t\\r\\b\\f\\u0001\\u001F\"",
+    "{\"k\\\"ey\":\"v\\\\al\",\"\\n\":[\"\\u0000\"]}",
+    "[]",
+    "{}",
+    "[[]]",
+    "[{}]",
+    "[1,2,3]",
+    "[1.5,-2.5,1e+300]",
+    "[1,2.5]",
+    "[null,true,false,\"s\",[1],{\"k\":[2.5]}]",
+    "{\"a\":{\"b\":[{\"c\":null}]},\"d\":[[[\"x\"]]]}",
+    "{\"dup\":1,\"dup\":2}",
+};
+#define ROUNDTRIP_DOC_COUNT (sizeof(ROUNDTRIP_DOCS) / sizeof(ROUNDTRIP_DOCS[0]))
+
+static bool collect(void *ctx, const char *data, size_t len) {
+  text_append(ctx, data, len);
+  return true;
+}
+
+// Every serializer gives expected: the growing writer, the exact size and
+// the bound, serialization into a fixed buffer and sink writers with the
+// smallest and the default buffer
+static void check_output(const JsonVal *val, const JsonStyle *style,
+                         const char *expected) {
+  size_t len = strlen(expected);
+  char *out = write_val(val, style);
+  CHECK(strcmp(out, expected) == 0);
+  free(out);
+  CHECK(json_serialized_size(val, style) == len);
+  size_t bound = json_serialized_size_bound(val, style);
+  CHECK(bound >= len);
+  char *buf = malloc(bound + 1);
+  CHECK(json_serialize_into(val, style, buf) == len &&
+        strcmp(buf, expected) == 0);
+  free(buf);
+  size_t buf_sizes[] = {1, 0};
+  for (size_t i = 0; i < 2; i++) {
+    Text sunk = {0};
+    JsonWriter w;
+    json_writer_init_sink(&w, style, collect, &sunk, buf_sizes[i]);
+    json_write_val(&w, val);
+    CHECK(json_writer_flush(&w));
+    json_writer_free(&w);
+    CHECK(sunk.len == len &&
+          (len == 0 || memcmp(sunk.buf, expected, len) == 0));
+    free(sunk.buf);
+  }
+}
+
+// expected[s] is the output of the tree of doc in STYLES[s]
+static void check_all_styles(const JsonVal *val, char *const *expected) {
+  for (size_t s = 0; s < STYLE_COUNT; s++)
+    check_output(val, &STYLES[s], expected[s]);
+}
+
+// Trees in a document arena serialize like heap trees
+static void test_arena(void) {
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    const char *doc = context = ROUNDTRIP_DOCS[i];
+    const char *text = doc;
+    JsonVal val;
+    if (!CHECK(json_parse_val(&val, &text) && *text == '\0')) {
+      json_free_val(&val);
+      continue;
+    }
+    char *expected[STYLE_COUNT];
+    for (size_t s = 0; s < STYLE_COUNT; s++)
+      expected[s] = write_val(&val, &STYLES[s]);
+    CHECK(strcmp(expected[0], doc) == 0);
+    json_free_val(&val);
+
+    JsonDocument d;
+    json_doc_init(&d);
+    text = doc;
+    CHECK(json_doc_parse(&d, &text) && *text == '\0');
+    check_all_styles(&d.root, expected);
+    json_doc_free(&d);
+    for (size_t s = 0; s < STYLE_COUNT; s++)
+      free(expected[s]);
+  }
+
+  // Allocations are aligned, distinct and larger than a block if asked to
+  context = "json_arena_alloc";
+  JsonDocument d;
+  json_doc_init(&d);
+  char *prev = NULL;
+  for (size_t i = 0; i < 10000; i++) {
+    size_t size = i % 100 == 0 ? 200000 : i % 37 + 1;
+    char *ptr = json_arena_alloc(&d.arena, size);
+    CHECK((uintptr_t)ptr % _Alignof(max_align_t) == 0 && ptr != prev);
+    memset(ptr, (int)i, size);
+    prev = ptr;
+  }
+  json_doc_free(&d);
+
+  // A failed parse leaves a partial tree in the arena
+  context = "{\"a\":[1,2,}";
+  json_doc_init(&d);
+  const char *text = context;
+  CHECK(!json_doc_parse(&d, &text) && *text == '}');
+  json_doc_free(&d);
+}
+
+// The vector scans at every length and alignment around the block sizes:
+// the string ends, escapes and control characters are found wherever they
+// are, and whitespace runs of any length are skipped
+static void test_scan(void) {
+  char buf[256];
+  for (size_t len = 0; len < 100; len++)
+    for (size_t offset = 0; offset < 33; offset++) {
+      char *str = buf + offset;
+      str[0] = '"';
+      for (size_t i = 0; i < len; i++)
+        str[1 + i] = (char)(i % 3 == 0 ? 'a' + i % 26 : 0x80 + i % 64);
+      str[1 + len] = '"';
+      str[2 + len] = '\0';
+      context = str;
+      const char *text = str;
+      JsonVal val;
+      if (CHECK(json_parse_val(&val, &text) && *text == '\0'))
+        CHECK(val.type == JSON_TYPE_STR && val.as.str_ptr->len == len &&
+              memcmp(val.as.str_ptr->start, str + 1, len) == 0);
+      json_free_val(&val);
+
+      // A control character fails where it is, an escape is decoded there
+      for (size_t k = 0; k < len; k += 7) {
+        char saved = str[1 + k];
+        str[1 + k] = '\t';
+        text = str;
+        CHECK(!json_parse_val(&val, &text) && text == str + 1 + k);
+        json_free_val(&val);
+        str[1 + k] = saved;
+
+        char escaped[256];
+        memcpy(escaped, str, 1 + k);
+        memcpy(escaped + 1 + k, "\\n", 2);
+        memcpy(escaped + 3 + k, str + 1 + k, len - k + 2);
+        text = escaped;
+        if (CHECK(json_parse_val(&val, &text) && *text == '\0'))
+          CHECK(val.as.str_ptr->len == len + 1 &&
+                val.as.str_ptr->start[k] == '\n' &&
+                memcmp(val.as.str_ptr->start + k + 1, str + 1 + k, len - k) ==
+                    0);
+        json_free_val(&val);
+      }
+    }
+
+  static const char whitespace[] = " \t\n\r";
+  for (size_t n = 0; n < 70; n++) {
+    char doc[512];
+    size_t pos = 0;
+    const char *tokens[] = {"[", "1", ",", "2", "]"};
+    for (size_t t = 0; t < 5; t++) {
+      for (size_t i = 0; t > 0 && i < n; i++)
+        doc[pos++] = whitespace[(i + t) % 4];
+      doc[pos++] = tokens[t][0];
+    }
+    doc[pos] = '\0';
+    context = doc;
+    const char *text = doc;
+    JsonVal val;
+    CHECK(json_parse_val(&val, &text) && *text == '\0' &&
+          val.type == JSON_TYPE_ARR && val.as.arr_ptr->len == 2);
+    json_free_val(&val);
+  }
+  // Only the four whitespace characters of the specification
+  const char *const bad[] = {"[1,\v2]", "[1,\f2]", "[1,\xa0" "2]"};
+  for (size_t i = 0; i < 3; i++) {
+    context = bad[i];
+    const char *text = bad[i];
+    JsonVal val;
+    CHECK(!json_parse_val(&val, &text) && text == bad[i] + 3);
+    json_free_val(&val);
+  }
+}
+
+static uint64_t rng_state = UINT64_C(0x9E3779B97F4A7C15);
+
+static uint64_t rng_next(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// Number literals read like strtod reads them, bit for bit: correctly
+// rounded, and rejected where strtod reports ERANGE
+static void test_numbers(void) {
+  static char literal[64]; // Static as context keeps pointing to it
+  context = literal;
+  for (int n = 0; n < 200000; n++) {
+    size_t pos = 0;
+    if (rng_next() % 2)
+      literal[pos++] = '-';
+    size_t digits = 1 + rng_next() % 25;
+    literal[pos++] = (char)('1' + rng_next() % 9);
+    for (size_t i = 1; i < digits; i++)
+      literal[pos++] = (char)('0' + rng_next() % 10);
+    bool frc = false;
+    if (rng_next() % 2) {
+      frc = true;
+      literal[pos++] = '.';
+      for (size_t i = 0, count = 1 + rng_next() % 20; i < count; i++)
+        literal[pos++] = (char)('0' + rng_next() % 10);
+    }
+    if (rng_next() % 2) {
+      frc = true;
+      pos += (size_t)snprintf(literal + pos, sizeof(literal) - pos, "e%d",
+                              (int)(rng_next() % 700) - 350);
+    }
+    literal[pos] = '\0';
+
+    errno = 0;
+    double expected = strtod(literal, NULL);
+    bool in_range = errno != ERANGE && isfinite(expected);
+    const char *text = literal;
+    JsonVal val;
+    bool ok = json_parse_val(&val, &text);
+    if (!frc) {
+      long long integer;
+      errno = 0;
+      integer = strtoll(literal, NULL, 10);
+      CHECK(ok == (errno != ERANGE));
+      if (ok)
+        CHECK(val.type == JSON_TYPE_INT && val.as.integer == integer);
+    } else {
+      CHECK(ok == in_range);
+      if (ok)
+        CHECK(*text == '\0' && val.type == JSON_TYPE_FRC &&
+              memcmp(&val.as.fract, &expected, sizeof(double)) == 0);
+    }
+  }
+
+  const char *const exact[] = {"0", "-0", "0.0", "-0.0", "0e-999", "1E+2",
+                               "1e2", "2.5e-3", "9007199254740993",
+                               "0.1", "1.7976931348623157e308",
+                               "2.2250738585072014e-308"};
+  for (size_t i = 0; i < sizeof(exact) / sizeof(exact[0]); i++) {
+    context = exact[i];
+    const char *text = exact[i];
+    JsonVal val;
+    if (CHECK(json_parse_val(&val, &text) && *text == '\0')) {
+      double d = val.type == JSON_TYPE_INT ? (double)val.as.integer
+                                           : val.as.fract;
+      double expected = strtod(exact[i], NULL);
+      CHECK(d == expected && (val.type == JSON_TYPE_INT ||
+                              signbit(d) == signbit(expected)));
+    }
+  }
+
+  const char *const rejected[] = {"01",   "-",     "1.",   "1e",  "1e+",
+                                  ".5",   "+1",    "1.e5", "-01", "1e400",
+                                  "-1e400", "5e-324", "99999999999999999999"};
+  for (size_t i = 0; i < sizeof(rejected) / sizeof(rejected[0]); i++) {
+    context = rejected[i];
+    const char *text = rejected[i];
+    JsonVal val;
+    bool ok = json_parse_val(&val, &text);
+    CHECK(!ok || *text != '\0');
+    json_free_val(&val);
+  }
+}
+
+// Significant digits of a formatted double
+static int significant_digits(const char *text) {
+  int count = 0, zeros = 0;
+  bool leading = true;
+  for (; *text != '\0' && *text != 'e'; text++) {
+    if (*text < '0' || *text > '9' || (leading && *text == '0'))
+      continue;
+    leading = false;
+    if (*text == '0') {
+      zeros++;
+    } else {
+      count += zeros + 1;
+      zeros = 0;
+    }
+  }
+  return count > 0 ? count : 1;
+}
+
+// Fewest digits of printf's correctly rounded forms that read back
+static int printf_shortest(double value) {
+  char buf[32];
+  for (int prec = 1; prec < 17; prec++) {
+    snprintf(buf, sizeof(buf), "%.*e", prec - 1, value);
+    if (strtod(buf, NULL) == value)
+      return prec;
+  }
+  return 17;
+}
+
+// Formatted numbers read back as the same value and are no longer than
+// needed: every normal double (subnormals are rejected by the parser) and
+// every integer
+static void test_format(void) {
+  context = "random numbers";
+  for (int i = 0; i < 200000; i++) {
+    uint64_t bits = rng_next();
+    JsonVal val = {.type = JSON_TYPE_FRC};
+    memcpy(&val.as.fract, &bits, sizeof(bits));
+    if (i % 4 == 0) // Also values of everyday magnitudes
+      val.as.fract = (double)(int64_t)bits / (double)(rng_next() | 1);
+    if (!isfinite(val.as.fract) ||
+        (val.as.fract != 0 && fabs(val.as.fract) < DBL_MIN))
+      continue;
+    char *out = write_val(&val, &STYLES[0]);
+    const char *text = out;
+    JsonVal back;
+    if (!CHECK(json_parse_val(&back, &text) && *text == '\0' &&
+               back.type == JSON_TYPE_FRC &&
+               memcmp(&back.as.fract, &val.as.fract, sizeof(double)) == 0 &&
+               significant_digits(out) <= printf_shortest(val.as.fract)))
+      fprintf(stderr, "  %.17g written as %s\n", val.as.fract, out);
+    free(out);
+
+    val.type = JSON_TYPE_INT;
+    val.as.integer = (long long)rng_next();
+    out = write_val(&val, &STYLES[0]);
+    text = out;
+    CHECK(json_parse_val(&back, &text) && *text == '\0' &&
+          back.type == JSON_TYPE_INT && back.as.integer == val.as.integer);
+    free(out);
+  }
+
+  // Integral values keep a fraction, so they read back as doubles; JSON has
+  // no NaN or infinities
+  const struct {
+    double value;
+    const char *text;
+  } forms[] = {
+      {2, "2.0"},         {-0.0, "-0.0"},      {1e20, "1e+20"},
+      {123456.0, "123456.0"}, {0.001, "0.001"}, {1e-7, "1e-07"},
+      {NAN, "null"},      {INFINITY, "null"}, {-INFINITY, "null"},
+      // Grisu2 gave 5.6319500000000003e+20, the second one takes the
+      // fallback of Grisu3
+      {5.63195e20, "5.63195e+20"}, {1.6543612251060553e-24,
+                                    "1.6543612251060553e-24"},
+  };
+  for (size_t i = 0; i < sizeof(forms) / sizeof(forms[0]); i++) {
+    context = forms[i].text;
+    JsonVal val = {.type = JSON_TYPE_FRC, .as.fract = forms[i].value};
+    char *out = write_val(&val, &STYLES[0]);
+    CHECK(strcmp(out, forms[i].text) == 0);
+    free(out);
+  }
+}
+
+// A writer gives what json_serialize_val gives, in every style and after reset
+static void test_writer(void) {
+  JsonWriter w;
+  for (size_t s = 0; s < STYLE_COUNT; s++) {
+    json_writer_init(&w, &STYLES[s]);
+    for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+      context = ROUNDTRIP_DOCS[i];
+      const char *text = ROUNDTRIP_DOCS[i];
+      JsonVal val;
+      if (!CHECK(json_parse_val(&val, &text)))
+        continue;
+      char *expected = write_val(&val, &STYLES[s]);
+      json_writer_reset(&w);
+      json_write_val(&w, &val);
+      CHECK(w.str_len == strlen(expected) && strcmp(w.str, expected) == 0);
+      json_free_val(&val);
+      free(expected);
+    }
+    json_writer_free(&w);
+  }
+
+  // Without a reset values are appended
+  context = "append";
+  json_writer_init(&w, &STYLES[0]);
+  JsonVal one = {.type = JSON_TYPE_INT, .as.integer = 1};
+  json_write_val(&w, &one);
+  json_write_val(&w, &one);
+  CHECK(strcmp(w.str, "11") == 0);
+  json_writer_free(&w);
+}
+
+#define WRITER_THREADS 4
+
+static void *write_docs(void *arg) {
+  const JsonStyle *style = arg;
+  JsonWriter w;
+  json_writer_init(&w, style);
+  for (int round = 0; round < 200; round++) {
+    for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+      const char *text = ROUNDTRIP_DOCS[i];
+      JsonVal val;
+      if (!json_parse_val(&val, &text))
+        return "parse";
+      json_writer_reset(&w);
+      json_write_val(&w, &val);
+      json_free_val(&val);
+      if (style->minimal && strcmp(w.str, ROUNDTRIP_DOCS[i]) != 0)
+        return "output";
+    }
+  }
+  json_writer_free(&w);
+  return NULL;
+}
+
+// Writers share no state, so threads with different styles can run at once
+static void test_writer_threads(void) {
+  context = "threads";
+  pthread_t threads[WRITER_THREADS];
+  for (size_t i = 0; i < WRITER_THREADS; i++)
+    CHECK(pthread_create(&threads[i], NULL, write_docs,
+                         (void *)&STYLES[i % STYLE_COUNT]) == 0);
+  for (size_t i = 0; i < WRITER_THREADS; i++) {
+    void *err;
+    CHECK(pthread_join(threads[i], &err) == 0 && err == NULL);
+  }
+}
+
+// {"key0":0,"key1":7,...} with n keys and a duplicate of key0 at the end
+static char *keys_doc(long long n) {
+  Text t = {0};
+  text_append(&t, "{", 1);
+  for (long long i = 0; i < n; i++) {
+    text_printf(&t, i > 0 ? ",\"key%lld\":" : "\"key%lld\":", i);
+    text_printf(&t, "%lld", i * 7);
+  }
+  text_append(&t, n > 0 ? ",\"key0\":-1}" : "}", n > 0 ? 12 : 1);
+  return t.buf;
+}
+
+static void check_keys(JsonObj *obj, long long n) {
+  char key[32];
+  for (long long i = 0; i < n; i++) {
+    snprintf(key, sizeof(key), "key%lld", i);
+    JsonVal *val = json_value_by_key(obj, key);
+    CHECK(val != NULL && val->type == JSON_TYPE_INT &&
+          val->as.integer == i * 7); // The first of duplicates wins
+  }
+  CHECK(json_value_by_key(obj, "missing") == NULL);
+  CHECK(json_value_by_key_len(obj, "key", 3) == NULL);
+  CHECK(n == 0 || json_value_by_key_len(obj, "key0 and more", 4) != NULL);
+}
+
+// Lookups through the index agree with the linear scan, built during parsing
+// or on the first lookup, in trees and documents
+static void test_index(void) {
+  for (long long n = 0; n <= 100; n++) {
+    char *doc = keys_doc(n);
+    context = doc;
+    for (unsigned flags = 0; flags <= JSON_PARSE_INDEX_KEYS;
+         flags += JSON_PARSE_INDEX_KEYS) {
+      // No options are the defaults
+      JsonParseOptions opts = {.flags = flags};
+      const char *text = doc;
+      JsonVal val;
+      if (!CHECK(json_parse_val_opts(&val, &text, flags != 0 ? &opts : NULL) &&
+                 *text == '\0'))
+        continue;
+      JsonObj *obj = val.as.obj_ptr;
+      CHECK(obj->len == (size_t)(n > 0 ? n + 1 : 0));
+      CHECK(n >= 4 || obj->index == NULL);
+      CHECK(n < 64 || flags == 0 || obj->index != NULL);
+      check_keys(obj, n);
+      CHECK(n < 64 || obj->index != NULL);
+
+      // The index is rebuilt after the pairs change
+      if (n > 0) {
+        obj->pairs[0].key.len = 3; // "key0" -> "key"
+        json_obj_drop_index(obj);
+        CHECK(obj->index == NULL);
+        JsonVal *renamed = json_value_by_key(obj, "key");
+        CHECK(renamed != NULL && renamed->as.integer == 0);
+        JsonVal *dup = json_value_by_key(obj, "key0");
+        CHECK(dup != NULL && dup->as.integer == -1);
+        obj->pairs[0].key.len = 4;
+      }
+      json_free_val(&val);
+
+      JsonDocument d;
+      json_doc_init(&d);
+      d.opts = opts;
+      text = doc;
+      if (CHECK(json_doc_parse(&d, &text)))
+        check_keys(d.root.as.obj_ptr, n);
+      json_doc_free(&d);
+    }
+    free(doc);
+  }
+}
+
+// Invalid documents, the first BAD_STRUCTURE_COUNT with misplaced tokens and
+// the rest with malformed ones
+static const char *const BAD_DOCS[] = {
+    "[1,2,}", "{\"a\" 1}", "\"ab\x01\"", "{\"a\":[1,{}]]",
+    "[tru]",  "01",       "[1.]",       "\"\\q\"",
+};
+#define BAD_DOC_COUNT (sizeof(BAD_DOCS) / sizeof(BAD_DOCS[0]))
+#define BAD_STRUCTURE_COUNT 4
+
+// Feeds text in chunks of chunk bytes and finishes the stream at the end
+static JsonStreamStatus feed_chunks(JsonStream *stream, const char *text,
+                                    size_t chunk) {
+  size_t len = strlen(text);
+  JsonStreamStatus status = JSON_STREAM_NEED_MORE;
+  for (size_t i = 0; i < len && status == JSON_STREAM_NEED_MORE; i += chunk)
+    status = json_stream_feed(stream, text + i,
+                              len - i < chunk ? len - i : chunk);
+  return status == JSON_STREAM_NEED_MORE ? json_stream_finish(stream)
+                                         : status;
+}
+
+// Any split of the input gives the tree json_parse_val gives and finds the
+// same errors
+static void test_stream(void) {
+  static const size_t chunks[] = {1, 2, 3, 7, 64};
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    const char *doc = ROUNDTRIP_DOCS[i];
+    context = doc;
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+      JsonVal val;
+      JsonStream *stream = json_stream_new(&val, NULL);
+      if (CHECK(feed_chunks(stream, doc, chunks[c]) == JSON_STREAM_DONE) &&
+          CHECK(json_stream_offset(stream) == strlen(doc))) {
+        char *out = write_val(&val, &STYLES[0]);
+        CHECK(strcmp(out, doc) == 0);
+        free(out);
+        json_free_val(&val);
+      }
+      json_stream_free(stream);
+
+      JsonDocument d;
+      json_doc_init(&d);
+      stream = json_doc_stream_new(&d);
+      if (CHECK(feed_chunks(stream, doc, chunks[c]) == JSON_STREAM_DONE)) {
+        char *out = write_val(&d.root, &STYLES[0]);
+        CHECK(strcmp(out, doc) == 0);
+        free(out);
+      }
+      json_stream_free(stream);
+      json_doc_free(&d);
+    }
+  }
+
+  // The rest of the chunk after a value is left alone
+  context = "trailing";
+  JsonVal val;
+  JsonStream *stream = json_stream_new(&val, NULL);
+  CHECK(json_stream_feed(stream, "[1] [2]", 7) == JSON_STREAM_DONE &&
+        json_stream_offset(stream) == 3);
+  json_stream_free(stream);
+  json_free_val(&val);
+
+  // Structural errors are reported where json_parse_val stops, bad tokens
+  // after the bytes the token was read from
+  for (size_t i = 0; i < BAD_DOC_COUNT; i++) {
+    context = BAD_DOCS[i];
+    const char *text = BAD_DOCS[i];
+    JsonVal tree;
+    CHECK(!json_parse_val(&tree, &text));
+    json_free_val(&tree);
+    size_t tree_pos = (size_t)(text - BAD_DOCS[i]);
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+      stream = json_stream_new(&val, NULL);
+      CHECK(feed_chunks(stream, BAD_DOCS[i], chunks[c]) == JSON_STREAM_ERROR);
+      size_t offset = json_stream_offset(stream);
+      CHECK(i < BAD_STRUCTURE_COUNT
+                ? offset == tree_pos
+                : offset >= tree_pos && offset <= strlen(BAD_DOCS[i]));
+      json_stream_free(stream);
+      json_free_val(&val); // The partial tree
+    }
+  }
+}
+
+// Rebuilds minimal JSON text from SAX events
+typedef struct {
+  Text out;
+  bool has_items[64]; // Per open container: a comma goes before the next item
+  size_t depth;
+  bool after_key;
+  size_t events;
+  size_t stop_at; // Event whose callback returns false, 0 for none
+} SaxText;
+
+static bool sax_item(SaxText *st, const JsonVal *scalar) {
+  if (st->after_key)
+    st->after_key = false;
+  else if (st->depth > 0 && st->has_items[st->depth - 1])
+    text_append(&st->out, ",", 1);
+  if (st->depth > 0)
+    st->has_items[st->depth - 1] = true;
+  if (scalar != NULL) {
+    char *str = write_val(scalar, &STYLES[0]);
+    text_append(&st->out, str, strlen(str));
+    free(str);
+  }
+  return ++st->events != st->stop_at;
+}
+
+static bool sax_open(SaxText *st, const char *bracket) {
+  bool go_on = sax_item(st, NULL);
+  text_append(&st->out, bracket, 1);
+  st->has_items[st->depth++] = false;
+  return go_on;
+}
+
+static bool sax_close(SaxText *st, const char *bracket) {
+  text_append(&st->out, bracket, 1);
+  st->depth--;
+  return ++st->events != st->stop_at;
+}
+
+static bool sax_start_object(void *ctx) { return sax_open(ctx, "{"); }
+static bool sax_end_object(void *ctx) { return sax_close(ctx, "}"); }
+static bool sax_start_array(void *ctx) { return sax_open(ctx, "["); }
+static bool sax_end_array(void *ctx) { return sax_close(ctx, "]"); }
+
+static bool sax_string(void *ctx, const char *str, size_t len) {
+  JsonStr s = {.start = str, .len = len};
+  JsonVal val = {.type = JSON_TYPE_STR, .as.str_ptr = &s};
+  return sax_item(ctx, &val);
+}
+
+static bool sax_key(void *ctx, const char *str, size_t len) {
+  SaxText *st = ctx;
+  bool go_on = sax_string(ctx, str, len);
+  text_append(&st->out, ":", 1);
+  st->after_key = true;
+  return go_on;
+}
+
+static bool sax_integer(void *ctx, long long value) {
+  JsonVal val = {.type = JSON_TYPE_INT, .as.integer = value};
+  return sax_item(ctx, &val);
+}
+
+static bool sax_fract(void *ctx, double value) {
+  JsonVal val = {.type = JSON_TYPE_FRC, .as.fract = value};
+  return sax_item(ctx, &val);
+}
+
+static bool sax_boolean(void *ctx, bool value) {
+  JsonVal val = {.type = JSON_TYPE_BOL, .as.boolean = value};
+  return sax_item(ctx, &val);
+}
+
+static bool sax_null(void *ctx) {
+  JsonVal val = {.type = JSON_TYPE_NUL};
+  return sax_item(ctx, &val);
+}
+
+static const JsonSaxHandler SAX_TEXT = {
+    .start_object = sax_start_object,
+    .end_object = sax_end_object,
+    .start_array = sax_start_array,
+    .end_array = sax_end_array,
+    .key = sax_key,
+    .string = sax_string,
+    .integer = sax_integer,
+    .fract = sax_fract,
+    .boolean = sax_boolean,
+    .null = sax_null,
+};
+
+// The events describe the document exactly, NULL callbacks are skipped and a
+// callback returning false stops the parse
+static void test_sax(void) {
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    const char *doc = ROUNDTRIP_DOCS[i];
+    context = doc;
+    SaxText st = {0};
+    const char *text = doc;
+    if (CHECK(json_sax_parse(&text, &SAX_TEXT, &st) && *text == '\0'))
+      CHECK(st.out.buf != NULL && strcmp(st.out.buf, doc) == 0);
+    size_t events = st.events;
+    free(st.out.buf);
+
+    for (size_t stop = 1; stop <= events; stop++) {
+      st = (SaxText){.stop_at = stop};
+      text = doc;
+      CHECK(!json_sax_parse(&text, &SAX_TEXT, &st) && st.events == stop);
+      free(st.out.buf);
+    }
+
+    JsonSaxHandler none = {0};
+    text = doc;
+    CHECK(json_sax_parse(&text, &none, NULL) && *text == '\0');
+  }
+
+  for (size_t i = 0; i < BAD_DOC_COUNT; i++) {
+    context = BAD_DOCS[i];
+    const char *text = BAD_DOCS[i], *sax_text = BAD_DOCS[i];
+    JsonVal tree;
+    CHECK(!json_parse_val(&tree, &text));
+    json_free_val(&tree);
+    SaxText st = {0};
+    CHECK(!json_sax_parse(&sax_text, &SAX_TEXT, &st) && sax_text == text);
+    free(st.out.buf);
+  }
+}
+
+// The tape entry at ref holds the same value as val
+static bool tape_matches(const JsonTape *tape, size_t ref, const JsonVal *val) {
+  if (json_tape_type(tape, ref) != val->type)
+    return false;
+  switch (val->type) {
+  case JSON_TYPE_OBJ: {
+    const JsonObj *obj = val->as.obj_ptr;
+    if (json_tape_len(tape, ref) != obj->len)
+      return false;
+    size_t it = ref + 1;
+    for (size_t i = 0; i < obj->len; i++) {
+      const JsonStr *key = &obj->pairs[i].key;
+      if (json_tape_type(tape, it) != JSON_TYPE_STR ||
+          json_tape_len(tape, it) != key->len ||
+          memcmp(json_tape_str(tape, it), key->start, key->len) != 0)
+        return false;
+      it = json_tape_next(tape, it);
+      if (!tape_matches(tape, it, &obj->pairs[i].value))
+        return false;
+      it = json_tape_next(tape, it);
+    }
+    return it == json_tape_end(tape, ref);
+  }
+  case JSON_TYPE_ARR: {
+    const JsonArr *arr = val->as.arr_ptr;
+    if (json_tape_len(tape, ref) != arr->len)
+      return false;
+    size_t it = ref + 1;
+    for (size_t i = 0; i < arr->len; i++, it = json_tape_next(tape, it))
+      if (!tape_matches(tape, it, &arr->values[i]))
+        return false;
+    return it == json_tape_end(tape, ref);
+  }
+  case JSON_TYPE_STR: {
+    const JsonStr *str = val->as.str_ptr;
+    const char *tape_str = json_tape_str(tape, ref);
+    return json_tape_len(tape, ref) == str->len &&
+           memcmp(tape_str, str->start, str->len) == 0 &&
+           tape_str[str->len] == '\0';
+  }
+  case JSON_TYPE_INT:
+    return json_tape_int(tape, ref) == val->as.integer;
+  case JSON_TYPE_FRC:
+    return memcmp(&(double){json_tape_frc(tape, ref)}, &val->as.fract,
+                  sizeof(double)) == 0;
+  case JSON_TYPE_BOL:
+    return json_tape_bool(tape, ref) == val->as.boolean;
+  case JSON_TYPE_NUL:
+    return true;
+  }
+  return false;
+}
+
+// The tape holds the tree json_parse_val builds, is written the same way and
+// finds the same keys
+static void test_tape(void) {
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    const char *doc = ROUNDTRIP_DOCS[i];
+    context = doc;
+    const char *text = doc;
+    JsonVal val;
+    CHECK(json_parse_val(&val, &text));
+    JsonTape tape;
+    text = doc;
+    if (CHECK(json_tape_parse(&tape, &text) && *text == '\0')) {
+      CHECK(tape_matches(&tape, 0, &val));
+      CHECK(json_tape_next(&tape, 0) == tape.len);
+      for (size_t s = 0; s < STYLE_COUNT; s++) {
+        char *expected = write_val(&val, &STYLES[s]);
+        JsonWriter w;
+        json_writer_init(&w, &STYLES[s]);
+        json_tape_write(&w, &tape, 0);
+        CHECK(strcmp(w.str, expected) == 0);
+        json_writer_free(&w);
+        free(expected);
+      }
+    }
+    json_tape_free(&tape);
+    json_free_val(&val);
+  }
+
+  for (long long n = 0; n <= 40; n++) {
+    char *doc = keys_doc(n);
+    context = doc;
+    const char *text = doc;
+    JsonTape tape;
+    if (CHECK(json_tape_parse(&tape, &text))) {
+      char key[32];
+      for (long long i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "key%lld", i);
+        size_t ref = json_tape_value_by_key(&tape, 0, key);
+        CHECK(ref != JSON_TAPE_NONE && json_tape_int(&tape, ref) == i * 7);
+      }
+      CHECK(json_tape_value_by_key(&tape, 0, "missing") == JSON_TAPE_NONE);
+      CHECK(json_tape_value_by_key_len(&tape, 0, "key", 3) == JSON_TAPE_NONE);
+    }
+    json_tape_free(&tape);
+    free(doc);
+  }
+
+  for (size_t i = 0; i < BAD_DOC_COUNT; i++) {
+    context = BAD_DOCS[i];
+    const char *text = BAD_DOCS[i], *tape_text = BAD_DOCS[i];
+    JsonVal tree;
+    CHECK(!json_parse_val(&tree, &text));
+    json_free_val(&tree);
+    JsonTape tape;
+    CHECK(!json_tape_parse(&tape, &tape_text) && tape_text == text);
+    json_tape_free(&tape);
+  }
+}
+
+// Array of count objects with keys key0..key<keys - 1>, large enough to be
+// parsed by several threads
+static char *wide_records(size_t count, size_t keys) {
+  Text t = {0};
+  text_append(&t, "[", 1);
+  for (size_t i = 0; i < count; i++) {
+    text_append(&t, i > 0 ? ",{" : "{", i > 0 ? 2 : 1);
+    for (size_t k = 0; k < keys; k++) {
+      text_printf(&t, k > 0 ? ",\"key%lld\":" : "\"key%lld\":", (long long)k);
+      text_printf(&t, "%lld", (long long)(i * keys + k));
+    }
+    text_append(&t, "}", 1);
+  }
+  text_append(&t, "]", 1);
+  return t.buf;
+}
+
+static void check_indexed_records(const JsonVal *root, size_t count,
+                                  size_t keys) {
+  if (!CHECK(root->type == JSON_TYPE_ARR && root->as.arr_ptr->len == count))
+    return;
+  for (size_t i = 0; i < count; i++) {
+    JsonObj *obj = root->as.arr_ptr->values[i].as.obj_ptr;
+    CHECK(obj->index != NULL);
+    for (size_t k = 0; k < keys; k++) {
+      char key[32];
+      snprintf(key, sizeof(key), "key%zu", k);
+      JsonVal *val = json_value_by_key(obj, key);
+      if (!CHECK(val == &obj->pairs[k].value &&
+                 val->as.integer == (long long)(i * keys + k)))
+        return;
+    }
+  }
+}
+
+// Several threads build the tree the calling thread alone builds, with key
+// indexes, in documents and heap trees, and stop at the same error
+static void test_parallel(void) {
+  context = "parallel records";
+  size_t count = 12000, keys = 20;
+  char *doc = wide_records(count, keys);
+  for (int round = 0; round < 3; round++) {
+    JsonDocument d;
+    json_doc_init(&d);
+    d.opts.flags = JSON_PARSE_INDEX_KEYS;
+    d.opts.threads = 4;
+    const char *text = doc;
+    CHECK(json_doc_parse(&d, &text) && *text == '\0');
+    check_indexed_records(&d.root, count, keys);
+    char *out = write_val(&d.root, &STYLES[0]);
+    CHECK(strcmp(out, doc) == 0);
+    free(out);
+    json_doc_free(&d);
+  }
+  JsonParseOptions opts = {.flags = JSON_PARSE_INDEX_KEYS, .threads = 4};
+  JsonVal val;
+  const char *text = doc;
+  CHECK(json_parse_val_opts(&val, &text, &opts) && *text == '\0');
+  check_indexed_records(&val, count, keys);
+  json_free_val(&val);
+
+  // An error in the middle leaves the elements before it, like the
+  // sequential parser does
+  context = "parallel error";
+  char *bad = strstr(doc + strlen(doc) / 2, "\"key3\"");
+  bad[1] = '\x01';
+  const char *seq_text = doc;
+  JsonVal seq;
+  CHECK(!json_parse_val(&seq, &seq_text));
+  for (unsigned threads = 2; threads <= 8; threads *= 2) {
+    opts.threads = threads;
+    text = doc;
+    CHECK(!json_parse_val_opts(&val, &text, &opts) && text == seq_text);
+    CHECK(val.as.arr_ptr->len == seq.as.arr_ptr->len);
+    json_free_val(&val);
+  }
+  json_free_val(&seq);
+  free(doc);
+
+  // Small arrays stay on the calling thread
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    context = ROUNDTRIP_DOCS[i];
+    text = ROUNDTRIP_DOCS[i];
+    if (CHECK(json_parse_val_opts(&val, &text, &opts))) {
+      char *out = write_val(&val, &STYLES[0]);
+      CHECK(strcmp(out, ROUNDTRIP_DOCS[i]) == 0);
+      free(out);
+      json_free_val(&val);
+    }
+  }
+}
+
+
+// Records stay within their line, whatever the line holds
+static void test_ndjson(void) {
+  const char *lines = "[\n1]\n2\n{\"a\":\n1}\n  \n3 \n";
+  context = lines;
+  JsonNdjsonRecord *records;
+  size_t count;
+  CHECK(!json_parse_ndjson(lines, strlen(lines), NULL, &records, &count));
+  size_t offsets[] = {0, 2, 5, 7, 13, 19};
+  size_t errors[] = {1, 3, 0, 12, 14, 0};
+  if (CHECK(count == 6))
+    for (size_t i = 0; i < count; i++)
+      CHECK(records[i].offset == offsets[i] &&
+            records[i].ok == (errors[i] == 0) &&
+            records[i].err_offset == errors[i]);
+  json_free_ndjson(records, count);
+
+  // Unclosed brackets do not reach into the following records
+  context = "unclosed lines";
+  Text t = {0};
+  text_repeat(&t, "[\n", 2000);
+  text_repeat(&t, "[1,2]\n", 1000);
+  for (unsigned threads = 1; threads <= 4; threads += 3) {
+    JsonParseOptions opts = {.threads = threads};
+    CHECK(!json_parse_ndjson(t.buf, t.len, &opts, &records, &count));
+    if (CHECK(count == 3000))
+      for (size_t i = 0; i < count; i++)
+        CHECK(records[i].ok == (i >= 2000) &&
+              records[i].err_offset == (i >= 2000 ? 0 : i * 2 + 1));
+    json_free_ndjson(records, count);
+  }
+  free(t.buf);
+
+  // Every round-trip document as a record
+  context = "round-trip records";
+  t = (Text){0};
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    text_append(&t, ROUNDTRIP_DOCS[i], strlen(ROUNDTRIP_DOCS[i]));
+    text_append(&t, "\n", 1);
+  }
+  JsonParseOptions opts = {.threads = 4};
+  CHECK(json_parse_ndjson(t.buf, t.len, &opts, &records, &count));
+  if (CHECK(count == ROUNDTRIP_DOC_COUNT))
+    for (size_t i = 0; i < count; i++) {
+      context = ROUNDTRIP_DOCS[i];
+      char *out = write_val(&records[i].val, &STYLES[0]);
+      CHECK(strcmp(out, ROUNDTRIP_DOCS[i]) == 0);
+      free(out);
+    }
+  json_free_ndjson(records, count);
+  free(t.buf);
+}
+
+static pthread_mutex_t calls_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Called from several threads at once
+static bool stop_at_first(void *ctx, JsonNdjsonRecord *record) {
+  pthread_mutex_lock(&calls_lock);
+  (*(size_t *)ctx)++;
+  pthread_mutex_unlock(&calls_lock);
+  json_free_val(&record->val);
+  return false;
+}
+
+// Stopping in the callback skips the records not yet taken by a thread, each
+// of the others reaches the callback at most once more
+static void test_ndjson_stop(void) {
+  context = "stopping callback";
+  Text t = {0};
+  text_repeat(&t, "{\"a\":[1,2,3]}\n", 100000);
+  for (unsigned threads = 1; threads <= 4; threads += 3) {
+    size_t calls = 0;
+    JsonParseOptions opts = {.threads = threads};
+    CHECK(!json_parse_ndjson_cb(t.buf, t.len, &opts, stop_at_first, &calls) &&
+          calls >= 1 && calls <= threads);
+  }
+  free(t.buf);
+}
+
+#define MMAP_PATH "json_test_mmap.tmp"
+
+static bool write_file(const char *path, const char *data, size_t len) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL)
+    return false;
+  bool ok = fwrite(data, 1, len, f) == len;
+  return fclose(f) == 0 && ok;
+}
+
+// Files of every size around a page boundary parse as their text does, with
+// unescaped strings pointing into the mapping
+static void test_mmap(void) {
+  static const size_t sizes[] = {2, 3, 4095, 4096, 4097, 8191, 8192, 65536};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    context = "page sized string";
+    char *data = malloc(sizes[i]);
+    memset(data, 'a', sizes[i]);
+    data[0] = data[sizes[i] - 1] = '"';
+    bool written = CHECK(write_file(MMAP_PATH, data, sizes[i]));
+    free(data);
+    if (!written)
+      continue;
+    JsonDocument d;
+    json_doc_init(&d);
+    const char *end;
+    if (CHECK(json_doc_parse_file(&d, MMAP_PATH, &end)) &&
+        CHECK(end == d.source + sizes[i] && d.source_len == sizes[i] &&
+              d.source[sizes[i]] == '\0')) {
+      const JsonStr *str = d.root.as.str_ptr;
+      CHECK(d.root.type == JSON_TYPE_STR && str->len == sizes[i] - 2 &&
+            str->start == d.source + 1 && !str->needs_dealloc);
+    }
+    json_doc_free(&d);
+  }
+
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    const char *doc = ROUNDTRIP_DOCS[i];
+    context = doc;
+    if (!CHECK(write_file(MMAP_PATH, doc, strlen(doc))))
+      continue;
+    JsonDocument d;
+    json_doc_init(&d);
+    const char *end;
+    if (CHECK(json_doc_parse_file(&d, MMAP_PATH, &end) && *end == '\0')) {
+      char *out = write_val(&d.root, &STYLES[0]);
+      CHECK(strcmp(out, doc) == 0);
+      free(out);
+    }
+    json_doc_free(&d);
+  }
+
+  for (size_t i = 0; i < BAD_DOC_COUNT; i++) {
+    context = BAD_DOCS[i];
+    const char *text = BAD_DOCS[i];
+    JsonVal tree;
+    CHECK(!json_parse_val(&tree, &text));
+    json_free_val(&tree);
+    if (!CHECK(write_file(MMAP_PATH, BAD_DOCS[i], strlen(BAD_DOCS[i]))))
+      continue;
+    JsonDocument d;
+    json_doc_init(&d);
+    const char *end;
+    CHECK(!json_doc_parse_file(&d, MMAP_PATH, &end) && end != NULL &&
+          end - d.source == text - BAD_DOCS[i]);
+    json_doc_free(&d);
+  }
+
+  context = "empty file";
+  JsonDocument d;
+  json_doc_init(&d);
+  const char *end;
+  CHECK(write_file(MMAP_PATH, "", 0) &&
+        !json_doc_parse_file(&d, MMAP_PATH, &end) && end == d.source);
+  json_doc_free(&d);
+  remove(MMAP_PATH);
+
+  context = "missing file";
+  json_doc_init(&d);
+  CHECK(!json_doc_parse_file(&d, MMAP_PATH, &end) && end == NULL &&
+        errno == ENOENT);
+  json_doc_free(&d);
+}
+
+// Looks up every value of the tree at val by its pointer, both in the tree and
+// lazily in doc, the text of the tree
+static void check_pointers(JsonVal *root, JsonVal *val, Text *pointer,
+                           const char *doc) {
+  CHECK(json_pointer_get(root, pointer->buf) == val);
+  JsonDocument d;
+  json_doc_init(&d);
+  JsonVal *lazy = json_doc_parse_pointer(&d, doc, pointer->buf);
+  if (CHECK(lazy != NULL)) {
+    char *expected = write_val(val, &STYLES[0]);
+    char *out = write_val(lazy, &STYLES[0]);
+    CHECK(strcmp(out, expected) == 0);
+    free(expected);
+    free(out);
+  }
+  json_doc_free(&d);
+
+  size_t len = pointer->len;
+  if (val->type == JSON_TYPE_ARR) {
+    for (size_t i = 0; i < val->as.arr_ptr->len; i++) {
+      text_printf(pointer, "/%lld", (long long)i);
+      check_pointers(root, &val->as.arr_ptr->values[i], pointer, doc);
+      pointer->buf[pointer->len = len] = '\0';
+    }
+  } else if (val->type == JSON_TYPE_OBJ) {
+    JsonObj *obj = val->as.obj_ptr;
+    for (size_t i = 0; i < obj->len; i++) {
+      const JsonStr *key = &obj->pairs[i].key;
+      // Later duplicates are not reachable
+      if (json_value_by_key_len(obj, key->start, key->len) !=
+          &obj->pairs[i].value)
+        continue;
+      text_append(pointer, "/", 1);
+      for (size_t c = 0; c < key->len; c++)
+        if (key->start[c] == '~' || key->start[c] == '/')
+          text_append(pointer, key->start[c] == '~' ? "~0" : "~1", 2);
+        else
+          text_append(pointer, &key->start[c], 1);
+      check_pointers(root, &obj->pairs[i].value, pointer, doc);
+      pointer->buf[pointer->len = len] = '\0';
+    }
+  }
+}
+
+// Every value is found by its pointer, in the tree and lazily in the text,
+// and malformed or dangling pointers find nothing
+static void test_pointer(void) {
+  static const char *const docs[] = {
+      "{\"a/b\":{\"m~n\":[10,20]},\"\":{\"\":1},\"~01\":2,\" \":[3]}",
+      "[[0,1,2,3,4,5,6,7,8,9,10,[11]],{\"0\":\"zero\",\"01\":true}]",
+  };
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT + 2; i++) {
+    const char *doc = i < 2 ? docs[i] : ROUNDTRIP_DOCS[i - 2];
+    context = doc;
+    const char *text = doc;
+    JsonVal val;
+    if (!CHECK(json_parse_val(&val, &text)))
+      continue;
+    Text pointer = {0};
+    text_append(&pointer, "", 0);
+    check_pointers(&val, &val, &pointer, doc);
+    free(pointer.buf);
+    json_free_val(&val);
+  }
+
+  const char *doc = docs[0];
+  context = doc;
+  const char *text = doc;
+  JsonVal val;
+  CHECK(json_parse_val(&val, &text));
+  JsonVal *found = json_pointer_get(&val, "/a~1b/m~0n/1");
+  CHECK(found != NULL && found->as.integer == 20);
+  found = json_pointer_get(&val, "/~001");
+  CHECK(found != NULL && found->as.integer == 2);
+  static const char *const missing[] = {
+      "a",      "/a~1b/m~0n/2", "/a~1b/m~0n/01", "/a~1b/m~0n/-",
+      "/a~2b",  "/a~",          "/a/b",          "/a~1b/m~0n/1/x",
+      "/ /0/0", "/ /+0",        "/nope",
+  };
+  for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++) {
+    context = missing[i];
+    CHECK(json_pointer_get(&val, missing[i]) == NULL);
+    JsonDocument d;
+    json_doc_init(&d);
+    CHECK(json_doc_parse_pointer(&d, doc, missing[i]) == NULL);
+    json_doc_free(&d);
+  }
+  json_free_val(&val);
+
+  // A lazy lookup only parses the value it returns
+  context = "lazy lookup";
+  JsonDocument d;
+  json_doc_init(&d);
+  found = json_doc_parse_pointer(&d, "{\"bad\":[1,,],\"ok\":[1]}", "/ok/0");
+  CHECK(found != NULL && found->as.integer == 1);
+  CHECK(json_doc_parse_pointer(&d, "{\"bad\":[1,,]}", "/bad") == NULL);
+  json_doc_free(&d);
+}
+
+// Accepts limit bytes, then reports a write error
+typedef struct {
+  Text out;
+  size_t limit;
+} LimitedSink;
+
+static bool collect_limited(void *ctx, const char *data, size_t len) {
+  LimitedSink *sink = ctx;
+  if (sink->out.len + len > sink->limit)
+    return false;
+  text_append(&sink->out, data, len);
+  return true;
+}
+
+#define SINK_PATH "json_test_sink.tmp"
+
+// Reads back what a writer left in f
+static char *read_back(FILE *f, size_t *len) {
+  fflush(f);
+  long size = ftell(f);
+  char *data = malloc((size_t)size + 1);
+  rewind(f);
+  *len = fread(data, 1, (size_t)size, f);
+  data[*len] = '\0';
+  return data;
+}
+
+// Sink writers pass on the output of a large document through any buffer
+// size, to file descriptors and FILE*, and report failed writes
+static void test_sinks(void) {
+  context = "records";
+  char *doc = wide_records(2000, 20);
+  const char *text = doc;
+  JsonVal val;
+  CHECK(json_parse_val(&val, &text));
+  for (size_t s = 0; s < STYLE_COUNT; s++) {
+    char *expected = write_val(&val, &STYLES[s]);
+    size_t len = strlen(expected);
+    check_output(&val, &STYLES[s], expected);
+    size_t buf_sizes[] = {2, 7, 4096, len, len + 1};
+    for (size_t i = 0; i < sizeof(buf_sizes) / sizeof(buf_sizes[0]); i++) {
+      Text sunk = {0};
+      JsonWriter w;
+      json_writer_init_sink(&w, &STYLES[s], collect, &sunk, buf_sizes[i]);
+      json_write_val(&w, &val);
+      json_write_val(&w, &val); // Appended
+      CHECK(json_writer_flush(&w));
+      json_writer_free(&w);
+      CHECK(sunk.len == 2 * len && memcmp(sunk.buf, expected, len) == 0 &&
+            memcmp(sunk.buf + len, expected, len) == 0);
+      free(sunk.buf);
+    }
+
+    FILE *f = fopen(SINK_PATH, "w+b");
+    if (CHECK(f != NULL)) {
+      JsonWriter w;
+      json_writer_init_file(&w, &STYLES[s], f);
+      json_write_val(&w, &val);
+      CHECK(json_writer_flush(&w));
+      json_writer_free(&w);
+      size_t read_len;
+      char *data = read_back(f, &read_len);
+      CHECK(read_len == len && strcmp(data, expected) == 0);
+      free(data);
+      fclose(f);
+    }
+
+    f = fopen(SINK_PATH, "w+b");
+    if (CHECK(f != NULL)) {
+      JsonWriter w;
+      json_writer_init_fd(&w, &STYLES[s], fileno(f));
+      json_write_val(&w, &val);
+      CHECK(json_writer_flush(&w));
+      json_writer_free(&w);
+      fseek(f, 0, SEEK_END);
+      size_t read_len;
+      char *data = read_back(f, &read_len);
+      CHECK(read_len == len && strcmp(data, expected) == 0);
+      free(data);
+      fclose(f);
+    }
+    free(expected);
+  }
+  remove(SINK_PATH);
+
+  // A failed write is reported by every later flush, and nothing more is
+  // passed on
+  context = "failing sink";
+  LimitedSink sink = {.limit = 10000};
+  JsonWriter w;
+  json_writer_init_sink(&w, &STYLES[0], collect_limited, &sink, 4096);
+  json_write_val(&w, &val);
+  CHECK(!json_writer_flush(&w));
+  size_t sunk = sink.out.len;
+  CHECK(sunk <= sink.limit);
+  json_write_val(&w, &val);
+  CHECK(!json_writer_flush(&w) && sink.out.len == sunk);
+  json_writer_free(&w);
+  free(sink.out.buf);
+
+  json_free_val(&val);
+  free(doc);
+}
+
+// Serialization into a buffer of exactly the measured size, for numbers of
+// every length
+static void test_measure(void) {
+  context = "random fractions";
+  for (int round = 0; round < 200; round++) {
+    size_t count = 1 + rng_next() % 64;
+    JsonVal *values = malloc(count * sizeof(JsonVal));
+    for (size_t i = 0; i < count; i++) {
+      uint64_t bits = rng_next();
+      values[i].type = i % 3 == 0 ? JSON_TYPE_INT : JSON_TYPE_FRC;
+      if (values[i].type == JSON_TYPE_INT)
+        values[i].as.integer = (long long)bits >> (bits % 64);
+      else
+        memcpy(&values[i].as.fract, &bits, sizeof(bits));
+    }
+    JsonArr arr = {.values = values, .len = count};
+    JsonVal val = {.type = JSON_TYPE_ARR, .as.arr_ptr = &arr};
+    for (size_t s = 0; s < STYLE_COUNT; s++) {
+      char *expected = write_val(&val, &STYLES[s]);
+      size_t len = strlen(expected);
+      CHECK(json_serialized_size(&val, &STYLES[s]) == len);
+      CHECK(json_serialized_size_bound(&val, &STYLES[s]) >= len);
+      // Nothing is written past the NUL
+      char *buf = malloc(len + 2);
+      buf[len + 1] = '#';
+      CHECK(json_serialize_into(&val, &STYLES[s], buf) == len &&
+            strcmp(buf, expected) == 0 && buf[len + 1] == '#');
+      free(buf);
+      free(expected);
+    }
+    free(values);
+  }
+}
+
+// Every byte value survives a round trip through the serializer, and strings
+// encoded with json_str_encode_into_buf are written verbatim with raw_strings
+static void test_escape(void) {
+  context = "all bytes";
+  char bytes[256];
+  for (size_t i = 0; i < 256; i++)
+    bytes[i] = (char)(i + 1 == 256 ? 0 : i + 1); // NUL last
+  for (size_t start = 0; start < 40; start++) {
+    for (size_t len = 0; start + len <= 256; len += 1 + len / 4) {
+      JsonStr str = {.start = bytes + start, .len = len};
+      JsonVal val = {.type = JSON_TYPE_STR, .as.str_ptr = &str};
+      char *out = write_val(&val, &STYLES[0]);
+      check_output(&val, &STYLES[0], out);
+      const char *text = out;
+      JsonVal back;
+      if (CHECK(json_parse_val(&back, &text) && *text == '\0'))
+        CHECK(back.as.str_ptr->len == len &&
+              memcmp(back.as.str_ptr->start, bytes + start, len) == 0);
+      json_free_val(&back);
+      free(out);
+    }
+  }
+
+  context = "raw strings";
+  const char *plain = "a\"b\\c\nd\x01e/";
+  size_t buf_size;
+  CHECK(json_str_needs_encoding(plain, &buf_size));
+  char *encoded = malloc(buf_size);
+  json_str_encode_into_buf(plain, encoded);
+  JsonStr str = {.start = plain, .len = strlen(plain)};
+  JsonVal val = {.type = JSON_TYPE_STR, .as.str_ptr = &str};
+  char *escaped = write_val(&val, &STYLES[0]);
+  for (size_t s = 0; s < STYLE_COUNT; s++) {
+    JsonStyle raw = STYLES[s];
+    raw.raw_strings = true;
+    str = (JsonStr){.start = encoded, .len = strlen(encoded)};
+    check_output(&val, &raw, escaped);
+    // Escaping it again would double the backslashes
+    char *twice = write_val(&val, &STYLES[s]);
+    CHECK(strcmp(twice, escaped) != 0);
+    free(twice);
+  }
+  free(escaped);
+  free(encoded);
+}
+
+// Decodes every string kept escaped, returns the number of them
+static size_t unescape_all(JsonVal *val, JsonArena *arena) {
+  size_t count = 0;
+  if (val->type == JSON_TYPE_STR) {
+    count = val->as.str_ptr->escaped;
+    json_str_unescape(val->as.str_ptr, arena);
+    CHECK(!val->as.str_ptr->escaped);
+  } else if (val->type == JSON_TYPE_ARR)
+    for (size_t i = 0; i < val->as.arr_ptr->len; i++)
+      count += unescape_all(&val->as.arr_ptr->values[i], arena);
+  else if (val->type == JSON_TYPE_OBJ)
+    for (size_t i = 0; i < val->as.obj_ptr->len; i++)
+      count += unescape_all(&val->as.obj_ptr->pairs[i].value, arena);
+  return count;
+}
+
+// Strings kept escaped are written as they were read and decode to what the
+// eager parse gives, in trees and documents
+static void test_lazy_strings(void) {
+  JsonParseOptions opts = {.flags = JSON_PARSE_LAZY_STRINGS};
+  size_t lazy_count = 0;
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    const char *doc = ROUNDTRIP_DOCS[i];
+    context = doc;
+    char *expected[STYLE_COUNT];
+    const char *text = doc;
+    JsonVal val;
+    CHECK(json_parse_val(&val, &text));
+    for (size_t s = 0; s < STYLE_COUNT; s++)
+      expected[s] = write_val(&val, &STYLES[s]);
+    json_free_val(&val);
+
+    text = doc;
+    if (CHECK(json_parse_val_opts(&val, &text, &opts) && *text == '\0')) {
+      check_all_styles(&val, expected);
+      lazy_count += unescape_all(&val, NULL);
+      check_all_styles(&val, expected);
+    }
+    json_free_val(&val);
+
+    JsonDocument d;
+    json_doc_init(&d);
+    d.opts = opts;
+    text = doc;
+    if (CHECK(json_doc_parse(&d, &text) && *text == '\0')) {
+      check_all_styles(&d.root, expected);
+      unescape_all(&d.root, &d.arena);
+      check_all_styles(&d.root, expected);
+    }
+    json_doc_free(&d);
+    for (size_t s = 0; s < STYLE_COUNT; s++)
+      free(expected[s]);
+  }
+  context = "lazy strings";
+  CHECK(lazy_count >= 2);
+
+  // Lazy strings are still validated
+  static const char *const invalid[] = {"[\"\\q\"]", "\"\\u12\"",
+                                        "\"a\\n\x01\""};
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    context = invalid[i];
+    const char *text = invalid[i];
+    JsonVal val;
+    CHECK(!json_parse_val_opts(&val, &text, &opts));
+    json_free_val(&val);
+  }
+}
+
+// Interned documents serialize like others, equal keys share their bytes and
+// are found by pointer, short equal strings share their node
+static void test_intern(void) {
+  unsigned intern = JSON_PARSE_INTERN_KEYS | JSON_PARSE_INTERN_STRINGS;
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    const char *doc = ROUNDTRIP_DOCS[i];
+    context = doc;
+    for (unsigned lazy = 0; lazy <= JSON_PARSE_LAZY_STRINGS;
+         lazy += JSON_PARSE_LAZY_STRINGS) {
+      JsonDocument d;
+      json_doc_init(&d);
+      d.opts.flags = intern | lazy;
+      const char *text = doc;
+      if (CHECK(json_doc_parse(&d, &text) && *text == '\0'))
+        check_output(&d.root, &STYLES[0], doc);
+      json_doc_free(&d);
+    }
+  }
+
+  context = "records";
+  size_t count = 300, keys = 20;
+  Text t = {0};
+  text_append(&t, "[", 1);
+  for (size_t i = 0; i < count; i++) {
+    text_printf(&t, i > 0 ? ",{\"id\":%lld," : "{\"id\":%lld,", (long long)i);
+    text_printf(&t, "\"tag\":\"t%lld\",\"k\\u0065y\":null}",
+                (long long)(i % 3));
+  }
+  text_append(&t, "]", 1);
+  char *wide = wide_records(count, keys);
+  const char *docs[] = {t.buf, wide};
+  for (size_t doc_idx = 0; doc_idx < 2; doc_idx++) {
+    JsonDocument d;
+    json_doc_init(&d);
+    d.opts.flags = intern;
+    const char *text = docs[doc_idx];
+    if (!CHECK(json_doc_parse(&d, &text) && *text == '\0')) {
+      json_doc_free(&d);
+      continue;
+    }
+    text = docs[doc_idx];
+    JsonVal val;
+    CHECK(json_parse_val(&val, &text));
+    char *expected = write_val(&val, &STYLES[0]);
+    check_output(&d.root, &STYLES[0], expected);
+    free(expected);
+    json_free_val(&val);
+    JsonArr *arr = d.root.as.arr_ptr;
+    JsonObj *first = arr->values[0].as.obj_ptr;
+    for (size_t k = 0; k < first->len; k++) {
+      const JsonStr *key = &first->pairs[k].key;
+      const char *shared = json_doc_intern(&d, key->start, key->len);
+      CHECK(shared == key->start);
+      for (size_t i = 0; i < arr->len; i++) {
+        JsonObj *obj = arr->values[i].as.obj_ptr;
+        CHECK(obj->pairs[k].key.start == shared);
+        CHECK(json_value_by_interned_key(obj, shared, key->len) ==
+              &obj->pairs[k].value);
+      }
+    }
+    CHECK(json_doc_intern(&d, "missing", 7) == NULL);
+    if (doc_idx == 0) {
+      // The key is decoded before it is interned
+      CHECK(json_doc_intern(&d, "key", 3) != NULL);
+      for (size_t i = 3; i < arr->len; i++)
+        CHECK(json_value_by_key(arr->values[i].as.obj_ptr, "tag")->as.str_ptr ==
+              json_value_by_key(arr->values[i - 3].as.obj_ptr, "tag")
+                  ->as.str_ptr);
+    }
+    json_doc_free(&d);
+  }
+  free(wide);
+  free(t.buf);
+}
+
+typedef struct {
+  long long id;
+  double weight;
+} Item;
+
+static const JsonField item_fields[] = {
+    JSON_FIELD(Item, id, JSON_TYPE_INT),
+    JSON_FIELD(Item, weight, JSON_TYPE_FRC),
+};
+static const JsonSchema item_schema = JSON_SCHEMA(Item, item_fields);
+
+typedef struct {
+  JsonStr name;
+  bool active;
+  Item main;
+  JsonBoundArr tags;  // JsonStr
+  JsonBoundArr items; // Item
+  JsonBoundArr ids;   // long long
+} Order;
+
+static const JsonField order_fields[] = {
+    JSON_FIELD(Order, name, JSON_TYPE_STR),
+    JSON_FIELD(Order, active, JSON_TYPE_BOL),
+    JSON_FIELD_OBJ(Order, main, item_schema),
+    JSON_FIELD_ARR(Order, tags, JSON_TYPE_STR),
+    JSON_FIELD_OBJ_ARR(Order, items, item_schema),
+    JSON_FIELD_ARR(Order, ids, JSON_TYPE_INT),
+};
+static const JsonSchema order_schema = JSON_SCHEMA(Order, order_fields);
+
+static bool str_is(const JsonStr *str, const char *expected) {
+  return str->len == strlen(expected) &&
+         memcmp(str->start, expected, str->len) == 0;
+}
+
+// Members are filled from their keys whatever the order, on the heap and in
+// an arena; double members take every number literal, integer members only
+// those that fit
+static void test_bind(void) {
+  const char *doc =
+      "{\"skip\":{\"a\":[1,{}]},\"ids\":[3,-4],\"name\":\"n\\u00e9\","
+      "\"items\":[{\"id\":1},{\"weight\":2.5,\"id\":2,\"x\":null}],"
+      "\"main\":{\"id\":7,\"weight\":1},\"active\":true,"
+      "\"tags\":[\"a\",\"b\\\"\"],\"name\":\"last\"}";
+  context = doc;
+  for (int in_arena = 0; in_arena < 2; in_arena++) {
+    JsonDocument d;
+    json_doc_init(&d);
+    Order order;
+    const char *text = doc;
+    if (CHECK(json_bind(&text, &order_schema, &order,
+                        in_arena ? &d.arena : NULL) &&
+              *text == '\0')) {
+      CHECK(str_is(&order.name, "last") && order.active);
+      CHECK(order.main.id == 7 && order.main.weight == 1.0);
+      JsonStr *tags = order.tags.items;
+      CHECK(order.tags.len == 2 && str_is(&tags[0], "a") &&
+            str_is(&tags[1], "b\""));
+      Item *items = order.items.items;
+      CHECK(order.items.len == 2 && items[0].id == 1 &&
+            items[0].weight == 0 && items[1].id == 2 &&
+            items[1].weight == 2.5);
+      long long *ids = order.ids.items;
+      CHECK(order.ids.len == 2 && ids[0] == 3 && ids[1] == -4);
+    }
+    if (!in_arena)
+      json_bind_free(&order_schema, &order);
+    json_doc_free(&d);
+  }
+
+  context = "null and missing";
+  Order order;
+  const char *text = "{\"name\":null,\"tags\":null}";
+  CHECK(json_bind(&text, &order_schema, &order, NULL) &&
+        order.name.start == NULL && order.tags.len == 0 && !order.active);
+  json_bind_free(&order_schema, &order);
+
+  struct {
+    const char *doc;
+    bool ok;
+    double weight;
+  } cases[] = {
+      {"{\"weight\":2}", true, 2.0},
+      {"{\"weight\":-2.5}", true, -2.5},
+      {"{\"weight\":123456789012345678901234567890}", true,
+       1.2345678901234568e29},
+      {"{\"weight\":-99999999999999999999}", true, -1e20},
+      {"{\"weight\":1e400}", false, 0},
+      {"{\"weight\":0123}", false, 0},
+      {"{\"id\":123456789012345678901}", false, 0},
+      {"{\"id\":1.5}", false, 0},
+      {"{\"id\":\"1\"}", false, 0},
+      {"{\"weight\":[]}", false, 0},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    context = cases[i].doc;
+    Item item;
+    text = cases[i].doc;
+    bool ok = json_bind(&text, &item_schema, &item, NULL);
+    CHECK(ok == cases[i].ok);
+    if (ok)
+      CHECK(item.weight == cases[i].weight && *text == '\0');
+    else
+      CHECK(text == strchr(cases[i].doc, ':') + 1); // At the value
+    json_bind_free(&item_schema, &item);
+  }
+
+  // The parts bound before an error are released by json_bind_free
+  context = "failed bind";
+  text = "{\"tags\":[\"a\\n\",\"b\"],\"items\":[{\"id\":1},{\"id\":{}}]}";
+  CHECK(!json_bind(&text, &order_schema, &order, NULL) && *text == '{');
+  json_bind_free(&order_schema, &order);
+}
+
+#define SNAPSHOT_PATH "json_test.snap"
+
+static char *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  char *data = read_back(f, len);
+  fclose(f);
+  return data;
+}
+
+// Loaded snapshots serialize like the saved tree and keep its key indexes;
+// truncated and foreign files are rejected
+static void test_snapshot(void) {
+  char *wide = wide_records(200, 40);
+  for (size_t i = 0; i <= ROUNDTRIP_DOC_COUNT; i++) {
+    const char *doc = i < ROUNDTRIP_DOC_COUNT ? ROUNDTRIP_DOCS[i] : wide;
+    context = doc;
+    const char *text = doc;
+    JsonVal val;
+    if (!CHECK(json_parse_val(&val, &text))) {
+      json_free_val(&val);
+      continue;
+    }
+    char *expected[STYLE_COUNT];
+    for (size_t s = 0; s < STYLE_COUNT; s++)
+      expected[s] = write_val(&val, &STYLES[s]);
+    JsonDocument loaded;
+    json_doc_init(&loaded);
+    if (CHECK(json_snapshot_save(&val, SNAPSHOT_PATH)) &&
+        CHECK(json_doc_load_snapshot(&loaded, SNAPSHOT_PATH)))
+      check_all_styles(&loaded.root, expected);
+    if (doc == wide)
+      check_indexed_records(&loaded.root, 200, 40);
+    json_doc_free(&loaded);
+
+    // A snapshot of a document tree
+    JsonDocument d;
+    json_doc_init(&d);
+    text = doc;
+    CHECK(json_doc_parse(&d, &text));
+    json_doc_init(&loaded);
+    if (CHECK(json_snapshot_save(&d.root, SNAPSHOT_PATH)) &&
+        CHECK(json_doc_load_snapshot(&loaded, SNAPSHOT_PATH)))
+      check_all_styles(&loaded.root, expected);
+    json_doc_free(&loaded);
+    json_doc_free(&d);
+
+    for (size_t s = 0; s < STYLE_COUNT; s++)
+      free(expected[s]);
+    json_free_val(&val);
+  }
+
+  context = "truncated snapshot";
+  const char *text = wide;
+  JsonVal val;
+  CHECK(json_parse_val(&val, &text));
+  CHECK(json_snapshot_save(&val, SNAPSHOT_PATH));
+  json_free_val(&val);
+  size_t len;
+  char *data = read_file(SNAPSHOT_PATH, &len);
+  if (CHECK(data != NULL)) {
+    for (size_t cut = 0; cut < len; cut += 1 + cut / 3) {
+      JsonDocument d;
+      json_doc_init(&d);
+      CHECK(write_file(SNAPSHOT_PATH, data, cut));
+      errno = 0;
+      CHECK(!json_doc_load_snapshot(&d, SNAPSHOT_PATH) && errno == EINVAL);
+      // Released by the failed load, no json_doc_free needed
+      CHECK(d.source == NULL && d.source_len == 0 && !d.source_mapped);
+    }
+    free(data);
+  }
+
+  context = "foreign file";
+  JsonDocument d;
+  json_doc_init(&d);
+  CHECK(write_file(SNAPSHOT_PATH, wide, strlen(wide)));
+  errno = 0;
+  CHECK(!json_doc_load_snapshot(&d, SNAPSHOT_PATH) && errno == EINVAL);
+  json_doc_free(&d);
+  remove(SNAPSHOT_PATH);
+  free(wide);
+}
+
+// Counts of one parse, adding up over calls and over worker threads
+static void test_stats(void) {
+  const char *doc = "{\"a\":[1,2.5,\"x\",\"y\\n\",true,null,{\"b\":[]}]}";
+  context = doc;
+  JsonStats stats = {0};
+  CHECK(json_stats_attach(&stats) == NULL);
+  const char *text = doc;
+  JsonVal val;
+  CHECK(json_parse_val(&val, &text));
+  json_free_val(&val);
+#ifndef JSON_NO_STATS
+  size_t expected[] = {2, 2, 2, 1, 1, 1, 1};
+  for (JsonType type = JSON_TYPE_OBJ; type <= JSON_TYPE_NUL; type++)
+    CHECK(stats.values[type] == expected[type]);
+  CHECK(stats.max_depth == 4);
+  CHECK(stats.plain_str_bytes == 3 && stats.escaped_str_bytes > 0);
+  CHECK(stats.allocs > 0 && stats.alloc_bytes > 0);
+
+  // Adds up
+  JsonDocument d;
+  json_doc_init(&d);
+  text = doc;
+  CHECK(json_doc_parse(&d, &text));
+  json_doc_free(&d);
+  CHECK(stats.values[JSON_TYPE_OBJ] == 4 && stats.max_depth == 4);
+
+  // Worker threads count into the attached stats too
+  context = "parallel records";
+  size_t count = 12000, keys = 20;
+  char *wide = wide_records(count, keys);
+  stats = (JsonStats){0};
+  JsonParseOptions opts = {.threads = 4};
+  text = wide;
+  CHECK(json_parse_val_opts(&val, &text, &opts));
+  CHECK(stats.values[JSON_TYPE_ARR] == 1 &&
+        stats.values[JSON_TYPE_OBJ] == count &&
+        stats.values[JSON_TYPE_INT] == count * keys && stats.max_depth == 2);
+  JsonWriter w;
+  json_writer_init(&w, &STYLES[0]);
+  json_write_val(&w, &val);
+  json_writer_free(&w);
+  CHECK(stats.writer_growths > 0);
+  json_free_val(&val);
+  free(wide);
+#endif
+
+  // Detached: nothing more is counted
+  CHECK(json_stats_attach(NULL) == &stats);
+  JsonStats before = stats;
+  text = doc;
+  CHECK(json_parse_val(&val, &text));
+  json_free_val(&val);
+  CHECK(memcmp(&before, &stats, sizeof(stats)) == 0);
+}
+
+// Checking allocator: every block carries its size, which release and resize
+// must be given back, and the blocks still live are counted
+typedef struct {
+  long live;
+  long mismatches;
+} CheckedHeap;
+
+#define CHECKED_HEADER 16
+
+static void *checked_alloc(void *ctx, size_t size) {
+  CheckedHeap *heap = ctx;
+  char *block = malloc(size + CHECKED_HEADER);
+  memcpy(block, &size, sizeof(size));
+  heap->live++;
+  return block + CHECKED_HEADER;
+}
+
+static void *checked_resize(void *ctx, void *ptr, size_t old_size,
+                            size_t new_size) {
+  CheckedHeap *heap = ctx;
+  char *block = (char *)ptr - CHECKED_HEADER;
+  size_t size;
+  memcpy(&size, block, sizeof(size));
+  heap->mismatches += size != old_size;
+  block = realloc(block, new_size + CHECKED_HEADER);
+  memcpy(block, &new_size, sizeof(new_size));
+  return block + CHECKED_HEADER;
+}
+
+static void checked_release(void *ctx, void *ptr, size_t size) {
+  CheckedHeap *heap = ctx;
+  if (ptr == NULL)
+    return;
+  char *block = (char *)ptr - CHECKED_HEADER;
+  size_t stored;
+  memcpy(&stored, block, sizeof(stored));
+  heap->mismatches += stored != size;
+  heap->live--;
+  free(block);
+}
+
+static JsonAllocator checked_allocator(CheckedHeap *heap) {
+  JsonAllocator alloc = {checked_alloc, checked_resize, checked_release,
+                         heap, false};
+  return alloc;
+}
+
+static void unescape_all_alloc(JsonVal *val, const JsonAllocator *alloc) {
+  if (val->type == JSON_TYPE_STR)
+    json_str_unescape_alloc(val->as.str_ptr, alloc);
+  else if (val->type == JSON_TYPE_ARR)
+    for (size_t i = 0; i < val->as.arr_ptr->len; i++)
+      unescape_all_alloc(&val->as.arr_ptr->values[i], alloc);
+  else if (val->type == JSON_TYPE_OBJ)
+    for (size_t i = 0; i < val->as.obj_ptr->len; i++)
+      unescape_all_alloc(&val->as.obj_ptr->pairs[i].value, alloc);
+}
+
+// Trees, documents, streams, writers and NDJSON records built with an
+// allocator give every block back to it with the size it was allocated with
+static void test_alloc(void) {
+  CheckedHeap heap = {0};
+  JsonAllocator alloc = checked_allocator(&heap);
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT; i++) {
+    const char *doc = ROUNDTRIP_DOCS[i];
+    context = doc;
+    for (unsigned lazy = 0; lazy <= JSON_PARSE_LAZY_STRINGS;
+         lazy += JSON_PARSE_LAZY_STRINGS) {
+      JsonParseOptions opts = {.flags = lazy, .alloc = &alloc};
+      JsonVal val;
+      const char *text = doc;
+      if (CHECK(json_parse_val_opts(&val, &text, &opts) && *text == '\0')) {
+        check_output(&val, &STYLES[0], doc);
+        unescape_all_alloc(&val, &alloc);
+        check_output(&val, &STYLES[0], doc);
+
+        JsonWriter w;
+        json_writer_init(&w, &STYLES[0]);
+        json_writer_set_allocator(&w, &alloc);
+        json_write_val(&w, &val);
+        CHECK(strcmp(w.str, doc) == 0);
+        json_writer_free(&w);
+      }
+      json_free_val_alloc(&val, &alloc);
+      CHECK(heap.live == 0 && heap.mismatches == 0);
+
+      JsonStream *stream = json_stream_new(&val, &opts);
+      if (CHECK(feed_chunks(stream, doc, 3) == JSON_STREAM_DONE)) {
+        unescape_all_alloc(&val, &alloc);
+        check_output(&val, &STYLES[0], doc);
+        json_free_val_alloc(&val, &alloc);
+      }
+      json_stream_free(stream);
+      CHECK(heap.live == 0 && heap.mismatches == 0);
+
+      JsonDocument d;
+      json_doc_init(&d);
+      d.opts = opts;
+      text = doc;
+      if (CHECK(json_doc_parse(&d, &text)))
+        check_output(&d.root, &STYLES[0], doc);
+      CHECK(heap.live > 0 || d.root.type > JSON_TYPE_STR); // Arena blocks
+      json_doc_free(&d);
+      CHECK(heap.live == 0 && heap.mismatches == 0);
+    }
+  }
+
+  // Partial trees of failed parses
+  for (size_t i = 0; i < BAD_DOC_COUNT; i++) {
+    context = BAD_DOCS[i];
+    JsonParseOptions opts = {.alloc = &alloc};
+    JsonVal val;
+    const char *text = BAD_DOCS[i];
+    CHECK(!json_parse_val_opts(&val, &text, &opts));
+    json_free_val_alloc(&val, &alloc);
+    CHECK(heap.live == 0 && heap.mismatches == 0);
+  }
+
+  // Key indexes, built while parsing or on lookup, from the same allocator
+  context = "allocated indexes";
+  char *wide = wide_records(50, 20);
+  for (unsigned flags = 0; flags <= JSON_PARSE_INDEX_KEYS;
+       flags += JSON_PARSE_INDEX_KEYS) {
+    JsonParseOptions opts = {.flags = flags, .alloc = &alloc};
+    JsonVal val;
+    const char *text = wide;
+    if (CHECK(json_parse_val_opts(&val, &text, &opts))) {
+      for (size_t i = 0; i < 50; i++)
+        json_value_by_key(val.as.arr_ptr->values[i].as.obj_ptr, "key0");
+      check_indexed_records(&val, 50, 20);
+      long indexed = heap.live;
+      json_obj_drop_index(val.as.arr_ptr->values[0].as.obj_ptr);
+      CHECK(heap.live == indexed - 1);
+    }
+    json_free_val_alloc(&val, &alloc);
+    CHECK(heap.live == 0 && heap.mismatches == 0);
+  }
+  free(wide);
+
+  const char *lines = "{\"s\":\"a\\nb\"}\n[1,\"\\u0041\"]\n[\n";
+  context = lines;
+  JsonParseOptions opts = {.alloc = &alloc, .threads = 4};
+  JsonNdjsonRecord *records;
+  size_t count;
+  CHECK(!json_parse_ndjson(lines, strlen(lines), &opts, &records, &count) &&
+        count == 3 && records[0].ok && records[1].ok && !records[2].ok);
+  json_free_ndjson_alloc(records, count, &alloc);
+  CHECK(heap.live == 0 && heap.mismatches == 0);
+}
+
+// Pools serve trees of any shape, reusing freed blocks
+// Forwards to another allocator, noting whether it is called on threads
+// other than the one that set it up
+typedef struct {
+  const JsonAllocator *base;
+  pthread_t caller;
+  atomic_bool other_thread;
+} ThreadedAlloc;
+
+static void threaded_note(ThreadedAlloc *ta) {
+  if (!pthread_equal(pthread_self(), ta->caller))
+    atomic_store(&ta->other_thread, true);
+}
+
+static void *threaded_alloc(void *ctx, size_t size) {
+  ThreadedAlloc *ta = ctx;
+  threaded_note(ta);
+  return ta->base->alloc(ta->base->ctx, size);
+}
+
+static void *threaded_resize(void *ctx, void *ptr, size_t old_size,
+                             size_t new_size) {
+  ThreadedAlloc *ta = ctx;
+  threaded_note(ta);
+  return ta->base->resize(ta->base->ctx, ptr, old_size, new_size);
+}
+
+static void threaded_release(void *ctx, void *ptr, size_t size) {
+  ThreadedAlloc *ta = ctx;
+  threaded_note(ta);
+  ta->base->release(ta->base->ctx, ptr, size);
+}
+
+static void test_pool(void) {
+  JsonPool *pool = json_pool_new();
+  JsonParseOptions opts = {.flags = JSON_PARSE_LAZY_STRINGS,
+                           .alloc = json_pool_allocator(pool)};
+  char *wide = wide_records(300, 40); // Pairs arrays larger than the classes
+  for (int round = 0; round < 20; round++) {
+    for (size_t i = 0; i <= ROUNDTRIP_DOC_COUNT; i++) {
+      const char *doc = i < ROUNDTRIP_DOC_COUNT ? ROUNDTRIP_DOCS[i] : wide;
+      context = doc;
+      JsonVal val;
+      const char *text = doc;
+      if (CHECK(json_parse_val_opts(&val, &text, &opts))) {
+        unescape_all_alloc(&val, opts.alloc);
+        if (round == 0)
+          check_output(&val, &STYLES[0], doc);
+      }
+      json_free_val_alloc(&val, opts.alloc);
+    }
+  }
+  free(wide);
+
+  // Parallel and NDJSON parsing keep their threads with the thread-safe
+  // pool, the trees are released on the calling thread
+  context = "pool threads";
+  ThreadedAlloc ta = {.base = json_pool_allocator(pool),
+                      .caller = pthread_self()};
+  atomic_init(&ta.other_thread, false);
+  JsonAllocator threaded = {threaded_alloc, threaded_resize, threaded_release,
+                            &ta, true};
+  opts = (JsonParseOptions){.threads = 4, .alloc = &threaded};
+  char *doc = wide_records(12000, 20);
+  JsonVal val;
+  const char *text = doc;
+  if (CHECK(json_parse_val_opts(&val, &text, &opts) && *text == '\0')) {
+    char *out = write_val(&val, &STYLES[0]);
+    CHECK(strcmp(out, doc) == 0);
+    free(out);
+  }
+  json_free_val_alloc(&val, &threaded);
+  CHECK(atomic_load(&ta.other_thread));
+  free(doc);
+
+  atomic_store(&ta.other_thread, false);
+  Text lines = {0};
+  text_repeat(&lines, "{\"a\":[1,2,3],\"b\":\"x\"}\n", 100000);
+  JsonNdjsonRecord *records;
+  size_t count;
+  CHECK(json_parse_ndjson(lines.buf, lines.len, &opts, &records, &count) &&
+        count == 100000);
+  json_free_ndjson_alloc(records, count, &threaded);
+  CHECK(atomic_load(&ta.other_thread));
+  free(lines.buf);
+  json_pool_free(pool);
+}
+
+static char *nested(const char *open, size_t depth, const char *inner,
+                    const char *close) {
+  Text t = {0};
+  text_repeat(&t, open, depth);
+  text_append(&t, inner, strlen(inner));
+  text_repeat(&t, close, depth);
+  return t.buf;
+}
+
+// A tree node that contains itself, for json_bind
+typedef struct {
+  long long id;
+  JsonBoundArr children;
+} Node;
+
+static const JsonSchema node_schema;
+static const JsonField node_fields[] = {
+    JSON_FIELD(Node, id, JSON_TYPE_INT),
+    JSON_FIELD_OBJ_ARR(Node, children, node_schema),
+};
+static const JsonSchema node_schema = JSON_SCHEMA(Node, node_fields);
+
+// Nesting limits of every parser, and trees far deeper than recursion could
+// handle
+static void test_depth(void) {
+  // The default limit, then a custom one on objects: the error is at the
+  // opening bracket past the limit
+  char *at_limit = nested("[", JSON_DEFAULT_MAX_DEPTH, "", "]");
+  char *past_limit = nested("[", JSON_DEFAULT_MAX_DEPTH + 1, "", "]");
+  JsonVal val;
+  context = "default limit";
+  const char *text = at_limit;
+  CHECK(json_parse_val(&val, &text) && *text == '\0');
+  json_free_val(&val);
+  text = past_limit;
+  CHECK(!json_parse_val(&val, &text) &&
+        text - past_limit == JSON_DEFAULT_MAX_DEPTH);
+  json_free_val(&val);
+  JsonSaxHandler no_events = {0};
+  text = at_limit;
+  CHECK(json_sax_parse(&text, &no_events, NULL) && *text == '\0');
+  text = past_limit;
+  CHECK(!json_sax_parse(&text, &no_events, NULL) &&
+        text - past_limit == JSON_DEFAULT_MAX_DEPTH);
+  JsonTape tape;
+  text = at_limit;
+  CHECK(json_tape_parse(&tape, &text) && *text == '\0');
+  json_tape_free(&tape);
+  text = past_limit;
+  CHECK(!json_tape_parse(&tape, &text) &&
+        text - past_limit == JSON_DEFAULT_MAX_DEPTH);
+  json_tape_free(&tape);
+  free(at_limit);
+  free(past_limit);
+
+  context = "custom limit";
+  char *ok_doc = nested("{\"a\":", 8, "1", "}");
+  char *deep_doc = nested("{\"a\":", 9, "1", "}");
+  size_t err_pos = 8 * strlen("{\"a\":");
+  JsonParseOptions opts = {.max_depth = 8};
+  text = ok_doc;
+  CHECK(json_parse_val_opts(&val, &text, &opts) && *text == '\0');
+  json_free_val(&val);
+  text = deep_doc;
+  CHECK(!json_parse_val_opts(&val, &text, &opts) &&
+        (size_t)(text - deep_doc) == err_pos);
+  json_free_val(&val);
+
+  JsonDocument d;
+  json_doc_init(&d);
+  d.opts.max_depth = 8;
+  text = deep_doc;
+  CHECK(!json_doc_parse(&d, &text) && (size_t)(text - deep_doc) == err_pos);
+  json_doc_free(&d);
+
+  JsonStream *stream = json_stream_new(&val, &opts);
+  CHECK(json_stream_feed(stream, deep_doc, strlen(deep_doc)) ==
+            JSON_STREAM_ERROR &&
+        json_stream_offset(stream) == err_pos);
+  json_stream_free(stream);
+  json_free_val(&val);
+
+  JsonNdjsonRecord *records;
+  size_t count;
+  CHECK(!json_parse_ndjson(deep_doc, strlen(deep_doc), &opts, &records,
+                           &count) &&
+        count == 1 && records[0].err_offset == err_pos);
+  json_free_ndjson(records, count);
+
+  text = ok_doc;
+  CHECK(json_sax_parse_opts(&text, &no_events, NULL, &opts) &&
+        *text == '\0');
+  text = deep_doc;
+  CHECK(!json_sax_parse_opts(&text, &no_events, NULL, &opts) &&
+        (size_t)(text - deep_doc) == err_pos);
+  text = deep_doc;
+  CHECK(!json_tape_parse_opts(&tape, &text, &opts) &&
+        (size_t)(text - deep_doc) == err_pos);
+  json_tape_free(&tape);
+  free(ok_doc);
+  free(deep_doc);
+
+  // Trees far deeper than the C stack allows for recursion: parsed with a
+  // raised limit, serialized, measured, snapshotted and freed
+  context = "deep tree";
+  size_t depth = 200000;
+  char *deep = nested("[{\"k\":", depth / 2, "[1,2]", "}]");
+  opts.max_depth = (unsigned)depth + 1;
+  text = deep;
+  if (CHECK(json_parse_val_opts(&val, &text, &opts) && *text == '\0')) {
+    char *out = write_val(&val, &STYLES[0]);
+    CHECK(strcmp(out, deep) == 0);
+    free(out);
+    CHECK(json_serialized_size(&val, &STYLES[0]) == strlen(deep));
+    JsonDocument loaded;
+    json_doc_init(&loaded);
+    CHECK(json_snapshot_save(&val, SNAPSHOT_PATH) &&
+          json_doc_load_snapshot(&loaded, SNAPSHOT_PATH) &&
+          json_serialized_size(&loaded.root, &STYLES[0]) == strlen(deep));
+    json_doc_free(&loaded);
+    remove(SNAPSHOT_PATH);
+  }
+  json_free_val(&val);
+
+  text = deep;
+  CHECK(json_sax_parse_opts(&text, &no_events, NULL, &opts) &&
+        *text == '\0');
+  text = deep;
+  CHECK(json_tape_parse_opts(&tape, &text, &opts) && *text == '\0');
+  JsonWriter w;
+  json_writer_init(&w, &STYLES[0]);
+  json_tape_write(&w, &tape, 0);
+  CHECK(strcmp(w.str, deep) == 0);
+  json_writer_free(&w);
+  json_tape_free(&tape);
+  free(deep);
+
+  // Binding with a schema that contains itself
+  context = "bind depth";
+  char *shallow = nested("{\"children\":[", 10, "{\"id\":1}", "]}");
+  char *hostile = nested("{\"children\":[", 100000, "{}", "]}");
+  Node node;
+  text = shallow;
+  CHECK(json_bind(&text, &node_schema, &node, NULL) && *text == '\0');
+  json_bind_free(&node_schema, &node);
+  opts.max_depth = 21; // Ten nodes with their arrays, and the leaf
+  text = shallow;
+  CHECK(json_bind_opts(&text, &node_schema, &node, NULL, &opts) &&
+        *text == '\0');
+  json_bind_free(&node_schema, &node);
+  opts.max_depth = 20;
+  text = shallow;
+  CHECK(!json_bind_opts(&text, &node_schema, &node, NULL, &opts) &&
+        (size_t)(text - shallow) == 10 * strlen("{\"children\":["));
+  json_bind_free(&node_schema, &node);
+  text = hostile;
+  CHECK(!json_bind(&text, &node_schema, &node, NULL) && *text == '{');
+  json_bind_free(&node_schema, &node);
+  // The value of an unknown key shares the limit with the 21 bound levels
+  // around it
+  size_t bound = 21;
+  char *hidden = nested("{\"children\":[", 10, "{\"x\":", "");
+  char *inner = nested("[", JSON_DEFAULT_MAX_DEPTH - bound, "", "]");
+  char *hostile_skip = malloc(strlen(hidden) + strlen(inner) + 30);
+  sprintf(hostile_skip, "%s[%s]}", hidden, inner);
+  for (int i = 0; i < 10; i++)
+    strcat(hostile_skip, "]}");
+  text = hostile_skip;
+  CHECK(!json_bind(&text, &node_schema, &node, NULL) &&
+        (size_t)(text - hostile_skip) ==
+            strlen(hidden) + JSON_DEFAULT_MAX_DEPTH - bound);
+  json_bind_free(&node_schema, &node);
+  sprintf(hostile_skip, "%s%s}", hidden, inner);
+  for (int i = 0; i < 10; i++)
+    strcat(hostile_skip, "]}");
+  text = hostile_skip;
+  CHECK(json_bind(&text, &node_schema, &node, NULL) && *text == '\0');
+  json_bind_free(&node_schema, &node);
+  free(hidden);
+  free(inner);
+  free(hostile_skip);
+  free(shallow);
+  free(hostile);
+}
+
+static bool same_value(const JsonVal *a, const JsonVal *b) {
+  if (a->type != b->type)
+    return false;
+  switch (a->type) {
+  case JSON_TYPE_INT:
+    return a->as.integer == b->as.integer;
+  case JSON_TYPE_FRC:
+    return memcmp(&a->as.fract, &b->as.fract, sizeof(double)) == 0;
+  case JSON_TYPE_BOL:
+    return a->as.boolean == b->as.boolean;
+  default:
+    return true; // Containers and strings by their type only
+  }
+}
+
+// Pointer lookups in trees with packed arrays answer like in plain ones
+static void test_packed_pointer(void) {
+  const char *doc =
+      "{\"ints\":[1,-2,3,9223372036854775807],\"fracts\":[0.5,-1e+300,2.0],"
+      "\"mixed\":[1,2.5],\"nested\":[[1,2],[3.5]],\"objs\":[{\"v\":[7,8]}],"
+      "\"empty\":[]}";
+  context = doc;
+  JsonVal plain, packed;
+  JsonParseOptions opts = {.flags = JSON_PARSE_PACK_NUMBERS};
+  const char *text = doc;
+  CHECK(json_parse_val(&plain, &text));
+  text = doc;
+  CHECK(json_parse_val_opts(&packed, &text, &opts));
+
+  CHECK(json_pointer_get(&packed, "/ints")->as.arr_ptr->kind ==
+        JSON_ARR_INTS);
+  CHECK(json_pointer_get(&packed, "/fracts")->as.arr_ptr->kind ==
+        JSON_ARR_FRCS);
+  CHECK(json_pointer_get(&packed, "/mixed")->as.arr_ptr->kind ==
+        JSON_ARR_VALUES);
+  CHECK(json_pointer_get(&packed, "/empty")->as.arr_ptr->kind ==
+        JSON_ARR_VALUES);
+  // No JsonVal to point to, only the copy or the array holding it
+  CHECK(json_pointer_get(&packed, "/ints/1") == NULL);
+  JsonVal *at = NULL;
+  CHECK(json_pointer_find(&packed, "/ints/1", &at) == JSON_POINTER_PACKED &&
+        at == json_pointer_get(&packed, "/ints"));
+  CHECK(json_pointer_find(&packed, "/mixed/1", &at) == JSON_POINTER_FOUND &&
+        at == json_pointer_get(&packed, "/mixed/1"));
+
+  const char *const pointers[] = {
+      "",           "/ints",      "/ints/0",   "/ints/3",    "/ints/4",
+      "/ints/01",   "/ints/-",    "/ints/0/x", "/fracts/1",  "/fracts/2",
+      "/mixed/1",   "/nested/0",  "/nested/0/1", "/nested/1/0", "/objs/0/v/1",
+      "/objs/0/v/2", "/empty/0", "/nope",     "/ints/",     "ints",
+  };
+  for (size_t i = 0; i < sizeof(pointers) / sizeof(pointers[0]); i++) {
+    context = pointers[i];
+    JsonVal *expected = json_pointer_get(&plain, pointers[i]);
+    JsonVal got;
+    bool found = json_pointer_get_val(&packed, pointers[i], &got);
+    CHECK(found == (expected != NULL));
+    CHECK((json_pointer_find(&packed, pointers[i], &at) !=
+           JSON_POINTER_NOT_FOUND) == found);
+    if (found && expected != NULL)
+      CHECK(same_value(&got, expected));
+  }
+  context = doc;
+  JsonArr *ints = json_pointer_get(&packed, "/ints")->as.arr_ptr;
+  JsonVal last = json_arr_get(ints, 3);
+  CHECK(last.type == JSON_TYPE_INT && last.as.integer == 9223372036854775807);
+
+  char *expected[STYLE_COUNT];
+  for (size_t s = 0; s < STYLE_COUNT; s++)
+    expected[s] = write_val(&plain, &STYLES[s]);
+  check_all_styles(&packed, expected);
+  for (size_t s = 0; s < STYLE_COUNT; s++)
+    free(expected[s]);
+  json_free_val(&plain);
+  json_free_val(&packed);
+}
+
+// Trees with packed arrays, built by every parser that packs, serialize like
+// plain ones: in batches, element by element when deeply nested and through
+// sink buffers of any size
+static void test_packed(void) {
+  Text t = {0};
+  text_append(&t, "[[", 2);
+  for (long long i = 0; i < 1000; i++)
+    text_printf(&t, i > 0 ? ",%lld" : "%lld", i * 1000003 - 150000000);
+  text_append(&t, "],[", 3);
+  for (long long i = 0; i < 1000; i++)
+    text_printf(&t, i > 0 ? ",%lld.25" : "%lld.25", i - 150);
+  text_append(&t, "]]", 2);
+  char *deep = nested("{\"a\":[", 70, "[1,2,3],[0.5,1e+300]", "]}");
+  // Large enough to be parsed by several threads
+  Text big = {0};
+  text_append(&big, "[", 1);
+  for (long long i = 0; i < 60000; i++)
+    text_printf(&big,
+                i > 0 ? ",[%lld,1,2,3,4,5,6,7,8]" : "[%lld,1,2,3,4,5,6,7,8]",
+                i);
+  text_append(&big, "]", 1);
+
+  JsonParseOptions opts = {.flags = JSON_PARSE_PACK_NUMBERS};
+  for (size_t i = 0; i < ROUNDTRIP_DOC_COUNT + 3; i++) {
+    const char *doc = i < ROUNDTRIP_DOC_COUNT ? ROUNDTRIP_DOCS[i]
+                      : i == ROUNDTRIP_DOC_COUNT     ? t.buf
+                      : i == ROUNDTRIP_DOC_COUNT + 1 ? deep
+                                                     : big.buf;
+    context = doc;
+    const char *text = doc;
+    JsonVal val;
+    if (!CHECK(json_parse_val(&val, &text))) {
+      json_free_val(&val);
+      continue;
+    }
+    char *expected[STYLE_COUNT];
+    for (size_t s = 0; s < STYLE_COUNT; s++)
+      expected[s] = write_val(&val, &STYLES[s]);
+    json_free_val(&val);
+
+    for (unsigned threads = 1; threads <= 4; threads += 3) {
+      opts.threads = threads;
+      text = doc;
+      if (CHECK(json_parse_val_opts(&val, &text, &opts) && *text == '\0'))
+        check_all_styles(&val, expected);
+      json_free_val(&val);
+
+      JsonDocument d;
+      json_doc_init(&d);
+      d.opts = opts;
+      text = doc;
+      if (CHECK(json_doc_parse(&d, &text) && *text == '\0')) {
+        check_all_styles(&d.root, expected);
+        JsonDocument loaded;
+        json_doc_init(&loaded);
+        if (CHECK(json_snapshot_save(&d.root, SNAPSHOT_PATH) &&
+                  json_doc_load_snapshot(&loaded, SNAPSHOT_PATH)))
+          check_output(&loaded.root, &STYLES[0], expected[0]);
+        json_doc_free(&loaded);
+        remove(SNAPSHOT_PATH);
+      }
+      json_doc_free(&d);
+    }
+
+    opts.threads = 0;
+    JsonStream *stream = json_stream_new(&val, &opts);
+    if (CHECK(feed_chunks(stream, doc, 7) == JSON_STREAM_DONE)) {
+      check_output(&val, &STYLES[0], expected[0]);
+      json_free_val(&val);
+    }
+    json_stream_free(stream);
+
+    CheckedHeap heap = {0};
+    JsonAllocator alloc = checked_allocator(&heap);
+    opts.alloc = &alloc;
+    text = doc;
+    if (CHECK(json_parse_val_opts(&val, &text, &opts)))
+      check_output(&val, &STYLES[0], expected[0]);
+    json_free_val_alloc(&val, &alloc);
+    CHECK(heap.live == 0 && heap.mismatches == 0);
+    opts.alloc = NULL;
+
+    for (size_t s = 0; s < STYLE_COUNT; s++)
+      free(expected[s]);
+  }
+  free(t.buf);
+  free(big.buf);
+  free(deep);
+}
+
+static const struct {
+  const char *name;
+  void (*run)(void);
+} GROUPS[] = {
+    {"arena", test_arena},
+    {"scan", test_scan},
+    {"numbers", test_numbers},
+    {"format", test_format},
+    {"writer", test_writer},
+    {"writer_threads", test_writer_threads},
+    {"index", test_index},
+    {"stream", test_stream},
+    {"sax", test_sax},
+    {"tape", test_tape},
+    {"parallel", test_parallel},
+    {"ndjson", test_ndjson},
+    {"ndjson_stop", test_ndjson_stop},
+    {"mmap", test_mmap},
+    {"pointer", test_pointer},
+    {"sinks", test_sinks},
+    {"measure", test_measure},
+    {"escape", test_escape},
+    {"lazy_strings", test_lazy_strings},
+    {"intern", test_intern},
+    {"bind", test_bind},
+    {"snapshot", test_snapshot},
+    {"stats", test_stats},
+    {"alloc", test_alloc},
+    {"pool", test_pool},
+    {"depth", test_depth},
+    {"packed", test_packed},
+    {"packed_pointer", test_packed_pointer},
+};
+#define GROUP_COUNT (sizeof(GROUPS) / sizeof(GROUPS[0]))
+
+int main(int argc, char **argv) {
+  for (size_t g = 0; g < GROUP_COUNT; g++) {
+    bool selected = argc < 2;
+    for (int i = 1; i < argc; i++)
+      selected |= strcmp(argv[i], GROUPS[g].name) == 0;
+    if (!selected)
+      continue;
+    int before = failures;
+    GROUPS[g].run();
+    printf("%s: %s\n", GROUPS[g].name, failures == before ? "ok" : "FAILED");
+  }
+  for (int i = 1; i < argc; i++) {
+    bool known = false;
+    for (size_t g = 0; g < GROUP_COUNT; g++)
+      known |= strcmp(argv[i], GROUPS[g].name) == 0;
+    if (!known) {
+      fprintf(stderr, "unknown group %s\n", argv[i]);
+      failures++;
+    }
+  }
+  return failures != 0;
+}